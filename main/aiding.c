@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "driver/uart.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+#include "storage.h"
+#include "uart2.h"
+#include "aiding.h"
+
+static const char *TAG = "aiding";
+
+static RTC_NOINIT_ATTR aiding_state_t rtc_state; // survives a software reset
+
+static aiding_state_t state;
+static SemaphoreHandle_t lock;
+
+static uint32_t saved_ts; // state.ts as last written to NVS
+static bool injected;
+static bool fixed;        // TTFF taken this boot
+static uint8_t given;     // AIDING_POS/TIME sent this boot
+static const char *source = "none";
+
+static uint32_t state_crc(const aiding_state_t *s)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)s + sizeof(s->crc), sizeof(*s) - sizeof(s->crc));
+}
+
+static bool state_valid(const aiding_state_t *s)
+{
+  return s->magic == AIDING_MAGIC && s->crc == state_crc(s);
+}
+
+/* call with the lock held */
+static void state_save(void)
+{
+  nvs_handle_t nvs;
+
+  if (nvs_open("gps", NVS_READWRITE, &nvs) != ESP_OK)
+    return;
+
+  if (nvs_set_blob(nvs, "aid", &state, sizeof(state)) == ESP_OK &&
+      nvs_commit(nvs) == ESP_OK)
+    saved_ts = state.ts;
+
+  nvs_close(nvs);
+}
+
+static void aiding_flush(void)
+{
+  if (!lock)
+    return;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (state.ts != saved_ts)
+    state_save();
+  xSemaphoreGive(lock);
+}
+
+static void send_nmea(const char *body)
+{
+  uint8_t cs = 0;
+  for (const char *p = body; *p; p++)
+    cs ^= (uint8_t)*p;
+
+  char line[96];
+  int n = snprintf(line, sizeof(line), "$%s*%02X\r\n", body, cs);
+  uart_write_bytes(UART2_PORT, line, n);
+}
+
+static void send_ubx(uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+  uint8_t frame[8 + 32];
+  uint8_t a = 0, b = 0;
+
+  frame[0] = 0xB5;
+  frame[1] = 0x62;
+  frame[2] = cls;
+  frame[3] = id;
+  frame[4] = len & 0xff;
+  frame[5] = len >> 8;
+  memcpy(frame + 6, payload, len);
+
+  for (int i = 2; i < 6 + len; i++)
+  {
+    a += frame[i];
+    b += a;
+  }
+
+  frame[6 + len] = a;
+  frame[7 + len] = b;
+
+  uart_write_bytes(UART2_PORT, frame, 8 + len);
+}
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/* UBX-MGA-INI-POS_LLH */
+static void ubx_pos(const aiding_state_t *s)
+{
+  uint8_t p[20] = {0x01, 0x00};
+
+  put_u32(p + 4, s->lat);
+  put_u32(p + 8, s->lon);
+  put_u32(p + 12, s->alt * 10); // cm
+  put_u32(p + 16, AIDING_POS_ACC_M * 100);
+
+  send_ubx(0x13, 0x40, p, sizeof(p));
+}
+
+/* UBX-MGA-INI-TIME_UTC, leap seconds unknown */
+static void ubx_time(const struct tm *t)
+{
+  uint8_t p[24] = {0x10, 0x00, 0x00, 0x80};
+
+  put_u16(p + 4, t->tm_year + 1900);
+  p[6] = t->tm_mon + 1;
+  p[7] = t->tm_mday;
+  p[8] = t->tm_hour;
+  p[9] = t->tm_min;
+  p[10] = t->tm_sec;
+  put_u16(p + 16, 2); // tAccS
+
+  send_ubx(0x13, 0x40, p, sizeof(p));
+}
+
+void aiding_inject(void)
+{
+  if (injected || !lock)
+    return;
+
+  injected = true;
+
+  if (devcfg.gps_aid == AIDING_OFF)
+    return;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  aiding_state_t s = state;
+  xSemaphoreGive(lock);
+
+  /* the clock only survives a software reset; after power-on it starts at 0 */
+  time_t now = time(NULL);
+  bool have_time = s.ts && now >= (time_t)s.ts;
+  bool have_pos = s.ts && (!have_time || now - s.ts < AIDING_MAX_AGE_S);
+
+  struct tm t;
+  gmtime_r(&now, &t);
+
+  char body[96];
+
+  if (devcfg.gps_aid == AIDING_PMTK)
+  {
+    /* MTK takes a position only together with the time */
+    if (have_time && have_pos)
+    {
+      snprintf(body, sizeof(body), "PMTK741,%.6f,%.6f,%ld,%04d,%02d,%02d,%02d,%02d,%02d",
+               s.lat * 1e-7, s.lon * 1e-7, (long)(s.alt / 10),
+               t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+      send_nmea(body);
+      given = AIDING_POS | AIDING_TIME;
+    }
+    else if (have_time)
+    {
+      snprintf(body, sizeof(body), "PMTK740,%04d,%02d,%02d,%02d,%02d,%02d",
+               t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+      send_nmea(body);
+      given = AIDING_TIME;
+    }
+  }
+  else if (devcfg.gps_aid == AIDING_UBX)
+  {
+    if (have_time)
+    {
+      ubx_time(&t);
+      given |= AIDING_TIME;
+    }
+    if (have_pos)
+    {
+      ubx_pos(&s);
+      given |= AIDING_POS;
+    }
+  }
+
+  ESP_LOGI(TAG, "sent %s%s (%s)",
+           given & AIDING_POS ? "position " : "",
+           given & AIDING_TIME ? "time" : given ? "" : "nothing", source);
+}
+
+void aiding_update(const gps_data_t *g)
+{
+  if (!lock || !g->fix)
+    return;
+
+  time_t ts = gps_epoch(g);
+  if (ts <= 0)
+    return;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  state.ts = (uint32_t)ts;
+  state.lat = (int32_t)lround(g->latitude * 1e7);
+  state.lon = (int32_t)lround(g->longitude * 1e7);
+  state.alt = (int32_t)lroundf(g->altitude * 10);
+  state.sats = g->satellites > 255 ? 255 : g->satellites;
+
+  bool save = ts - saved_ts >= AIDING_SAVE_S;
+
+  if (!fixed)
+  {
+    int64_t ds = esp_timer_get_time() / 100000;
+
+    state.ttff_ds[state.head] = ds > 65535 ? 65535 : ds;
+    state.ttff_flags[state.head] = given;
+    state.head = (state.head + 1) % AIDING_TTFF_HISTORY;
+    if (state.count < AIDING_TTFF_HISTORY)
+      state.count++;
+
+    fixed = true;
+    save = true;
+
+    ESP_LOGI(TAG, "first fix after %lld.%lld s", ds / 10, ds % 10);
+  }
+
+  state.crc = state_crc(&state);
+  rtc_state = state;
+
+  if (save)
+    state_save();
+
+  xSemaphoreGive(lock);
+}
+
+void aiding_stats_str(char *out, size_t len)
+{
+  if (!lock)
+  {
+    snprintf(out, len, "-");
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  /* averages over the history, split by whether the boot was aided */
+  uint32_t sum[2] = {0}, n[2] = {0};
+
+  for (int i = 0; i < state.count; i++)
+  {
+    int k = state.ttff_flags[i] != 0;
+    sum[k] += state.ttff_ds[i];
+    n[k]++;
+  }
+
+  int last = (state.head + AIDING_TTFF_HISTORY - 1) % AIDING_TTFF_HISTORY;
+
+  if (!fixed)
+    snprintf(out, len, "no fix yet, ");
+  else
+    snprintf(out, len, "ttff %u.%u s%s, ",
+             state.ttff_ds[last] / 10, state.ttff_ds[last] % 10,
+             state.ttff_flags[last] ? " aided" : "");
+
+  size_t used = strlen(out);
+  snprintf(out + used, len - used, "avg aided %lu.%lu s (%lu) / unaided %lu.%lu s (%lu), from %s",
+           n[1] ? (unsigned long)(sum[1] / n[1] / 10) : 0, n[1] ? (unsigned long)(sum[1] / n[1] % 10) : 0,
+           (unsigned long)n[1],
+           n[0] ? (unsigned long)(sum[0] / n[0] / 10) : 0, n[0] ? (unsigned long)(sum[0] / n[0] % 10) : 0,
+           (unsigned long)n[0], source);
+
+  xSemaphoreGive(lock);
+}
+
+void aiding_start(void)
+{
+  if (state_valid(&rtc_state))
+  {
+    state = rtc_state;
+    source = "rtc";
+  }
+  else
+  {
+    nvs_handle_t nvs;
+    size_t size = sizeof(state);
+
+    if (nvs_open("gps", NVS_READONLY, &nvs) == ESP_OK)
+    {
+      if (nvs_get_blob(nvs, "aid", &state, &size) == ESP_OK &&
+          size == sizeof(state) && state_valid(&state))
+        source = "nvs";
+      nvs_close(nvs);
+    }
+
+    if (strcmp(source, "nvs") != 0)
+    {
+      memset(&state, 0, sizeof(state));
+      state.magic = AIDING_MAGIC;
+    }
+  }
+
+  saved_ts = state.ts;
+
+  /* uart2 is already running; it starts using the state from here on */
+  lock = xSemaphoreCreateMutex();
+
+  esp_register_shutdown_handler(aiding_flush);
+
+  ESP_LOGI(TAG, "last fix %lu from %s", (unsigned long)state.ts, source);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "nmea_parser.h"
+
+/*
+ * Warm-start aiding for the GPS receiver.
+ *
+ * The last good fix is kept in RTC memory on every epoch, which survives
+ * a software reset or an OTA reboot, and in NVS every AIDING_SAVE_S so a
+ * power cycle has something too. When the receiver first talks after boot
+ * the position, and the time if the clock survived the reset, are sent
+ * back to it over UART2 TX as PMTK741/740 or UBX-MGA-INI, picked by the
+ * gps_aid config field.
+ *
+ * Time to first fix is recorded every boot, aided or not, with the last
+ * AIDING_TTFF_HISTORY kept alongside the fix so the two can be compared.
+ */
+
+#define AIDING_MAGIC 0x41494431 // "AID1"
+#define AIDING_SAVE_S 900
+#define AIDING_TTFF_HISTORY 8
+#define AIDING_MAX_AGE_S (14 * 24 * 3600) // older positions aren't sent
+#define AIDING_POS_ACC_M 1000
+
+#define AIDING_OFF 0
+#define AIDING_PMTK 1
+#define AIDING_UBX 2
+
+/* what a boot was given; flags of a TTFF sample */
+#define AIDING_POS 0x01
+#define AIDING_TIME 0x02
+
+typedef struct
+{
+  uint32_t crc; // over the rest
+  uint32_t magic;
+  uint32_t ts;  // UTC seconds of the fix, 0 = none yet
+  int32_t lat;  // 1e-7 degrees
+  int32_t lon;  // 1e-7 degrees
+  int32_t alt;  // decimetres
+  uint8_t sats;
+  uint8_t head; // next ttff slot
+  uint8_t count;
+  uint8_t reserved;
+  uint16_t ttff_ds[AIDING_TTFF_HISTORY]; // deciseconds from boot
+  uint8_t ttff_flags[AIDING_TTFF_HISTORY];
+} aiding_state_t;
+
+void aiding_start(void);
+
+/* once the receiver is up; no-op after the first call */
+void aiding_inject(void);
+
+/* every parsed epoch */
+void aiding_update(const gps_data_t *g);
+
+void aiding_stats_str(char *out, size_t len);
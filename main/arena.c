@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+
+#include "arena.h"
+
+static const char *TAG = "arena";
+
+typedef struct
+{
+  TaskHandle_t owner;
+  size_t lo; // free space is [lo, hi)
+  size_t hi;
+} arena_t;
+
+static uint8_t pool[ARENA_COUNT][ARENA_SIZE] __attribute__((aligned(8)));
+static arena_t arenas[ARENA_COUNT];
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buf;
+
+static struct
+{
+  uint32_t requests;
+  uint32_t busy;     // no arena free, request ran on malloc
+  uint32_t fallback; // mallocs
+  size_t peak;
+} stats;
+
+static arena_t *arena_current(void)
+{
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+  for (int i = 0; i < ARENA_COUNT; i++)
+    if (arenas[i].owner == self)
+      return &arenas[i];
+
+  return NULL;
+}
+
+static void arena_note_use(arena_t *a)
+{
+  size_t used = a->lo + ARENA_SIZE - a->hi;
+  if (used > stats.peak)
+    stats.peak = used;
+}
+
+void arena_init(void)
+{
+  lock = xSemaphoreCreateMutexStatic(&lock_buf);
+
+  cJSON_Hooks hooks = {
+      .malloc_fn = arena_alloc,
+      .free_fn = arena_free};
+  cJSON_InitHooks(&hooks);
+
+  ESP_LOGI(TAG, "%d x %d bytes", ARENA_COUNT, ARENA_SIZE);
+}
+
+bool arena_begin(void)
+{
+  arena_t *a = NULL;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  for (int i = 0; i < ARENA_COUNT && !a; i++)
+  {
+    if (!arenas[i].owner)
+    {
+      a = &arenas[i];
+      a->owner = xTaskGetCurrentTaskHandle();
+      a->lo = 0;
+      a->hi = ARENA_SIZE;
+    }
+  }
+
+  stats.requests++;
+  if (!a)
+    stats.busy++;
+
+  xSemaphoreGive(lock);
+
+  return a != NULL;
+}
+
+void arena_end(void)
+{
+  arena_t *a = arena_current();
+
+  if (a)
+  {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    a->owner = NULL;
+    xSemaphoreGive(lock);
+  }
+}
+
+void *arena_alloc(size_t n)
+{
+  arena_t *a = arena_current();
+
+  n = (n + 7) & ~7;
+
+  if (a && a->hi - a->lo >= n)
+  {
+    void *p = pool[a - arenas] + a->lo;
+    a->lo += n;
+    arena_note_use(a);
+    return p;
+  }
+
+  stats.fallback++;
+  return malloc(n);
+}
+
+void arena_free(void *p)
+{
+  /* arena memory goes back in one piece at arena_end */
+  if ((uint8_t *)p >= &pool[0][0] && (uint8_t *)p < &pool[ARENA_COUNT][0])
+    return;
+
+  free(p);
+}
+
+char *arena_print(cJSON *root)
+{
+  arena_t *a = arena_current();
+
+  if (a)
+  {
+    char *buf = (char *)pool[a - arenas] + a->lo;
+
+    if (cJSON_PrintPreallocated(root, buf, a->hi - a->lo, 0))
+    {
+      size_t len = strlen(buf) + 1;
+      size_t hi = (a->hi - len) & ~7;
+      char *out = (char *)pool[a - arenas] + hi;
+
+      memmove(out, buf, len);
+      a->hi = hi;
+      arena_note_use(a);
+      return out;
+    }
+  }
+
+  return cJSON_PrintUnformatted(root);
+}
+
+void arena_trim(void)
+{
+  arena_t *a = arena_current();
+
+  if (a)
+    a->lo = 0;
+}
+
+void arena_stats_str(char *out, size_t len)
+{
+  snprintf(out, len, "peak %u/%d B, %lu/%lu busy, %lu malloc",
+           (unsigned)stats.peak, ARENA_SIZE,
+           (unsigned long)stats.busy, (unsigned long)stats.requests,
+           (unsigned long)stats.fallback);
+}
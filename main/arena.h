@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+/*
+ * Per-request arenas carved from a static pool.
+ *
+ * A task handling a request binds an arena (arena_begin) and every cJSON
+ * node, request body and deflate state it needs comes out of it with a
+ * pointer bump; arena_end hands the whole thing back at once. Nothing is
+ * freed piecemeal, so request handling neither fragments the heap nor
+ * depends on it. Allocations from a task without an arena, or that don't
+ * fit, fall back to malloc and are counted.
+ *
+ * Printed JSON goes to the top of the arena (arena_print), so once the
+ * tree is deleted everything below it can be dropped (arena_trim) and the
+ * space reused while the response is compressed and sent.
+ */
+
+#define ARENA_COUNT 3     // httpd task + HTTP_WORKERS
+#define ARENA_SIZE 16384
+
+void arena_init(void); // also installs the cJSON hooks
+
+bool arena_begin(void);
+void arena_end(void);
+
+void *arena_alloc(size_t n);
+void arena_free(void *p);
+
+char *arena_print(cJSON *root);
+void arena_trim(void);
+
+void arena_stats_str(char *out, size_t len);
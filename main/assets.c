@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "assets.h"
+
+static const char *TAG = "assets";
+
+static const esp_partition_t *part;
+static SemaphoreHandle_t lock; // held while a response is sent from the mapping
+
+static const uint8_t *map; // NULL unless a valid bundle is mapped
+static esp_partition_mmap_handle_t map_handle;
+
+static struct
+{
+  bool active;
+  size_t size;
+  size_t written;
+} upload;
+
+static struct
+{
+  uint32_t count;
+  uint32_t size;
+  uint32_t crc;
+  uint32_t served;
+  int64_t mount_us;
+} stats;
+
+static bool assets_check(const uint8_t *p, size_t avail)
+{
+  const assets_header_t *h = (const assets_header_t *)p;
+  const assets_entry_t *e = (const assets_entry_t *)(p + sizeof(*h));
+
+  if (memcmp(h->magic, ASSETS_MAGIC, 4) != 0 ||
+      h->size < sizeof(*h) || h->size > avail ||
+      h->count > (h->size - sizeof(*h)) / sizeof(*e))
+    return false;
+
+  if (esp_rom_crc32_le(0, p + sizeof(*h), h->size - sizeof(*h)) != h->crc)
+    return false;
+
+  for (uint32_t i = 0; i < h->count; i++)
+  {
+    if (e[i].path[ASSETS_PATH_MAX - 1] ||
+        e[i].offset > h->size || e[i].size > h->size - e[i].offset)
+      return false;
+  }
+
+  return true;
+}
+
+/* call with the lock held */
+static esp_err_t assets_mount(void)
+{
+  int64_t t0 = esp_timer_get_time();
+  const void *ptr;
+
+  esp_err_t err = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA,
+                                     &ptr, &map_handle);
+  if (err != ESP_OK)
+    return err;
+
+  if (!assets_check(ptr, part->size))
+  {
+    esp_partition_munmap(map_handle);
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  const assets_header_t *h = ptr;
+
+  map = ptr;
+  stats.count = h->count;
+  stats.size = h->size;
+  stats.crc = h->crc;
+  stats.mount_us = esp_timer_get_time() - t0;
+
+  ESP_LOGI(TAG, "%lu files, %lu bytes, checked in %lld us",
+           (unsigned long)h->count, (unsigned long)h->size, stats.mount_us);
+
+  return ESP_OK;
+}
+
+static void assets_unmount(void)
+{
+  if (!map)
+    return;
+
+  esp_partition_munmap(map_handle);
+  map = NULL;
+}
+
+bool assets_get(const char *path, asset_t *a)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  if (map)
+  {
+    const assets_header_t *h = (const assets_header_t *)map;
+    const assets_entry_t *e = (const assets_entry_t *)(map + sizeof(*h));
+
+    for (uint32_t i = 0; i < h->count; i++)
+    {
+      if (strncmp(e[i].path, path, ASSETS_PATH_MAX) != 0)
+        continue;
+
+      a->data = map + e[i].offset;
+      a->size = e[i].size;
+      a->crc = e[i].crc;
+      a->flags = e[i].flags;
+      stats.served++;
+      return true; // still locked
+    }
+  }
+
+  xSemaphoreGive(lock);
+  return false;
+}
+
+void assets_release(void)
+{
+  xSemaphoreGive(lock);
+}
+
+esp_err_t assets_begin(size_t size)
+{
+  if (!part)
+    return ESP_ERR_NOT_FOUND;
+  if (size < sizeof(assets_header_t) || size > part->size)
+    return ESP_ERR_INVALID_SIZE;
+
+  /* waits for a response still being sent from the old bundle */
+  xSemaphoreTake(lock, portMAX_DELAY);
+  assets_unmount();
+  xSemaphoreGive(lock);
+
+  esp_err_t err = esp_partition_erase_range(part, 0, (size + 4095) & ~4095);
+  if (err != ESP_OK)
+    return err;
+
+  upload.active = true;
+  upload.size = size;
+  upload.written = 0;
+
+  return ESP_OK;
+}
+
+esp_err_t assets_write(const void *data, size_t len)
+{
+  if (!upload.active)
+    return ESP_ERR_INVALID_STATE;
+  if (len > upload.size - upload.written)
+    return ESP_ERR_INVALID_SIZE;
+
+  esp_err_t err = esp_partition_write(part, upload.written, data, len);
+  if (err == ESP_OK)
+    upload.written += len;
+
+  return err;
+}
+
+esp_err_t assets_finish(void)
+{
+  if (!upload.active)
+    return ESP_ERR_INVALID_STATE;
+
+  upload.active = false;
+
+  if (upload.written != upload.size)
+    return ESP_ERR_INVALID_SIZE;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  esp_err_t err = assets_mount();
+  xSemaphoreGive(lock);
+
+  return err;
+}
+
+void assets_abort(void)
+{
+  /* whatever was written fails the CRC; the embedded page takes over */
+  upload.active = false;
+}
+
+void assets_stats_str(char *out, size_t len)
+{
+  if (!map)
+    snprintf(out, len, "no bundle, built-in index");
+  else
+    snprintf(out, len, "%lu files, %lu B, crc %08lx, checked in %lld us, %lu served",
+             (unsigned long)stats.count, (unsigned long)stats.size,
+             (unsigned long)stats.crc, stats.mount_us, (unsigned long)stats.served);
+}
+
+void assets_start(void)
+{
+  lock = xSemaphoreCreateMutex();
+
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "www");
+  if (!part)
+  {
+    ESP_LOGW(TAG, "no www partition");
+    return;
+  }
+
+  if (assets_mount() != ESP_OK)
+    ESP_LOGW(TAG, "no valid bundle, serving the built-in index");
+}
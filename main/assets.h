@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+/*
+ * Web UI assets from the "www" data partition.
+ *
+ * The partition holds a read-only bundle built by tools/www_bundle.py: a
+ * header, an index of fixed-size entries and the (usually gzipped) files
+ * back to back. It is memory-mapped once and responses are sent straight
+ * out of the mapping. A bundle can be replaced on its own over HTTP, so a
+ * UI change doesn't need a firmware update; while there is no valid
+ * bundle the index page compiled into the app is served instead.
+ */
+
+#define ASSETS_MAGIC "WWW1"
+#define ASSETS_PATH_MAX 32
+#define ASSETS_GZIP 0x01 // entry flag: stored gzipped
+
+typedef struct
+{
+  char magic[4];
+  uint32_t count;
+  uint32_t size; // whole bundle
+  uint32_t crc;  // CRC-32 of everything after the header
+} assets_header_t;
+
+typedef struct
+{
+  char path[ASSETS_PATH_MAX]; // no leading slash, NUL padded
+  uint32_t offset;            // from the start of the bundle
+  uint32_t size;
+  uint32_t crc; // of the stored bytes, used as the ETag
+  uint32_t flags;
+} assets_entry_t;
+
+typedef struct
+{
+  const uint8_t *data; // in the mapped partition
+  uint32_t size;
+  uint32_t crc;
+  uint32_t flags;
+} asset_t;
+
+void assets_start(void);
+
+/* true: *a is valid and the bundle stays mapped until assets_release() */
+bool assets_get(const char *path, asset_t *a);
+void assets_release(void);
+
+/* bundle upload; the old bundle is gone from assets_begin() on */
+esp_err_t assets_begin(size_t size);
+esp_err_t assets_write(const void *data, size_t len);
+esp_err_t assets_finish(void);
+void assets_abort(void);
+
+void assets_stats_str(char *out, size_t len);
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "boot.h"
+
+static const char *TAG = "boot";
+
+static const char *const names[BOOT_STAGES] = {
+    [BOOT_CONFIG] = "config",
+    [BOOT_UART] = "uart",
+    [BOOT_UART_RX] = "rx",
+    [BOOT_DATA] = "data",
+    [BOOT_NETWORK] = "net",
+    [BOOT_WEB] = "web",
+    [BOOT_STA_IP] = "ip",
+    [BOOT_TCP_SERVED] = "tcp",
+    [BOOT_HTTP_SERVED] = "http",
+};
+
+#define BOOT_BIT(stage) (1u << (stage))
+
+static uint32_t stamp_ms[BOOT_STAGES];
+static EventGroupHandle_t boot_events;
+
+void boot_mark(boot_stage_t stage)
+{
+  /* first call comes from app_main before any other task exists */
+  if (!boot_events)
+    boot_events = xEventGroupCreate();
+
+  if (xEventGroupGetBits(boot_events) & BOOT_BIT(stage))
+    return;
+
+  stamp_ms[stage] = esp_timer_get_time() / 1000;
+  xEventGroupSetBits(boot_events, BOOT_BIT(stage));
+
+  ESP_LOGI(TAG, "%s at %lu ms", names[stage], (unsigned long)stamp_ms[stage]);
+}
+
+void boot_wait(boot_stage_t stage)
+{
+  xEventGroupWaitBits(boot_events, BOOT_BIT(stage), pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+void boot_timeline_str(char *out, size_t len)
+{
+  EventBits_t bits = boot_events ? xEventGroupGetBits(boot_events) : 0;
+  size_t used = 0;
+  out[0] = 0;
+
+  for (int i = 0; i < BOOT_STAGES && used < len; i++)
+  {
+    if (!(bits & BOOT_BIT(i)))
+      continue;
+
+    used += snprintf(out + used, len - used, "%s%s %lu",
+                     used ? ", " : "", names[i], (unsigned long)stamp_ms[i]);
+  }
+
+  if (used < len)
+    snprintf(out + used, len - used, " ms");
+}
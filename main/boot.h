@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/*
+ * Staged startup and the boot timeline.
+ *
+ * UART capture starts as soon as the config is loaded; the network and
+ * web server come up in their own task while the flash-backed modules
+ * recover in app_main. Until then received bytes wait in the stream ring,
+ * and the first bridge client after boot is given all of them.
+ *
+ * Each milestone is stamped once, in milliseconds since the app started
+ * (the bootloader's time before that isn't included).
+ */
+
+typedef enum
+{
+  BOOT_CONFIG,      // config loaded
+  BOOT_UART,        // capture running
+  BOOT_UART_RX,     // first byte from the receiver
+  BOOT_DATA,        // track, aiding and assets recovered
+  BOOT_NETWORK,     // Wi-Fi started, sockets usable
+  BOOT_WEB,         // HTTP server listening
+  BOOT_STA_IP,      // station got an address
+  BOOT_TCP_SERVED,  // first byte to a bridge client
+  BOOT_HTTP_SERVED, // first HTTP response
+  BOOT_STAGES
+} boot_stage_t;
+
+void boot_mark(boot_stage_t stage);
+void boot_wait(boot_stage_t stage);
+
+void boot_timeline_str(char *out, size_t len);
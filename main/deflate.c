@@ -0,0 +1,268 @@
+#include <string.h>
+
+#include "esp_rom_crc.h"
+
+#include "deflate.h"
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void out_byte(deflate_stream_t *s, uint8_t b)
+{
+  s->out[s->outlen++] = b;
+  s->total_out++;
+
+  if (s->outlen == sizeof(s->out))
+  {
+    if (s->err == ESP_OK)
+      s->err = s->sink(s->ctx, (const char *)s->out, s->outlen);
+    s->outlen = 0;
+  }
+}
+
+static void put_bits(deflate_stream_t *s, uint32_t value, int n)
+{
+  s->bitbuf |= value << s->bitcnt;
+  s->bitcnt += n;
+
+  while (s->bitcnt >= 8)
+  {
+    out_byte(s, s->bitbuf & 0xFF);
+    s->bitbuf >>= 8;
+    s->bitcnt -= 8;
+  }
+}
+
+/* Huffman codes go out MSB first, everything else LSB first */
+static void put_code(deflate_stream_t *s, uint32_t code, int n)
+{
+  uint32_t rev = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    rev = (rev << 1) | (code & 1);
+    code >>= 1;
+  }
+
+  put_bits(s, rev, n);
+}
+
+static void put_litlen(deflate_stream_t *s, int sym)
+{
+  if (sym < 144)
+    put_code(s, 0x30 + sym, 8);
+  else if (sym < 256)
+    put_code(s, 0x190 + sym - 144, 9);
+  else if (sym < 280)
+    put_code(s, sym - 256, 7);
+  else
+    put_code(s, 0xC0 + sym - 280, 8);
+}
+
+static void put_match(deflate_stream_t *s, int len, int dist)
+{
+  int i = 28;
+  while (len_base[i] > len)
+    i--;
+
+  put_litlen(s, 257 + i);
+  put_bits(s, len - len_base[i], len_extra[i]);
+
+  i = 29;
+  while (dist_base[i] > dist)
+    i--;
+
+  put_code(s, i, 5);
+  put_bits(s, dist - dist_base[i], dist_extra[i]);
+}
+
+static inline uint32_t hash3(const uint8_t *p)
+{
+  uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/* greedy single-probe LZ77 over win[from, wend) */
+static void compress_range(deflate_stream_t *s, size_t from)
+{
+  size_t p = from;
+
+  while (p < s->wend)
+  {
+    size_t avail = s->wend - p;
+    int best = 0;
+    size_t dist = 0;
+
+    if (avail >= MIN_MATCH)
+    {
+      uint32_t h = hash3(&s->win[p]);
+      int cand = (int)s->head[h] - 1;
+      s->head[h] = p + 1;
+
+      if (cand >= 0 && p - cand <= DEFLATE_WINDOW)
+      {
+        size_t max = avail < MAX_MATCH ? avail : MAX_MATCH;
+        while (best < max && s->win[cand + best] == s->win[p + best])
+          best++;
+        dist = p - cand;
+      }
+    }
+
+    if (best >= MIN_MATCH)
+    {
+      put_match(s, best, dist);
+
+      for (int i = 1; i < best && avail - i >= MIN_MATCH; i++)
+        s->head[hash3(&s->win[p + i])] = p + i + 1;
+
+      p += best;
+    }
+    else
+    {
+      put_litlen(s, s->win[p]);
+      p++;
+    }
+  }
+}
+
+static void slide(deflate_stream_t *s)
+{
+  memmove(s->win, s->win + DEFLATE_WINDOW, DEFLATE_WINDOW);
+  s->wend -= DEFLATE_WINDOW;
+
+  for (int i = 0; i < HASH_SIZE; i++)
+    s->head[i] = s->head[i] > DEFLATE_WINDOW ? s->head[i] - DEFLATE_WINDOW : 0;
+}
+
+static void adler_update(deflate_stream_t *s, const uint8_t *p, size_t len)
+{
+  uint32_t a = s->adler & 0xFFFF;
+  uint32_t b = s->adler >> 16;
+
+  while (len)
+  {
+    size_t n = len < 5552 ? len : 5552;
+    len -= n;
+    while (n--)
+    {
+      a += *p++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+
+  s->adler = (b << 16) | a;
+}
+
+void deflate_begin(deflate_stream_t *s, deflate_format_t format,
+                   deflate_sink_t sink, void *ctx)
+{
+  memset(s->head, 0, sizeof(s->head));
+  s->format = format;
+  s->sink = sink;
+  s->ctx = ctx;
+  s->err = ESP_OK;
+  s->wend = 0;
+  s->bitbuf = 0;
+  s->bitcnt = 0;
+  s->outlen = 0;
+  s->crc = 0;
+  s->adler = 1;
+  s->total_in = 0;
+  s->total_out = 0;
+
+  if (format == DEFLATE_GZIP)
+  {
+    static const uint8_t hdr[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+    for (int i = 0; i < sizeof(hdr); i++)
+      out_byte(s, hdr[i]);
+  }
+  else
+  {
+    out_byte(s, 0x78); // CM=8, 32K window
+    out_byte(s, 0x01); // fastest, FCHECK
+  }
+
+  /* one open-ended fixed block; closed in deflate_end */
+  put_bits(s, 0, 1); // BFINAL
+  put_bits(s, 1, 2); // BTYPE = fixed
+}
+
+esp_err_t deflate_write(deflate_stream_t *s, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+
+  if (s->format == DEFLATE_GZIP)
+    s->crc = esp_rom_crc32_le(s->crc, p, len);
+  else
+    adler_update(s, p, len);
+
+  s->total_in += len;
+
+  while (len && s->err == ESP_OK)
+  {
+    if (s->wend == sizeof(s->win))
+      slide(s);
+
+    size_t n = sizeof(s->win) - s->wend;
+    if (n > len)
+      n = len;
+
+    size_t from = s->wend;
+    memcpy(&s->win[s->wend], p, n);
+    s->wend += n;
+    compress_range(s, from);
+
+    p += n;
+    len -= n;
+  }
+
+  return s->err;
+}
+
+esp_err_t deflate_end(deflate_stream_t *s)
+{
+  put_litlen(s, 256); // end of block
+
+  put_bits(s, 1, 1); // empty final block
+  put_bits(s, 1, 2);
+  put_litlen(s, 256);
+
+  if (s->bitcnt)
+    put_bits(s, 0, 8 - s->bitcnt);
+
+  if (s->format == DEFLATE_GZIP)
+  {
+    for (int i = 0; i < 4; i++)
+      out_byte(s, s->crc >> (8 * i));
+    for (int i = 0; i < 4; i++)
+      out_byte(s, s->total_in >> (8 * i));
+  }
+  else
+  {
+    for (int i = 3; i >= 0; i--)
+      out_byte(s, s->adler >> (8 * i));
+  }
+
+  if (s->outlen && s->err == ESP_OK)
+    s->err = s->sink(s->ctx, (const char *)s->out, s->outlen);
+  s->outlen = 0;
+
+  return s->err;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/*
+ * Small streaming deflate encoder (RFC 1951, fixed Huffman blocks) with a
+ * bounded LZ77 window, wrapped as zlib (RFC 1950) or gzip (RFC 1952).
+ * State is ~7 KB and lives wherever the caller puts it.
+ */
+
+#define DEFLATE_WINDOW 2048 // max match distance, power of two
+#define DEFLATE_HASH_BITS 10
+#define DEFLATE_OUT_SIZE 512
+
+/* responses smaller than this are not worth compressing */
+#define DEFLATE_MIN_SIZE 256
+
+typedef enum
+{
+  DEFLATE_ZLIB, // "Content-Encoding: deflate"
+  DEFLATE_GZIP, // "Content-Encoding: gzip"
+} deflate_format_t;
+
+typedef esp_err_t (*deflate_sink_t)(void *ctx, const char *data, size_t len);
+
+typedef struct
+{
+  deflate_format_t format;
+  deflate_sink_t sink;
+  void *ctx;
+  esp_err_t err;
+
+  uint8_t win[2 * DEFLATE_WINDOW];
+  uint16_t head[1 << DEFLATE_HASH_BITS];
+  size_t wend;
+
+  uint32_t bitbuf;
+  int bitcnt;
+  uint8_t out[DEFLATE_OUT_SIZE];
+  size_t outlen;
+
+  uint32_t crc;   // gzip
+  uint32_t adler; // zlib
+
+  uint32_t total_in;
+  uint32_t total_out;
+} deflate_stream_t;
+
+void deflate_begin(deflate_stream_t *s, deflate_format_t format,
+                   deflate_sink_t sink, void *ctx);
+esp_err_t deflate_write(deflate_stream_t *s, const void *data, size_t len);
+esp_err_t deflate_end(deflate_stream_t *s);
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp32/rom/miniz.h"
+#include "mbedtls/sha256.h"
+
+#include "delta.h"
+
+static const char *TAG = "delta";
+
+enum
+{
+  OP_COPY,
+  OP_ADD,
+  OP_INSERT,
+};
+
+enum
+{
+  ST_HEADER,
+  ST_OP,
+  ST_ARGS,
+  ST_DATA,
+  ST_DONE,
+};
+
+static struct
+{
+  bool active;
+  bool ota_started;
+  int state;
+
+  uint8_t hdr[DELTA_HDR_SIZE];
+  size_t hdr_len;
+  uint32_t src_size;
+  uint32_t dst_size;
+  uint8_t dst_sha[32];
+  const esp_partition_t *src;
+
+  tinfl_decompressor *inf;
+  uint8_t *dict; // inflate output window
+  size_t dict_ofs;
+  uint8_t *work; // DELTA_CHUNK
+
+  uint8_t op;
+  uint8_t args[8];
+  size_t args_len;
+  uint32_t off;
+  uint32_t left;
+
+  uint32_t patch_size;
+  uint32_t out;
+} delta;
+
+static void delta_free(void)
+{
+  free(delta.inf);
+  free(delta.dict);
+  free(delta.work);
+  delta.inf = NULL;
+  delta.dict = NULL;
+  delta.work = NULL;
+  delta.active = false;
+}
+
+/* the patch must have been made against exactly what we are running */
+static esp_err_t delta_check_source(const uint8_t *sha)
+{
+  delta.src = esp_ota_get_running_partition();
+  if (!delta.src || delta.src_size > delta.src->size)
+    return ESP_ERR_INVALID_VERSION;
+
+  mbedtls_sha256_context ctx;
+  uint8_t got[32];
+
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+
+  for (uint32_t off = 0; off < delta.src_size; off += DELTA_CHUNK)
+  {
+    size_t n = delta.src_size - off < DELTA_CHUNK ? delta.src_size - off : DELTA_CHUNK;
+    esp_partition_read(delta.src, off, delta.work, n);
+    mbedtls_sha256_update(&ctx, delta.work, n);
+  }
+
+  mbedtls_sha256_finish(&ctx, got);
+  mbedtls_sha256_free(&ctx);
+
+  if (memcmp(got, sha, 32) != 0)
+  {
+    ESP_LOGE(TAG, "patch is for a different source image");
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t delta_header(void)
+{
+  uint8_t src_sha[32];
+
+  if (memcmp(delta.hdr, DELTA_MAGIC, 4) != 0)
+    return ESP_ERR_INVALID_ARG;
+
+  memcpy(&delta.src_size, delta.hdr + 4, 4);
+  memcpy(src_sha, delta.hdr + 8, 32);
+  memcpy(&delta.dst_size, delta.hdr + 40, 4);
+  memcpy(delta.dst_sha, delta.hdr + 44, 32);
+
+  /* an empty image can't be valid; refuse before the slot is opened */
+  if (delta.dst_size == 0)
+    return ESP_ERR_INVALID_SIZE;
+
+  esp_err_t err = delta_check_source(src_sha);
+  if (err != ESP_OK)
+    return err;
+
+  ESP_LOGI(TAG, "source %s ok, rebuilding %lu bytes",
+           delta.src->label, (unsigned long)delta.dst_size);
+
+  err = ota_begin(delta.dst_size);
+  delta.ota_started = err == ESP_OK;
+
+  return err;
+}
+
+/* dst += src[off:off+n] (+ diff) */
+static esp_err_t delta_emit_src(const uint8_t *diff, size_t n)
+{
+  esp_err_t err = esp_partition_read(delta.src, delta.off, delta.work, n);
+
+  if (diff)
+    for (size_t i = 0; i < n; i++)
+      delta.work[i] += diff[i];
+
+  if (err == ESP_OK)
+    err = ota_write(delta.work, n);
+
+  delta.off += n;
+  return err;
+}
+
+static esp_err_t delta_args(void)
+{
+  if (delta.op == OP_INSERT)
+  {
+    memcpy(&delta.left, delta.args, 4);
+  }
+  else
+  {
+    memcpy(&delta.off, delta.args, 4);
+    memcpy(&delta.left, delta.args + 4, 4);
+
+    if (delta.off > delta.src_size || delta.left > delta.src_size - delta.off)
+      return ESP_ERR_INVALID_ARG;
+  }
+
+  if (delta.left > delta.dst_size - delta.out)
+    return ESP_ERR_INVALID_SIZE;
+
+  delta.out += delta.left;
+
+  if (delta.op == OP_COPY)
+  {
+    while (delta.left)
+    {
+      size_t n = delta.left < DELTA_CHUNK ? delta.left : DELTA_CHUNK;
+      esp_err_t err = delta_emit_src(NULL, n);
+      if (err != ESP_OK)
+        return err;
+      delta.left -= n;
+    }
+  }
+
+  delta.state = delta.left ? ST_DATA : ST_OP;
+  return ESP_OK;
+}
+
+/* runs the inflated operation stream, split anywhere */
+static esp_err_t delta_ops(const uint8_t *p, size_t len)
+{
+  esp_err_t err = ESP_OK;
+
+  while (len && err == ESP_OK)
+  {
+    switch (delta.state)
+    {
+    case ST_OP:
+      delta.op = *p++;
+      len--;
+      if (delta.op > OP_INSERT)
+        return ESP_ERR_INVALID_ARG;
+      delta.args_len = 0;
+      delta.state = ST_ARGS;
+      break;
+
+    case ST_ARGS:
+    {
+      size_t need = (delta.op == OP_INSERT ? 4 : 8) - delta.args_len;
+      size_t n = len < need ? len : need;
+
+      memcpy(delta.args + delta.args_len, p, n);
+      delta.args_len += n;
+      p += n;
+      len -= n;
+
+      if (n == need)
+        err = delta_args();
+      break;
+    }
+
+    case ST_DATA:
+    {
+      size_t n = len < delta.left ? len : delta.left;
+      if (n > DELTA_CHUNK)
+        n = DELTA_CHUNK;
+
+      if (delta.op == OP_INSERT)
+        err = ota_write(p, n);
+      else
+        err = delta_emit_src(p, n);
+
+      p += n;
+      len -= n;
+      delta.left -= n;
+      if (!delta.left)
+        delta.state = ST_OP;
+      break;
+    }
+
+    default:
+      return ESP_ERR_INVALID_SIZE; // data after the end of the stream
+    }
+  }
+
+  return err;
+}
+
+static esp_err_t delta_inflate(const uint8_t *in, size_t len)
+{
+  for (;;)
+  {
+    size_t in_n = len;
+    size_t out_n = TINFL_LZ_DICT_SIZE - delta.dict_ofs;
+
+    tinfl_status st = tinfl_decompress(delta.inf, in, &in_n,
+                                       delta.dict, delta.dict + delta.dict_ofs, &out_n,
+                                       TINFL_FLAG_HAS_MORE_INPUT);
+    in += in_n;
+    len -= in_n;
+
+    esp_err_t err = delta_ops(delta.dict + delta.dict_ofs, out_n);
+    if (err != ESP_OK)
+      return err;
+
+    delta.dict_ofs = (delta.dict_ofs + out_n) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (st < 0)
+      return ESP_ERR_INVALID_ARG;
+
+    if (st == TINFL_STATUS_DONE)
+    {
+      if (delta.state != ST_OP)
+        return ESP_ERR_INVALID_SIZE;
+      delta.state = ST_DONE;
+      return ESP_OK;
+    }
+
+    if (st == TINFL_STATUS_NEEDS_MORE_INPUT)
+      return ESP_OK;
+  }
+}
+
+esp_err_t delta_begin(void)
+{
+  if (delta.active)
+    return ESP_ERR_INVALID_STATE;
+
+  memset(&delta, 0, sizeof(delta));
+
+  delta.inf = malloc(sizeof(tinfl_decompressor));
+  delta.dict = malloc(TINFL_LZ_DICT_SIZE);
+  delta.work = malloc(DELTA_CHUNK);
+
+  if (!delta.inf || !delta.dict || !delta.work)
+  {
+    delta_free();
+    return ESP_ERR_NO_MEM;
+  }
+
+  tinfl_init(delta.inf);
+  delta.state = ST_HEADER;
+  delta.active = true;
+
+  return ESP_OK;
+}
+
+esp_err_t delta_write(const void *data, size_t len)
+{
+  const uint8_t *p = data;
+
+  delta.patch_size += len;
+
+  if (delta.state == ST_HEADER)
+  {
+    size_t n = DELTA_HDR_SIZE - delta.hdr_len;
+    if (n > len)
+      n = len;
+
+    memcpy(delta.hdr + delta.hdr_len, p, n);
+    delta.hdr_len += n;
+    p += n;
+    len -= n;
+
+    if (delta.hdr_len < DELTA_HDR_SIZE)
+      return ESP_OK;
+
+    esp_err_t err = delta_header();
+    if (err != ESP_OK)
+      return err;
+
+    delta.state = ST_OP;
+  }
+
+  if (!len)
+    return ESP_OK;
+
+  if (delta.state == ST_DONE)
+    return ESP_ERR_INVALID_SIZE;
+
+  return delta_inflate(p, len);
+}
+
+esp_err_t delta_finish(ota_result_t *res)
+{
+  if (delta.state != ST_DONE || delta.out != delta.dst_size)
+  {
+    delta_abort();
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  esp_err_t err = ota_finish(delta.dst_sha, res);
+
+  ESP_LOGI(TAG, "patch %lu B -> image %lu B (%lu%%)",
+           (unsigned long)delta.patch_size, (unsigned long)delta.dst_size,
+           delta.dst_size ? (unsigned long)((uint64_t)delta.patch_size * 100 / delta.dst_size) : 0);
+
+  delta_free();
+  return err;
+}
+
+void delta_abort(void)
+{
+  if (delta.ota_started)
+    ota_abort();
+
+  delta.ota_started = false;
+  delta_free();
+}
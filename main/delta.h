@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "ota.h"
+
+/*
+ * Delta OTA: rebuilds a new image from the running app slot and a patch
+ * made by tools/delta_ota.py, streaming the result through ota.c into the
+ * other slot. The patch header names the exact source image (size and
+ * SHA-256, checked against the running slot before anything is erased)
+ * and the resulting one (checked by ota_finish before it is made
+ * bootable). The operations follow as a raw deflate stream, inflated with
+ * the ROM inflater.
+ */
+
+#define DELTA_MAGIC "EDP1"
+#define DELTA_HDR_SIZE 76 // magic, src size + sha256, dst size + sha256
+#define DELTA_CHUNK 1024  // source read / add granularity
+
+esp_err_t delta_begin(void);
+esp_err_t delta_write(const void *data, size_t len); // patch bytes, any split
+esp_err_t delta_finish(ota_result_t *res);
+void delta_abort(void);
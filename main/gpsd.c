@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+
+#include "cJSON.h"
+
+#include "arena.h"
+#include "stream.h"
+#include "powersave.h"
+#include "uart2.h"
+#include "gpsd.h"
+
+static const char *TAG = "gpsd";
+
+typedef struct
+{
+  int fd; // -1 if the slot is free
+  bool json;
+  bool nmea;
+  uint32_t epoch; // last one sent
+
+  uint32_t cursor; // stream ring, while nmea
+  uint32_t dropped;
+
+  char cmd[GPSD_CMD_MAX];
+  size_t cmd_len;
+  char line[GPSD_LINE_MAX]; // sentence being assembled
+  size_t line_len;
+  bool midline;  // joined the ring inside a sentence
+  bool overflow; // sentence longer than line, skipped to its end
+} gpsd_client_t;
+
+static gpsd_client_t clients[GPSD_MAX_CLIENTS];
+
+/* under the lock */
+static SemaphoreHandle_t lock;
+static gps_data_t latest;
+static uint32_t epochs;
+
+/* task only */
+static gps_data_t fix;
+static char out[1024];
+static size_t out_len;
+static bool out_failed;
+
+static struct
+{
+  uint32_t accepted;
+  uint32_t refused;
+  uint32_t requests;
+  uint32_t reports; // TPV + SKY pairs
+  uint32_t sentences;
+  uint32_t too_long; // sentences not passed on
+} stats;
+
+void gpsd_epoch(const gps_data_t *g)
+{
+  if (!lock)
+    return;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  latest = *g;
+  epochs++;
+  xSemaphoreGive(lock);
+}
+
+static void client_flush(gpsd_client_t *c)
+{
+  size_t off = 0;
+
+  while (off < out_len && !out_failed)
+  {
+    int n = send(c->fd, out + off, out_len - off, 0);
+    if (n <= 0)
+      out_failed = true;
+    else
+      off += n;
+  }
+
+  out_len = 0;
+}
+
+static void client_put(gpsd_client_t *c, const char *data, size_t len)
+{
+  while (len)
+  {
+    if (out_len == sizeof(out))
+      client_flush(c);
+
+    size_t n = sizeof(out) - out_len;
+    if (n > len)
+      n = len;
+
+    memcpy(out + out_len, data, n);
+    out_len += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static void client_printf(gpsd_client_t *c, const char *fmt, ...)
+{
+  char buf[160];
+  va_list ap;
+
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  if (n > 0)
+    client_put(c, buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+/* ISO 8601 with milliseconds, or nothing without a date */
+static void put_time(gpsd_client_t *c, const gps_data_t *g)
+{
+  time_t t = gps_epoch(g);
+  if (t <= 0)
+    return;
+
+  struct tm tm;
+  gmtime_r(&t, &tm);
+
+  const char *dot = strchr(g->utc_time, '.');
+  int ms = dot ? (int)(atof(dot) * 1000 + 0.5) : 0;
+
+  client_printf(c, ",\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ\"",
+                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                tm.tm_hour, tm.tm_min, tm.tm_sec, ms);
+}
+
+static int tpv_mode(const gps_data_t *g)
+{
+  if (!g->fix)
+    return 1;
+  if (g->mode >= 2)
+    return g->mode;
+  return g->satellites >= 4 ? 3 : 2; // no GSA from this receiver
+}
+
+static void put_version(gpsd_client_t *c)
+{
+  client_printf(c, "{\"class\":\"VERSION\",\"release\":\"%s\",\"rev\":\"esp32-uart2-bridge\","
+                   "\"proto_major\":%d,\"proto_minor\":%d}\r\n",
+                GPSD_RELEASE, GPSD_PROTO_MAJOR, GPSD_PROTO_MINOR);
+}
+
+static void put_device(gpsd_client_t *c)
+{
+  client_printf(c, "{\"class\":\"DEVICE\",\"path\":\"%s\",\"driver\":\"NMEA0183\",\"activated\":\"\","
+                   "\"flags\":1,\"native\":0,\"bps\":%d,\"parity\":\"N\",\"stopbits\":1,\"cycle\":1.00}",
+                GPSD_DEVICE, UART2_BAUD_RATE);
+}
+
+static void put_devices(gpsd_client_t *c)
+{
+  client_printf(c, "{\"class\":\"DEVICES\",\"devices\":[");
+  put_device(c);
+  client_printf(c, "]}\r\n");
+}
+
+static void put_watch(gpsd_client_t *c)
+{
+  client_printf(c, "{\"class\":\"WATCH\",\"enable\":%s,\"json\":%s,\"nmea\":%s,\"raw\":%d,"
+                   "\"scaled\":false,\"timing\":false,\"split24\":false,\"pps\":false}\r\n",
+                c->json || c->nmea ? "true" : "false",
+                c->json ? "true" : "false",
+                c->nmea ? "true" : "false",
+                c->nmea ? 1 : 0);
+}
+
+static void put_tpv(gpsd_client_t *c, const gps_data_t *g)
+{
+  int mode = tpv_mode(g);
+
+  client_printf(c, "{\"class\":\"TPV\",\"device\":\"%s\",\"mode\":%d", GPSD_DEVICE, mode);
+  put_time(c, g);
+
+  if (mode >= 2)
+    client_printf(c, ",\"lat\":%.9f,\"lon\":%.9f,\"speed\":%.3f,\"track\":%.1f",
+                  g->latitude, g->longitude, g->speed_knots * 0.514444f, g->course);
+  if (mode == 3)
+    client_printf(c, ",\"alt\":%.3f,\"altMSL\":%.3f", g->altitude, g->altitude);
+
+  client_printf(c, "}");
+}
+
+static void put_sky(gpsd_client_t *c, const gps_data_t *g)
+{
+  /* gpsd's gnssid for our system index */
+  static const int gnssid[GPS_SYSTEMS] = {0, 6, 2, 3};
+  int used = 0;
+
+  for (int i = 0; i < g->sats_count; i++)
+    used += gps_sat_used(g, &g->sats[i]);
+
+  client_printf(c, "{\"class\":\"SKY\",\"device\":\"%s\"", GPSD_DEVICE);
+  put_time(c, g);
+  if (g->mode)
+    client_printf(c, ",\"hdop\":%.2f,\"pdop\":%.2f,\"vdop\":%.2f", g->hdop, g->pdop, g->vdop);
+  client_printf(c, ",\"nSat\":%d,\"uSat\":%d,\"satellites\":[", g->sats_count, used);
+
+  for (int i = 0; i < g->sats_count; i++)
+  {
+    const gps_sat_t *s = &g->sats[i];
+
+    client_printf(c, "%s{\"PRN\":%d,\"gnssid\":%d,\"svid\":%d", i ? "," : "",
+                  s->prn, gnssid[s->system], s->prn);
+    if (s->elevation >= 0)
+      client_printf(c, ",\"el\":%d.0", s->elevation);
+    if (s->azimuth >= 0)
+      client_printf(c, ",\"az\":%d.0", s->azimuth);
+    if (s->snr >= 0)
+      client_printf(c, ",\"ss\":%d.0", s->snr);
+    client_printf(c, ",\"used\":%s}", gps_sat_used(g, s) ? "true" : "false");
+  }
+
+  client_printf(c, "]}");
+}
+
+static void put_poll(gpsd_client_t *c, const gps_data_t *g, bool have)
+{
+  client_printf(c, "{\"class\":\"POLL\"");
+  put_time(c, g);
+  client_printf(c, ",\"active\":%d,\"tpv\":[", have);
+  if (have)
+    put_tpv(c, g);
+  client_printf(c, "],\"sky\":[");
+  if (have)
+    put_sky(c, g);
+  client_printf(c, "]}\r\n");
+}
+
+static void watch(gpsd_client_t *c, const char *arg)
+{
+  /* the tree comes out of an arena, not the heap */
+  if (arg)
+    arena_begin();
+
+  cJSON *doc = arg ? cJSON_Parse(arg) : NULL;
+
+  if (arg && !doc)
+  {
+    arena_end();
+    client_printf(c, "{\"class\":\"ERROR\",\"message\":\"Invalid WATCH: %.64s\"}\r\n", arg);
+    return;
+  }
+
+  if (doc)
+  {
+    bool enable = !cJSON_IsFalse(cJSON_GetObjectItem(doc, "enable"));
+    cJSON *json = cJSON_GetObjectItem(doc, "json");
+    cJSON *nmea = cJSON_GetObjectItem(doc, "nmea");
+    cJSON *raw = cJSON_GetObjectItem(doc, "raw");
+    bool was_nmea = c->nmea;
+
+    if (!enable)
+    {
+      c->json = c->nmea = false;
+    }
+    else
+    {
+      /* gpsd's default for a bare enable is JSON */
+      if (json)
+        c->json = cJSON_IsTrue(json);
+      else if (!nmea && !raw)
+        c->json = true;
+
+      if (nmea || raw)
+        c->nmea = cJSON_IsTrue(nmea) || (cJSON_IsNumber(raw) && raw->valueint > 0);
+    }
+
+    if (c->nmea && !was_nmea)
+    {
+      c->cursor = stream_head();
+      c->line_len = 0;
+      c->midline = true;
+      c->overflow = false;
+    }
+
+    cJSON_Delete(doc);
+    arena_end();
+
+    /* the current fix goes out at the next epoch */
+    xSemaphoreTake(lock, portMAX_DELAY);
+    c->epoch = epochs;
+    xSemaphoreGive(lock);
+
+    put_devices(c);
+  }
+
+  put_watch(c);
+}
+
+static void request(gpsd_client_t *c, char *cmd)
+{
+  while (isspace((unsigned char)*cmd))
+    cmd++;
+
+  if (!*cmd)
+    return;
+
+  stats.requests++;
+
+  char *arg = strchr(cmd, '=');
+  if (arg)
+    *arg++ = 0;
+
+  if (strcmp(cmd, "?WATCH") == 0)
+  {
+    watch(c, arg);
+  }
+  else if (strcmp(cmd, "?VERSION") == 0)
+  {
+    put_version(c);
+  }
+  else if (strcmp(cmd, "?DEVICES") == 0)
+  {
+    put_devices(c);
+  }
+  else if (strcmp(cmd, "?POLL") == 0)
+  {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool have = epochs > 0;
+    fix = latest;
+    xSemaphoreGive(lock);
+
+    put_poll(c, &fix, have);
+  }
+  else
+  {
+    client_printf(c, "{\"class\":\"ERROR\",\"message\":\"Unrecognized request '%.32s'\"}\r\n", cmd);
+  }
+}
+
+/* false when the client went away */
+static bool client_read(gpsd_client_t *c)
+{
+  char buf[128];
+  int len = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+  if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    return false;
+
+  for (int i = 0; i < len; i++)
+  {
+    char ch = buf[i];
+
+    if (ch == ';' || ch == '\n' || ch == '\r')
+    {
+      c->cmd[c->cmd_len] = 0;
+      request(c, c->cmd);
+      c->cmd_len = 0;
+    }
+    else if (c->cmd_len < sizeof(c->cmd) - 1)
+    {
+      c->cmd[c->cmd_len++] = ch;
+    }
+  }
+
+  return true;
+}
+
+/* whole sentences only, so a report never lands inside one */
+static void client_nmea(gpsd_client_t *c)
+{
+  uint8_t buf[STREAM_REC_MAX];
+  uint8_t type;
+  size_t n;
+
+  while (!out_failed && (n = stream_read(&c->cursor, STREAM_RAW, &type,
+                                         buf, sizeof(buf), &c->dropped)) > 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      char ch = buf[i];
+
+      if (c->midline)
+      {
+        c->midline = ch != '\n';
+        continue;
+      }
+
+      if (c->line_len < sizeof(c->line))
+        c->line[c->line_len++] = ch;
+      else
+        c->overflow = true;
+
+      if (ch == '\n')
+      {
+        /* a cut sentence would run into the next one */
+        if (c->overflow)
+          stats.too_long++;
+        else
+          client_put(c, c->line, c->line_len);
+
+        c->line_len = 0;
+        c->overflow = false;
+        stats.sentences++;
+      }
+    }
+  }
+}
+
+static void client_close(gpsd_client_t *c)
+{
+  close(c->fd);
+  c->fd = -1;
+  powersave_release();
+
+  ESP_LOGI(TAG, "client disconnected (dropped %lu bytes)", (unsigned long)c->dropped);
+}
+
+static void client_accept(int listen_sock)
+{
+  int fd = accept(listen_sock, NULL, NULL);
+  if (fd < 0)
+    return;
+
+  gpsd_client_t *c = NULL;
+  for (int i = 0; i < GPSD_MAX_CLIENTS && !c; i++)
+    if (clients[i].fd < 0)
+      c = &clients[i];
+
+  if (!c)
+  {
+    close(fd);
+    stats.refused++;
+    return;
+  }
+
+  /* a stalled reader is dropped rather than holding up the others */
+  struct timeval tv = {.tv_sec = 1};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  memset(c, 0, sizeof(*c));
+  c->fd = fd;
+  stats.accepted++;
+  powersave_hold();
+
+  out_failed = false;
+  put_version(c);
+  client_flush(c);
+
+  if (out_failed)
+    client_close(c);
+  else
+    ESP_LOGI(TAG, "client connected");
+}
+
+static void gpsd_task(void *arg)
+{
+  int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(GPSD_PORT),
+      .sin_addr.s_addr = INADDR_ANY};
+
+  if (listen_sock < 0 ||
+      bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_sock, 2) < 0)
+  {
+    ESP_LOGE(TAG, "cannot listen on TCP %d", GPSD_PORT);
+    vTaskDelete(NULL);
+    return;
+  }
+
+  while (1)
+  {
+    fd_set rfds;
+    int maxfd = listen_sock;
+
+    FD_ZERO(&rfds);
+    FD_SET(listen_sock, &rfds);
+    for (int i = 0; i < GPSD_MAX_CLIENTS; i++)
+    {
+      if (clients[i].fd < 0)
+        continue;
+      FD_SET(clients[i].fd, &rfds);
+      if (clients[i].fd > maxfd)
+        maxfd = clients[i].fd;
+    }
+
+    /* raw sentences are polled, so this is also their latency */
+    struct timeval tv = {.tv_usec = 50 * 1000};
+    if (select(maxfd + 1, &rfds, NULL, NULL, &tv) < 0)
+    {
+      vTaskDelay(pdMS_TO_TICKS(50));
+      continue;
+    }
+
+    if (FD_ISSET(listen_sock, &rfds))
+      client_accept(listen_sock);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t epoch = epochs;
+    bool fresh = false;
+    for (int i = 0; i < GPSD_MAX_CLIENTS; i++)
+      fresh |= clients[i].fd >= 0 && clients[i].json && clients[i].epoch != epoch;
+    if (fresh)
+      fix = latest;
+    xSemaphoreGive(lock);
+
+    for (int i = 0; i < GPSD_MAX_CLIENTS; i++)
+    {
+      gpsd_client_t *c = &clients[i];
+
+      if (c->fd < 0)
+        continue;
+
+      out_failed = false;
+
+      if (FD_ISSET(c->fd, &rfds) && !client_read(c))
+      {
+        client_close(c);
+        continue;
+      }
+
+      if (c->nmea)
+        client_nmea(c);
+
+      if (c->json && c->epoch != epoch)
+      {
+        c->epoch = epoch;
+        put_tpv(c, &fix);
+        client_put(c, "\r\n", 2);
+        put_sky(c, &fix);
+        client_put(c, "\r\n", 2);
+        stats.reports++;
+      }
+
+      client_flush(c);
+
+      if (out_failed)
+        client_close(c);
+    }
+  }
+}
+
+void gpsd_stats_str(char *out, size_t len)
+{
+  int active = 0;
+
+  for (int i = 0; i < GPSD_MAX_CLIENTS; i++)
+    active += clients[i].fd >= 0;
+
+  snprintf(out, len, "%d clients, %lu accepted (%lu refused), %lu requests, %lu reports, %lu sentences (%lu too long)",
+           active, (unsigned long)stats.accepted, (unsigned long)stats.refused,
+           (unsigned long)stats.requests, (unsigned long)stats.reports,
+           (unsigned long)stats.sentences, (unsigned long)stats.too_long);
+}
+
+void gpsd_start(void)
+{
+  for (int i = 0; i < GPSD_MAX_CLIENTS; i++)
+    clients[i].fd = -1;
+
+  lock = xSemaphoreCreateMutex();
+
+  xTaskCreate(gpsd_task, "gpsd", 4096, NULL, 5, NULL);
+
+  ESP_LOGI(TAG, "gpsd on port %d", GPSD_PORT);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "nmea_parser.h"
+
+/*
+ * gpsd JSON protocol on TCP 2947, so cgps, gpspipe and OpenCPN can talk to
+ * the bridge without a gpsd on the host.
+ *
+ * A client gets VERSION on connect and then asks for data with
+ * ?WATCH={"enable":true,"json":true} (TPV and SKY once per epoch, from the
+ * parsed fix) and/or "nmea":true or "raw":1 (the UART sentences as they
+ * arrive, read from the stream ring). ?POLL, ?DEVICES and ?VERSION are
+ * answered too. JSON is only ever written between whole sentences.
+ */
+
+#define GPSD_PORT 2947
+#define GPSD_MAX_CLIENTS 4
+#define GPSD_CMD_MAX 256     // longest request line
+#define GPSD_LINE_MAX 100    // longer sentences are dropped, not cut
+#define GPSD_DEVICE "/dev/uart2"
+#define GPSD_RELEASE "3.25"
+#define GPSD_PROTO_MAJOR 3
+#define GPSD_PROTO_MINOR 15
+
+void gpsd_start(void); // needs the network stack
+
+/* every RMC */
+void gpsd_epoch(const gps_data_t *g);
+
+void gpsd_stats_str(char *out, size_t len);
@@ -1,12 +1,56 @@
+#include "aiding.h"
+#include "arena.h"
+#include "assets.h"
+#include "boot.h"
+#include "gpsd.h"
+#include "stream.h"
 #include "storage.h"
 #include "network.h"
+#include "ntp.h"
+#include "outbox.h"
+#include "publisher.h"
+#include "track.h"
+#include "uploader.h"
 #include "webserver.h"
 #include "uart2.h"
 
-void app_main(void)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static void network_task(void *arg)
 {
-    storage_start();
     network_start();
+    boot_mark(BOOT_NETWORK);
+
+    uart2_bridge_start();
+    ntp_start();
+    gpsd_start();
+    uploader_start();
+    publisher_start();
+
+    /* the web server reads the asset bundle */
+    boot_wait(BOOT_DATA);
     webserver_start();
+    boot_mark(BOOT_WEB);
+
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    stream_init();
+    arena_init();
+    storage_start();
+    boot_mark(BOOT_CONFIG);
+
+    /* capture first; bytes wait in the stream ring until someone reads them */
     uart2_start();
+
+    xTaskCreate(network_task, "network_start", 4096, NULL, 5, NULL);
+
+    track_start();
+    outbox_start();
+    aiding_start();
+    assets_start();
+    boot_mark(BOOT_DATA);
 }
@@ -1,3 +1,5 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
@@ -8,9 +10,22 @@
 #include "esp_sntp.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "mbedtls/pkcs5.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 
 #include "storage.h"
 #include "network.h"
+#include "boot.h"
+#include "powersave.h"
 
 static const char *TAG = "network";
 
@@ -21,14 +36,237 @@ static int retry_count = 0;
 static bool sta_enabled = true;
 static bool sntp_started = false;
 
-static int get_retry_delay_ms(int retry)
+#define SCAN_DONE_BIT BIT0
+
+static wifi_ap_record_t scan_records[SCAN_MAX_AP];
+static uint16_t scan_count = 0;
+static int64_t scan_time_us = 0; // 0 = no result yet
+static uint32_t scan_seq = 0;
+static SemaphoreHandle_t scan_lock;
+static EventGroupHandle_t scan_events;
+static TaskHandle_t scan_task_handle;
+
+ESP_EVENT_DEFINE_BASE(NETWORK_EVENT);
+
+enum
+{
+  NETWORK_EVENT_PROBE, // carries the esp_timer time it was posted at
+};
+
+static volatile network_state_t state = NETWORK_IDLE;
+static EventGroupHandle_t state_events;
+static network_notify_t subscribers[NETWORK_MAX_SUBSCRIBERS];
+static int subscriber_count;
+
+static esp_timer_handle_t retry_timer;
+static esp_timer_handle_t probe_timer;
+static esp_timer_handle_t cache_timer;
+static esp_timer_handle_t ap_timer;
+
+static wifi_config_t sta_config;
+static RTC_NOINIT_ATTR network_cache_t rtc_cache;
+static network_cache_t cache;
+static bool directed;      // current attempt skips the scan
+static bool use_pmk;       // and hands the driver the cached PMK
+static int64_t offline_us; // when an online STA dropped, 0 = not timing
+
+static struct
+{
+  uint32_t reconnects;
+  uint32_t probes[2]; // [online]
+  int64_t lag_us[2];
+  int64_t lag_max_us[2];
+  int64_t handler_max_us; // longest time wifi_event_handler held the loop
+  uint32_t fast_ok;
+  uint32_t fast_failed;
+  uint32_t outages;
+  int64_t outage_last_us; // disconnect to IP again
+  int64_t outage_sum_us;
+  int64_t outage_max_us;
+} stats;
+
+static const char *const state_names[] = {
+    [NETWORK_IDLE] = "idle",
+    [NETWORK_CONNECTING] = "connecting",
+    [NETWORK_BACKOFF] = "backoff",
+    [NETWORK_ONLINE] = "online",
+};
+
+static void set_state(network_state_t s)
+{
+  if (state == s)
+    return;
+
+  state = s;
+
+  if (s == NETWORK_ONLINE)
+    xEventGroupSetBits(state_events, NETWORK_ONLINE_BIT);
+  else
+    xEventGroupClearBits(state_events, NETWORK_ONLINE_BIT);
+
+  for (int i = 0; i < subscriber_count; i++)
+    subscribers[i](s);
+
+  /* the soft-AP comes back at once, goes a while after the STA is online */
+  esp_timer_stop(ap_timer);
+  esp_timer_start_once(ap_timer, s == NETWORK_ONLINE ? NETWORK_AP_OFF_MS * 1000LL : 0);
+}
+
+static uint32_t cache_crc(const network_cache_t *c)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)c + sizeof(c->crc), sizeof(*c) - sizeof(c->crc));
+}
+
+/* identifies the network the cache belongs to */
+static uint32_t credentials_crc(void)
+{
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)devcfg.sta_ssid, strlen(devcfg.sta_ssid) + 1);
+  return esp_rom_crc32_le(crc, (const uint8_t *)devcfg.sta_key, strlen(devcfg.sta_key));
+}
+
+static bool cache_load(const network_cache_t *c)
+{
+  if (c->magic != NETWORK_CACHE_MAGIC || c->crc != cache_crc(c) ||
+      c->credentials != credentials_crc())
+    return false;
+
+  cache = *c;
+  return true;
+}
+
+/* esp_timer task: keeps the NVS write off the event loop */
+static void cache_timer_cb(void *arg)
+{
+  nvs_handle_t nvs;
+
+  if (nvs_open("wifi", NVS_READWRITE, &nvs) != ESP_OK)
+    return;
+
+  nvs_set_blob(nvs, "cache", &cache, sizeof(cache));
+  nvs_commit(nvs);
+  nvs_close(nvs);
+}
+
+static void cache_store(void)
+{
+  cache.crc = cache_crc(&cache);
+  rtc_cache = cache;
+  esp_timer_stop(cache_timer);
+  esp_timer_start_once(cache_timer, 0);
+}
+
+/*
+ * The WPA2 PMK is PBKDF2 over the passphrase, close to a second of CPU
+ * on every association. Computed once per passphrase and handed to the
+ * driver as a 64 hex digit key, which it uses as is. WPA3 (SAE) can't use
+ * it, so it only goes to the cached AP after a WPA2-PSK association there.
+ */
+static void cache_pmk(void)
 {
-  if (retry < 5)
-    return 2000; // fast
-  else if (retry < 10)
-    return 5000; // medium
+  size_t len = strlen(devcfg.sta_key);
+
+  if (cache.has_pmk || len < 8 || len > 63)
+    return;
+
+  int64_t t0 = esp_timer_get_time();
+
+  if (mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA1,
+                                    (const unsigned char *)devcfg.sta_key, len,
+                                    (const unsigned char *)devcfg.sta_ssid, strlen(devcfg.sta_ssid),
+                                    4096, sizeof(cache.pmk), cache.pmk) != 0)
+    return;
+
+  cache.has_pmk = 1;
+  cache_store();
+
+  ESP_LOGI(TAG, "PMK derived in %lld ms", (esp_timer_get_time() - t0) / 1000);
+}
+
+/* a known AP gets a connect on its channel only; anything else a full scan */
+static void sta_prepare(bool fast)
+{
+  directed = fast && cache.has_ap;
+
+  sta_config.sta.bssid_set = directed;
+  sta_config.sta.channel = directed ? cache.channel : 0;
+  sta_config.sta.scan_method = directed ? WIFI_FAST_SCAN : WIFI_ALL_CHANNEL_SCAN;
+  if (directed)
+    memcpy(sta_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+
+  use_pmk = directed && cache.has_pmk && cache.pmk_ok;
+  if (use_pmk)
+  {
+    char hex[2 * sizeof(cache.pmk) + 1];
+    for (int i = 0; i < sizeof(cache.pmk); i++)
+      sprintf(hex + 2 * i, "%02x", cache.pmk[i]);
+    memcpy(sta_config.sta.password, hex, sizeof(sta_config.sta.password));
+  }
   else
-    return 15000; // slow forever
+  {
+    strncpy((char *)sta_config.sta.password,
+            devcfg.sta_key,
+            sizeof(sta_config.sta.password));
+  }
+
+  esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+}
+
+/* exponential with equal jitter, so a roomful of bridges don't retry in step */
+static int get_retry_delay_ms(int retry)
+{
+  int ms = NETWORK_RETRY_MIN_MS << (retry < 5 ? retry : 5);
+  if (ms > NETWORK_RETRY_MAX_MS)
+    ms = NETWORK_RETRY_MAX_MS;
+
+  return ms / 2 + esp_random() % (ms / 2 + 1);
+}
+
+static void sta_connect(void)
+{
+  set_state(NETWORK_CONNECTING);
+
+  esp_err_t err = esp_wifi_connect();
+  if (err == ESP_OK)
+    return;
+
+  /* no disconnect event will follow, so back off from here */
+  retry_count++;
+  int delay_ms = get_retry_delay_ms(retry_count - 1);
+
+  ESP_LOGW(TAG, "connect: %s → retry #%d in %d ms",
+           esp_err_to_name(err), retry_count, delay_ms);
+
+  set_state(NETWORK_BACKOFF);
+  esp_timer_stop(retry_timer);
+  esp_timer_start_once(retry_timer, delay_ms * 1000LL);
+}
+
+static void retry_timer_cb(void *arg)
+{
+  if (!sta_enabled || state != NETWORK_BACKOFF)
+    return;
+
+  /* the first retry goes straight back to the AP we just lost */
+  sta_prepare(retry_count == 1 && offline_us);
+  sta_connect();
+}
+
+static void probe_timer_cb(void *arg)
+{
+  int64_t now = esp_timer_get_time();
+  esp_event_post(NETWORK_EVENT, NETWORK_EVENT_PROBE, &now, sizeof(now), 0);
+}
+
+static void sntp_synced(struct timeval *tv)
+{
+  time_t now = tv->tv_sec;
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+
+  char datetime[32];
+  strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", &timeinfo);
+
+  ESP_LOGI(TAG, "SNTP time: %s", datetime);
 }
 
 static void wifi_event_handler(void *arg,
@@ -36,43 +274,103 @@ static void wifi_event_handler(void *arg,
                                int32_t event_id,
                                void *event_data)
 {
+  int64_t t0 = esp_timer_get_time();
+
   if (event_base == WIFI_EVENT)
   {
     switch (event_id)
     {
     case WIFI_EVENT_STA_START:
-      ESP_LOGI(TAG, "STA start → connecting...");
+      ESP_LOGI(TAG, "STA start → connecting%s...", cache.has_ap ? " to the cached AP" : "");
       if (sta_enabled)
-        esp_wifi_connect();
+      {
+        sta_prepare(true);
+        sta_connect();
+      }
       break;
 
+    case WIFI_EVENT_STA_CONNECTED:
+    {
+      wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+
+      /* counted once; a later drop is not a failed fast connect */
+      if (directed)
+        stats.fast_ok++;
+      directed = false;
+      use_pmk = false;
+
+      uint8_t pmk_ok = event->authmode == WIFI_AUTH_WPA2_PSK;
+
+      if (!cache.has_ap || cache.channel != event->channel || cache.pmk_ok != pmk_ok ||
+          memcmp(cache.bssid, event->bssid, sizeof(cache.bssid)) != 0)
+      {
+        memcpy(cache.bssid, event->bssid, sizeof(cache.bssid));
+        cache.channel = event->channel;
+        cache.has_ap = 1;
+        cache.pmk_ok = pmk_ok;
+        cache_store();
+      }
+      break;
+    }
+
     case WIFI_EVENT_STA_DISCONNECTED:
     {
       if (!sta_enabled)
       {
         ESP_LOGW(TAG, "STA disabled, not reconnecting");
+        set_state(NETWORK_IDLE);
         break;
       }
 
+      if (state == NETWORK_ONLINE)
+      {
+        stats.reconnects++;
+        offline_us = t0;
+      }
+
+      if (directed)
+        stats.fast_failed++;
+
+      /* the AP may have moved to WPA3; the passphrase goes next */
+      if (use_pmk)
+      {
+        use_pmk = false;
+        cache.pmk_ok = 0;
+        cache_store();
+      }
+
       retry_count++;
 
-      int delay_ms = get_retry_delay_ms(retry_count);
+      /* the directed retry goes at once, the scans back off */
+      int delay_ms = retry_count == 1 && offline_us && cache.has_ap
+                         ? NETWORK_FAST_RETRY_MS
+                         : get_retry_delay_ms(retry_count - 1);
 
       ESP_LOGW(TAG, "STA disconnected → retry #%d in %d ms",
                retry_count, delay_ms);
 
-      vTaskDelay(pdMS_TO_TICKS(delay_ms));
-      esp_wifi_connect();
+      set_state(NETWORK_BACKOFF);
+      esp_timer_stop(retry_timer);
+      esp_timer_start_once(retry_timer, delay_ms * 1000LL);
 
       break;
     }
 
+    case WIFI_EVENT_SCAN_DONE:
+      xEventGroupSetBits(scan_events, SCAN_DONE_BIT);
+      break;
+
     case WIFI_EVENT_AP_STACONNECTED:
       ESP_LOGI(TAG, "AP client connected");
       break;
 
     case WIFI_EVENT_AP_STADISCONNECTED:
       ESP_LOGI(TAG, "AP client disconnected");
+      if (state == NETWORK_ONLINE)
+      {
+        esp_timer_stop(ap_timer);
+        esp_timer_start_once(ap_timer, NETWORK_AP_OFF_MS * 1000LL);
+      }
       break;
     }
   }
@@ -83,42 +381,261 @@ static void wifi_event_handler(void *arg,
 
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGI(TAG, "STA got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+    boot_mark(BOOT_STA_IP);
+
+    if (offline_us)
+    {
+      int64_t us = t0 - offline_us;
+      stats.outages++;
+      stats.outage_last_us = us;
+      stats.outage_sum_us += us;
+      if (us > stats.outage_max_us)
+        stats.outage_max_us = us;
+      offline_us = 0;
+
+      ESP_LOGI(TAG, "back online after %lld ms", us / 1000);
+    }
 
     if (!sntp_started)
     {
       sntp_started = true;
 
+      /* sntp_synced() reports the result; nothing waits for it here */
       ESP_LOGI(TAG, "Starting SNTP...");
       esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
       esp_sntp_setservername(0, "pool.ntp.org");
+      sntp_set_time_sync_notification_cb(sntp_synced);
       esp_sntp_init();
     }
 
-    time_t now = 0;
-    struct tm timeinfo = {0};
-    int retry = 0;
+    set_state(NETWORK_ONLINE);
+  }
+
+  else if (event_base == NETWORK_EVENT && event_id == NETWORK_EVENT_PROBE)
+  {
+    /* how long the loop took to get round to an event posted at *data */
+    int64_t lag = t0 - *(int64_t *)event_data;
+    int k = state == NETWORK_ONLINE;
+
+    stats.probes[k]++;
+    stats.lag_us[k] += lag;
+    if (lag > stats.lag_max_us[k])
+      stats.lag_max_us[k] = lag;
+  }
+
+  int64_t us = esp_timer_get_time() - t0;
+  if (us > stats.handler_max_us)
+    stats.handler_max_us = us;
+}
+
+network_state_t network_state(void)
+{
+  return state;
+}
+
+void network_subscribe(network_notify_t fn)
+{
+  if (subscriber_count < NETWORK_MAX_SUBSCRIBERS)
+    subscribers[subscriber_count++] = fn;
+}
+
+bool network_wait_online(int timeout_ms)
+{
+  return xEventGroupWaitBits(state_events, NETWORK_ONLINE_BIT, pdFALSE, pdTRUE,
+                             timeout_ms < 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)) &
+         NETWORK_ONLINE_BIT;
+}
+
+void network_stats_str(char *out, size_t len)
+{
+  wifi_mode_t mode = WIFI_MODE_NULL;
+  esp_wifi_get_mode(&mode);
+
+  snprintf(out, len, "%s, AP %s, retry #%d; outage last %lu / avg %lu / max %lu ms over %lu, fast connect %lu ok %lu failed; "
+                     "loop lag avg %lu / max %lu us online, %lu / %lu us offline, handler max %lu us",
+           state_names[state], mode == WIFI_MODE_APSTA ? "on" : "off", retry_count,
+           (unsigned long)(stats.outage_last_us / 1000),
+           stats.outages ? (unsigned long)(stats.outage_sum_us / stats.outages / 1000) : 0,
+           (unsigned long)(stats.outage_max_us / 1000), (unsigned long)stats.outages,
+           (unsigned long)stats.fast_ok, (unsigned long)stats.fast_failed,
+           stats.probes[1] ? (unsigned long)(stats.lag_us[1] / stats.probes[1]) : 0,
+           (unsigned long)stats.lag_max_us[1],
+           stats.probes[0] ? (unsigned long)(stats.lag_us[0] / stats.probes[0]) : 0,
+           (unsigned long)stats.lag_max_us[0],
+           (unsigned long)stats.handler_max_us);
+}
+
+static int ap_clients(void)
+{
+  wifi_sta_list_t list;
+  return esp_wifi_ap_get_sta_list(&list) == ESP_OK ? list.num : 0;
+}
+
+/*
+ * The driver only does modem sleep in station-only mode, so the soft-AP
+ * is dropped while the STA is online and nobody is on it (ap_sta_off),
+ * and is back as soon as the STA isn't.
+ */
+static void ap_timer_cb(void *arg)
+{
+  wifi_mode_t mode;
+  if (esp_wifi_get_mode(&mode) != ESP_OK)
+    return;
+
+  bool off = devcfg.ap_sta_off && state == NETWORK_ONLINE && ap_clients() == 0;
+  wifi_mode_t want = off ? WIFI_MODE_STA : WIFI_MODE_APSTA;
+  if (mode == want)
+    return;
+
+  ESP_LOGI(TAG, "soft-AP %s", off ? "off, STA online" : "on");
+  esp_wifi_set_mode(want);
+}
+
+/*
+ * Scans run here, never in an HTTP handler: when network_scan_request()
+ * pokes the task, or periodically while the station is looking for its
+ * AP. A scan takes the radio off-channel, so the periodic one is skipped
+ * while the STA is online or anyone is on the soft-AP. Readers only ever
+ * see the cache.
+ */
+static void wifi_scan_task(void *arg)
+{
+  while (1)
+  {
+    bool asked = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SCAN_INTERVAL_MS)) > 0;
+
+    if (!asked && (state == NETWORK_ONLINE || ap_clients() > 0))
+      continue;
+
+    wifi_scan_config_t scan_config = {
+        .ssid = 0,
+        .bssid = 0,
+        .channel = 0,
+        .show_hidden = true};
+
+    xEventGroupClearBits(scan_events, SCAN_DONE_BIT);
+
+    esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+    if (err != ESP_OK)
+    {
+      /* e.g. ESP_ERR_WIFI_STATE while the STA is connecting */
+      ESP_LOGW(TAG, "scan not started: %s", esp_err_to_name(err));
+      continue;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(scan_events, SCAN_DONE_BIT,
+                                           pdTRUE, pdFALSE,
+                                           pdMS_TO_TICKS(SCAN_TIMEOUT_MS));
+    if (!(bits & SCAN_DONE_BIT))
+    {
+      ESP_LOGW(TAG, "scan timed out");
+      continue;
+    }
 
-    while (timeinfo.tm_year < (2020 - 1900) && retry < 10)
+    uint16_t n = SCAN_MAX_AP;
+
+    xSemaphoreTake(scan_lock, portMAX_DELAY);
+    if (esp_wifi_scan_get_ap_records(&n, scan_records) == ESP_OK)
     {
-      ESP_LOGI(TAG, "Waiting for time sync...");
-      vTaskDelay(pdMS_TO_TICKS(2000));
-      time(&now);
-      localtime_r(&now, &timeinfo);
-      retry++;
+      scan_count = n;
+      scan_time_us = esp_timer_get_time();
+      scan_seq++;
     }
+    xSemaphoreGive(scan_lock);
 
-    setenv("TZ", "PHT-8", 1);
-    tzset();
+    ESP_LOGI(TAG, "scan #%lu: %d APs", (unsigned long)scan_seq, n);
+  }
+}
+
+void network_scan_request(void)
+{
+  if (scan_task_handle)
+    xTaskNotifyGive(scan_task_handle);
+}
+
+/* copy of the cached result; age_ms is -1 before the first scan */
+int network_scan_get(wifi_ap_record_t *out, int max, int64_t *age_ms, uint32_t *seq)
+{
+  xSemaphoreTake(scan_lock, portMAX_DELAY);
+
+  int n = scan_count < max ? scan_count : max;
+  memcpy(out, scan_records, n * sizeof(wifi_ap_record_t));
+
+  if (age_ms)
+    *age_ms = scan_time_us ? (esp_timer_get_time() - scan_time_us) / 1000 : -1;
+  if (seq)
+    *seq = scan_seq;
 
-    char datetime[32];
-    strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", &timeinfo);
+  xSemaphoreGive(scan_lock);
+
+  return n;
+}
 
-    ESP_LOGI(TAG, "Current time: %s", datetime);
+/* true once a scan newer than seq has completed */
+bool network_scan_wait(uint32_t seq, int timeout_ms)
+{
+  while (scan_seq == seq && timeout_ms > 0)
+  {
+    vTaskDelay(pdMS_TO_TICKS(100));
+    timeout_ms -= 100;
   }
+
+  return scan_seq != seq;
 }
 
 void network_start(void)
 {
+  scan_lock = xSemaphoreCreateMutex();
+  scan_events = xEventGroupCreate();
+  state_events = xEventGroupCreate();
+
+  /* the clock is UTC (GPS, SNTP); local time is for display */
+  setenv("TZ", "PHT-8", 1);
+  tzset();
+
+  const esp_timer_create_args_t retry_args = {
+      .callback = retry_timer_cb,
+      .name = "wifi_retry"};
+  ESP_ERROR_CHECK(esp_timer_create(&retry_args, &retry_timer));
+
+  const esp_timer_create_args_t probe_args = {
+      .callback = probe_timer_cb,
+      .name = "loop_probe"};
+  ESP_ERROR_CHECK(esp_timer_create(&probe_args, &probe_timer));
+
+  const esp_timer_create_args_t cache_args = {
+      .callback = cache_timer_cb,
+      .name = "wifi_cache"};
+  ESP_ERROR_CHECK(esp_timer_create(&cache_args, &cache_timer));
+
+  const esp_timer_create_args_t ap_args = {
+      .callback = ap_timer_cb,
+      .name = "wifi_ap"};
+  ESP_ERROR_CHECK(esp_timer_create(&ap_args, &ap_timer));
+
+  /* RTC memory survives a reset, NVS a power cycle */
+  if (!cache_load(&rtc_cache))
+  {
+    network_cache_t c;
+    size_t size = sizeof(c);
+    nvs_handle_t nvs;
+
+    if (nvs_open("wifi", NVS_READONLY, &nvs) == ESP_OK)
+    {
+      if (nvs_get_blob(nvs, "cache", &c, &size) != ESP_OK || size != sizeof(c) || !cache_load(&c))
+        memset(&cache, 0, sizeof(cache));
+      nvs_close(nvs);
+    }
+  }
+
+  if (cache.magic != NETWORK_CACHE_MAGIC)
+  {
+    cache.magic = NETWORK_CACHE_MAGIC;
+    cache.credentials = credentials_crc();
+  }
+
+  cache_pmk();
+
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -144,9 +661,16 @@ void network_start(void)
           NULL,
           NULL));
 
+  ESP_ERROR_CHECK(
+      esp_event_handler_instance_register(
+          NETWORK_EVENT,
+          NETWORK_EVENT_PROBE,
+          &wifi_event_handler,
+          NULL,
+          NULL));
+
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
 
-  wifi_config_t sta_config = {0};
   strncpy((char *)sta_config.sta.ssid,
           devcfg.sta_ssid,
           sizeof(sta_config.sta.ssid));
@@ -179,13 +703,21 @@ void network_start(void)
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
   ESP_ERROR_CHECK(esp_wifi_start());
 
-  ESP_LOGI(TAG, "Network started (AP always ON, STA auto-retry)");
+  esp_timer_start_periodic(probe_timer, NETWORK_PROBE_MS * 1000LL);
+  powersave_start();
+
+  xTaskCreate(wifi_scan_task, "wifi_scan", 3072, NULL, 3, &scan_task_handle);
+  network_scan_request(); // first result ready before anyone asks
+
+  ESP_LOGI(TAG, "Network started (AP %s, STA auto-retry)",
+           devcfg.ap_sta_off ? "ON while STA offline" : "always ON");
 }
 
 void wifi_sta_disable(void)
 {
   ESP_LOGW(TAG, "Disabling STA...");
   sta_enabled = false;
+  esp_timer_stop(retry_timer);
   esp_wifi_disconnect();
 }
 
@@ -194,5 +726,7 @@ void wifi_sta_enable(void)
   ESP_LOGI(TAG, "Enabling STA...");
   retry_count = 0;
   sta_enabled = true;
-  esp_wifi_connect();
+  esp_timer_stop(retry_timer);
+  sta_prepare(true);
+  sta_connect();
 }
\ No newline at end of file
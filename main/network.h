@@ -1,8 +1,72 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdbool.h>
+
 #include "esp_netif.h"
+#include "esp_wifi.h"
 
 extern esp_netif_t *ap_netif;
 extern esp_netif_t *sta_netif;
 
-void network_start(void);
\ No newline at end of file
+#define SCAN_MAX_AP 20
+#define SCAN_INTERVAL_MS 300000 // background rescan while offline and nobody is on the AP
+#define SCAN_TIMEOUT_MS 10000
+
+#define NETWORK_RETRY_MIN_MS 1000
+#define NETWORK_RETRY_MAX_MS 15000
+#define NETWORK_PROBE_MS 500 // event loop latency probe
+#define NETWORK_MAX_SUBSCRIBERS 4
+#define NETWORK_AP_OFF_MS 30000 // soft-AP stays this long after the STA is online and it is empty
+#define NETWORK_ONLINE_BIT BIT0
+
+/*
+ * Station connection state. Everything in the event handler returns at
+ * once: retries wait on an esp_timer, SNTP reports through its callback.
+ * Subscribers are called on every change from the event loop or the
+ * esp_timer task, so they must not block either.
+ */
+typedef enum
+{
+  NETWORK_IDLE,       // STA disabled
+  NETWORK_CONNECTING,
+  NETWORK_BACKOFF,    // waiting to retry
+  NETWORK_ONLINE,     // got an IP
+} network_state_t;
+
+typedef void (*network_notify_t)(network_state_t state);
+
+#define NETWORK_FAST_RETRY_MS 100
+#define NETWORK_CACHE_MAGIC 0x57494631 // "WIF1"
+
+/*
+ * Last AP the station associated with and the PMK for the configured
+ * passphrase, in RTC memory and NVS. Dropped when the SSID or key changes.
+ * The PMK is only offered to that AP, and only once it has taken WPA2-PSK.
+ */
+typedef struct
+{
+  uint32_t crc; // over the rest
+  uint32_t magic;
+  uint32_t credentials; // CRC of the SSID and key it was made for
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t has_ap;
+  uint8_t has_pmk;
+  uint8_t pmk_ok; // the cached AP associated with WPA2-PSK, not SAE
+  uint8_t reserved[2];
+  uint8_t pmk[32];
+} network_cache_t;
+
+void network_start(void);
+
+network_state_t network_state(void);
+void network_subscribe(network_notify_t fn);
+bool network_wait_online(int timeout_ms); // < 0 waits forever
+
+void network_stats_str(char *out, size_t len);
+
+/* cached background Wi-Fi scan */
+void network_scan_request(void);
+int network_scan_get(wifi_ap_record_t *out, int max, int64_t *age_ms, uint32_t *seq);
+bool network_scan_wait(uint32_t seq, int timeout_ms);
\ No newline at end of file
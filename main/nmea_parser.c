@@ -25,101 +25,153 @@ static double nmea_to_deg(char *val, char hemi)
   return result;
 }
 
-static void parse_rmc(char *line)
+/*
+ * Split a sentence in place into its fields, keeping empty ones (strtok
+ * would drop them and shift every field after); the checksum is cut off.
+ */
+static int nmea_fields(char *line, char **f, int max)
 {
-  char *tok;
-  int field = 0;
-
-  char lat[16] = {0};
-  char lon[16] = {0};
-  char latH = 'N';
-  char lonH = 'E';
+  char *star = strchr(line, '*');
+  if (star)
+    *star = 0;
 
-  tok = strtok(line, ",");
-
-  while (tok)
+  int n = 0;
+  while (n < max)
   {
-    switch (field)
-    {
-    case 1:
-      strncpy(gps.utc_time, tok, sizeof(gps.utc_time));
+    f[n++] = line;
+    line = strchr(line, ',');
+    if (!line)
       break;
+    *line++ = 0;
+  }
 
-    case 2:
-      gps.fix = (tok[0] == 'A');
-      break;
+  return n;
+}
 
-    case 3:
-      strncpy(lat, tok, sizeof(lat));
-      break;
+/* talker (the two letters after '$') to a system index */
+static int nmea_system(const char *talker)
+{
+  if (talker[0] == 'G' && talker[1] == 'L')
+    return 1;
+  if (talker[0] == 'G' && talker[1] == 'A')
+    return 2;
+  if ((talker[0] == 'G' && talker[1] == 'B') || (talker[0] == 'B' && talker[1] == 'D'))
+    return 3;
+  return 0; // GP, GN
+}
 
-    case 4:
-      latH = tok[0];
-      break;
+static void parse_rmc(char *line)
+{
+  char *f[16];
+  int n = nmea_fields(line, f, 16);
 
-    case 5:
-      strncpy(lon, tok, sizeof(lon));
-      break;
+  if (n < 10)
+    return;
 
-    case 6:
-      lonH = tok[0];
-      break;
+  strncpy(gps.utc_time, f[1], sizeof(gps.utc_time) - 1);
+  gps.fix = (f[2][0] == 'A');
+  gps.latitude = nmea_to_deg(f[3], f[4][0]);
+  gps.longitude = nmea_to_deg(f[5], f[6][0]);
+  gps.speed_knots = atof(f[7]);
+  gps.course = atof(f[8]);
+  strncpy(gps.utc_date, f[9], sizeof(gps.utc_date) - 1);
+}
 
-    case 7:
-      gps.speed_knots = atof(tok);
-      break;
+static void parse_gga(char *line)
+{
+  char *f[16];
+  int n = nmea_fields(line, f, 16);
 
-    case 9:
-      strncpy(gps.utc_date, tok, sizeof(gps.utc_date));
-      break;
-    }
+  if (n < 10)
+    return;
 
-    tok = strtok(NULL, ",");
-    field++;
-  }
+  gps.fix = atoi(f[6]);
+  gps.satellites = atoi(f[7]);
+  gps.hdop = atof(f[8]);
+  gps.altitude = atof(f[9]);
+}
+
+static void parse_gsa(char *line)
+{
+  char *f[20];
+  int n = nmea_fields(line, f, 20);
+
+  if (n < 18)
+    return;
+
+  /* NMEA 4.1 names the system; before that the talker does */
+  int sys = n > 18 && f[18][0] ? atoi(f[18]) - 1 : nmea_system(f[0] + 1);
+  if (sys < 0 || sys >= GPS_SYSTEMS)
+    return;
+
+  gps.mode = atoi(f[2]);
+  for (int i = 0; i < 12; i++)
+    gps.used[sys][i] = atoi(f[3 + i]);
 
-  gps.latitude = nmea_to_deg(lat, latH);
-  gps.longitude = nmea_to_deg(lon, lonH);
+  gps.pdop = atof(f[15]);
+  gps.hdop = atof(f[16]);
+  gps.vdop = atof(f[17]);
 }
 
-static void parse_gga(char *line)
+static void parse_gsv(char *line)
 {
-  char *tok;
-  int field = 0;
+  char *f[24];
+  int n = nmea_fields(line, f, 24);
 
-  tok = strtok(line, ",");
+  if (n < 4)
+    return;
 
-  while (tok)
-  {
-    switch (field)
-    {
-    case 6:
-      gps.fix = atoi(tok);
-      break;
+  int sys = nmea_system(f[0] + 1);
 
-    case 7:
-      gps.satellites = atoi(tok);
-      break;
+  /* the first message of a cycle replaces everything this system had */
+  if (atoi(f[2]) == 1)
+  {
+    int kept = 0;
+    for (int i = 0; i < gps.sats_count; i++)
+      if (gps.sats[i].system != sys)
+        gps.sats[kept++] = gps.sats[i];
+    gps.sats_count = kept;
+  }
 
-    case 9:
-      gps.altitude = atof(tok);
+  /* up to four satellites, then an optional NMEA 4.1 signal id */
+  for (int i = 4; i + 3 < n && gps.sats_count < GPS_MAX_SATS; i += 4)
+  {
+    if (!f[i][0])
       break;
-    }
 
-    tok = strtok(NULL, ",");
-    field++;
+    gps_sat_t *s = &gps.sats[gps.sats_count++];
+    s->system = sys;
+    s->prn = atoi(f[i]);
+    s->elevation = f[i + 1][0] ? atoi(f[i + 1]) : -1;
+    s->azimuth = f[i + 2][0] ? atoi(f[i + 2]) : -1;
+    s->snr = f[i + 3][0] ? atoi(f[i + 3]) : -1;
   }
 }
 
 void nmea_parse_line(char *line)
 {
-  if (!line || line[0] != '$')
+  if (!line || line[0] != '$' || strlen(line) < 6)
     return;
 
-  if (strstr(line, "RMC"))
+  const char *type = line + 3;
+
+  if (strncmp(type, "RMC", 3) == 0)
     parse_rmc(line);
-  else if (strstr(line, "GGA"))
+  else if (strncmp(type, "GGA", 3) == 0)
     parse_gga(line);
+  else if (strncmp(type, "GSA", 3) == 0)
+    parse_gsa(line);
+  else if (strncmp(type, "GSV", 3) == 0)
+    parse_gsv(line);
+}
+
+bool gps_sat_used(const gps_data_t *g, const gps_sat_t *s)
+{
+  for (int i = 0; i < 12; i++)
+    if (g->used[s->system][i] == s->prn)
+      return s->prn != 0;
+
+  return false;
 }
 
 gps_data_t *gps_get_data(void)
@@ -127,31 +179,39 @@ gps_data_t *gps_get_data(void)
   return &gps;
 }
 
-void gps_update_system_time(gps_data_t *g)
+/* seconds since 1970 for a UTC civil date; mktime() would apply TZ */
+time_t utc_epoch(int year, int mon, int day, int hh, int mm, int ss)
 {
-  if (!g->fix)
-    return;
-  if (strlen(g->utc_time) < 6 || strlen(g->utc_date) < 6)
-    return;
+  int y = year - (mon <= 2);
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097L + doe - 719468;
+
+  return (time_t)days * 86400 + hh * 3600 + mm * 60 + ss;
+}
 
-  struct tm t = {0};
+/* UTC seconds for the last RMC date and time, 0 if there are none */
+time_t gps_epoch(const gps_data_t *g)
+{
+  int hh, mm, ss, day, mon, year;
 
-  /* hhmmss */
-  sscanf(g->utc_time, "%2d%2d%2d",
-         &t.tm_hour,
-         &t.tm_min,
-         &t.tm_sec);
+  if (sscanf(g->utc_time, "%2d%2d%2d", &hh, &mm, &ss) != 3 ||
+      sscanf(g->utc_date, "%2d%2d%2d", &day, &mon, &year) != 3)
+    return 0;
 
-  /* ddmmyy */
-  int day, mon, year;
-  sscanf(g->utc_date, "%2d%2d%2d",
-         &day, &mon, &year);
+  return utc_epoch(2000 + year, mon, day, hh, mm, ss);
+}
 
-  t.tm_mday = day;
-  t.tm_mon = mon - 1;
-  t.tm_year = year + 100; // 2000+
+void gps_update_system_time(gps_data_t *g)
+{
+  if (!g->fix)
+    return;
 
-  time_t epoch = mktime(&t);
+  time_t epoch = gps_epoch(g);
+  if (epoch <= 0)
+    return;
 
   struct timeval now = {
       .tv_sec = epoch,
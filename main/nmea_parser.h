@@ -1,6 +1,22 @@
 #ifndef NMEA_PARSER_H
 #define NMEA_PARSER_H
 
+#include <time.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GPS_MAX_SATS 48
+#define GPS_SYSTEMS 4 // GPS, GLONASS, Galileo, BeiDou
+
+typedef struct
+{
+  uint8_t system; // 0 GPS, 1 GLONASS, 2 Galileo, 3 BeiDou
+  uint8_t prn;
+  int8_t elevation; // degrees, -1 unknown
+  int8_t snr;       // dB-Hz, -1 not tracked
+  int16_t azimuth;  // degrees, -1 unknown
+} gps_sat_t;
+
 typedef struct
 {
   double latitude;
@@ -13,10 +29,24 @@ typedef struct
   char utc_time[16];
   char utc_date[16];
 
+  float course; // degrees true
+  int mode;     // GSA: 1 no fix, 2 2D, 3 3D
+  float pdop;
+  float hdop;
+  float vdop;
+
+  /* GSV: in view; GSA: used, per system */
+  gps_sat_t sats[GPS_MAX_SATS];
+  int sats_count;
+  uint8_t used[GPS_SYSTEMS][12];
+
 } gps_data_t;
 
 void nmea_parse_line(char *line);
 gps_data_t *gps_get_data(void);
+time_t utc_epoch(int year, int mon, int day, int hh, int mm, int ss);
+time_t gps_epoch(const gps_data_t *g);
+bool gps_sat_used(const gps_data_t *g, const gps_sat_t *s);
 void gps_update_system_time(gps_data_t *g);
 
 #endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "ntp.h"
+
+static const char *TAG = "ntp";
+
+#define NTP_UNIX_OFFSET 2208988800UL // 1900 to 1970
+
+typedef struct
+{
+  uint8_t li_vn_mode;
+  uint8_t stratum;
+  int8_t poll;
+  int8_t precision;
+  uint32_t root_delay; // 16.16 seconds
+  uint32_t root_dispersion;
+  uint32_t refid;
+  uint32_t ref_ts[2]; // 32.32 seconds since 1900
+  uint32_t orig_ts[2];
+  uint32_t rx_ts[2];
+  uint32_t tx_ts[2];
+} ntp_packet_t;
+
+_Static_assert(sizeof(ntp_packet_t) == 48, "ntp packet size");
+
+static SemaphoreHandle_t lock;
+
+/* uart2 task only */
+static int64_t burst_us; // first byte of the current epoch's sentences
+static int64_t last_rx_us;
+static time_t last_epoch;
+
+/* under the lock */
+static int64_t offsets[NTP_WINDOW]; // UTC us - esp_timer us, one per epoch
+static int noffsets, next_offset;
+static int64_t offset_us;  // the least delayed of them
+static int64_t spread_us;
+static int64_t synced_us;  // esp_timer time of the last fix, 0 = never
+
+static struct
+{
+  uint32_t served;
+  uint32_t unsynced; // answered with leap 3
+  uint32_t ignored;
+  int64_t turnaround_max_us;
+} stats;
+
+void ntp_uart_rx(int64_t first_us, int64_t last_us)
+{
+  if (first_us - last_rx_us > NTP_BURST_GAP_MS * 1000LL)
+    burst_us = first_us;
+
+  last_rx_us = last_us;
+}
+
+void ntp_gps_fix(const gps_data_t *g)
+{
+  if (!lock || !g->fix || !burst_us)
+    return;
+
+  time_t epoch = gps_epoch(g);
+  if (epoch <= 0 || epoch == last_epoch)
+    return;
+
+  last_epoch = epoch;
+
+  int64_t off = epoch * 1000000LL + NTP_NMEA_FUDGE_MS * 1000LL - burst_us;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  /* after a gap the crystal has wandered; old epochs would skew the pick */
+  if (esp_timer_get_time() - synced_us > NTP_FIX_MAX_AGE_S * 1000000LL)
+    noffsets = next_offset = 0;
+
+  offsets[next_offset] = off;
+  next_offset = (next_offset + 1) % NTP_WINDOW;
+  if (noffsets < NTP_WINDOW)
+    noffsets++;
+
+  int64_t lo = offsets[0], hi = offsets[0];
+  for (int i = 1; i < noffsets; i++)
+  {
+    if (offsets[i] < lo)
+      lo = offsets[i];
+    if (offsets[i] > hi)
+      hi = offsets[i];
+  }
+
+  offset_us = hi;
+  spread_us = hi - lo;
+  synced_us = esp_timer_get_time();
+
+  xSemaphoreGive(lock);
+}
+
+static void ntp_ts(uint32_t ts[2], int64_t utc_us)
+{
+  uint64_t us = utc_us % 1000000;
+
+  ts[0] = htonl((uint32_t)(utc_us / 1000000 + NTP_UNIX_OFFSET));
+  ts[1] = htonl((uint32_t)((us << 32) / 1000000));
+}
+
+static uint32_t ntp_short(int64_t us)
+{
+  return htonl((uint32_t)(((uint64_t)us << 16) / 1000000));
+}
+
+static void ntp_reply(ntp_packet_t *p, int64_t rx_us)
+{
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int64_t off = offset_us;
+  int64_t spread = spread_us;
+  int64_t synced = synced_us;
+  xSemaphoreGive(lock);
+
+  int64_t age = rx_us - synced;
+  bool holding = synced && age < NTP_HOLDOVER_S * 1000000LL;
+  uint8_t vn = (p->li_vn_mode >> 3) & 7;
+
+  if (vn < 3 || vn > 4)
+    vn = 4;
+
+  memcpy(p->orig_ts, p->tx_ts, sizeof(p->orig_ts));
+
+  if (holding)
+  {
+    /* NMEA jitter, plus the crystal's drift since the last fix once it's stale */
+    int64_t disp = spread + 1000;
+    if (age > NTP_FIX_MAX_AGE_S * 1000000LL)
+      disp += age / 1000000 * NTP_DRIFT_PPM;
+
+    p->li_vn_mode = (0 << 6) | (vn << 3) | 4;
+    p->stratum = 1;
+    p->root_dispersion = ntp_short(disp);
+    memcpy(&p->refid, "GPS", 4);
+    ntp_ts(p->ref_ts, synced + off);
+  }
+  else
+  {
+    p->li_vn_mode = (3 << 6) | (vn << 3) | 4;
+    p->stratum = 16;
+    p->root_dispersion = ntp_short(16000000);
+    p->refid = 0;
+    memset(p->ref_ts, 0, sizeof(p->ref_ts));
+    stats.unsynced++;
+  }
+
+  p->precision = -20; // esp_timer ticks in microseconds
+  p->root_delay = 0;
+  ntp_ts(p->rx_ts, rx_us + off);
+  ntp_ts(p->tx_ts, esp_timer_get_time() + off);
+}
+
+static void ntp_task(void *arg)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(NTP_PORT),
+      .sin_addr.s_addr = INADDR_ANY};
+
+  if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    ESP_LOGE(TAG, "cannot bind UDP %d", NTP_PORT);
+    vTaskDelete(NULL);
+    return;
+  }
+
+  while (1)
+  {
+    union
+    {
+      ntp_packet_t p;
+      uint8_t raw[68]; // header plus a key id and MAC, which are ignored
+    } msg;
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+
+    int len = recvfrom(sock, msg.raw, sizeof(msg.raw), 0, (struct sockaddr *)&from, &from_len);
+    int64_t rx_us = esp_timer_get_time();
+
+    /* client requests only */
+    if (len < (int)sizeof(ntp_packet_t) || (msg.p.li_vn_mode & 7) != 3)
+    {
+      stats.ignored++;
+      continue;
+    }
+
+    ntp_reply(&msg.p, rx_us);
+
+    sendto(sock, &msg.p, sizeof(msg.p), 0, (struct sockaddr *)&from, from_len);
+
+    int64_t us = esp_timer_get_time() - rx_us;
+    if (us > stats.turnaround_max_us)
+      stats.turnaround_max_us = us;
+    stats.served++;
+  }
+}
+
+void ntp_stats_str(char *out, size_t len)
+{
+  if (!lock)
+  {
+    snprintf(out, len, "-");
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int64_t spread = spread_us;
+  int64_t synced = synced_us;
+  xSemaphoreGive(lock);
+
+  if (synced)
+    snprintf(out, len, "fix %lld s ago, jitter %lld us, ", (esp_timer_get_time() - synced) / 1000000, spread);
+  else
+    snprintf(out, len, "no GPS time, ");
+
+  size_t used = strlen(out);
+  snprintf(out + used, len - used, "%lu served (%lu unsynced), %lu ignored, turnaround max %lld us",
+           (unsigned long)stats.served, (unsigned long)stats.unsynced,
+           (unsigned long)stats.ignored, stats.turnaround_max_us);
+}
+
+void ntp_start(void)
+{
+  lock = xSemaphoreCreateMutex();
+
+  /* above the bridge and web tasks, so the receive stamp isn't kept waiting */
+  xTaskCreate(ntp_task, "ntp", 3072, NULL, 10, NULL);
+
+  ESP_LOGI(TAG, "NTP server on UDP %d", NTP_PORT);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nmea_parser.h"
+
+/*
+ * NTP server on UDP 123, answering from the GPS.
+ *
+ * There is no PPS line, so the second boundary comes from the NMEA output
+ * itself: the receiver starts each epoch's sentences a roughly fixed time
+ * after the second, and the arrival of the burst's first byte is stamped
+ * on the esp_timer. Over the last NTP_WINDOW epochs the earliest arrival
+ * (the least delayed) gives the offset from esp_timer to UTC, and the
+ * spread between them goes out as the root dispersion. NTP_NMEA_FUDGE_MS
+ * is the receiver's own output delay, to be measured once per receiver
+ * type (tools/nmea_replay.py and ntpdate against a good clock).
+ *
+ * With a current fix the server is stratum 1, refid GPS. Without one it
+ * holds over on the esp_timer crystal for NTP_HOLDOVER_S with growing
+ * dispersion, then answers unsynchronised (leap 3, stratum 16) so clients
+ * drop it.
+ */
+
+#define NTP_PORT 123
+#define NTP_WINDOW 8
+#define NTP_BURST_GAP_MS 200 // silence that separates two epochs' sentences
+#define NTP_NMEA_FUDGE_MS 0
+#define NTP_FIX_MAX_AGE_S 10
+#define NTP_HOLDOVER_S 3600
+#define NTP_DRIFT_PPM 50     // assumed crystal error while holding over
+
+void ntp_start(void); // needs the network stack
+
+/* every UART read: when its first and last byte arrived */
+void ntp_uart_rx(int64_t first_us, int64_t last_us);
+
+/* every RMC */
+void ntp_gps_fix(const gps_data_t *g);
+
+void ntp_stats_str(char *out, size_t len);
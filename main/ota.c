@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+#include "stream.h"
+#include "ota.h"
+
+static const char *TAG = "ota";
+
+typedef struct
+{
+  int idx; // buffer, -1 stops the writer
+  size_t len;
+} ota_job_t;
+
+static struct
+{
+  bool active;
+  const esp_partition_t *part;
+  esp_ota_handle_t handle;
+
+  uint8_t *buf[2];
+  int cur;     // buffer the producer is filling, -1 if none
+  size_t fill;
+  QueueHandle_t free_q;
+  QueueHandle_t full_q;
+  SemaphoreHandle_t done;
+
+  mbedtls_sha256_context sha;
+  uint32_t total; // 0 if unknown
+  uint32_t received;
+  uint32_t written; // writer task only
+  volatile esp_err_t err;
+
+  int64_t t0;
+  int64_t progress_last;
+} ota;
+
+static char status[64] = "idle";
+
+static void ota_progress(bool force)
+{
+  int64_t now = esp_timer_get_time();
+
+  if (!force && now - ota.progress_last < OTA_PROGRESS_MS * 1000LL)
+    return;
+  ota.progress_last = now;
+
+  int64_t us = now - ota.t0;
+  uint32_t kbps = us > 0 ? (uint64_t)ota.received * 1000000 / 1024 / us : 0;
+
+  if (ota.total)
+    snprintf(status, sizeof(status), "%lu%% %lu/%lu KB, %lu KB/s",
+             (unsigned long)((uint64_t)ota.received * 100 / ota.total),
+             (unsigned long)(ota.received / 1024),
+             (unsigned long)(ota.total / 1024),
+             (unsigned long)kbps);
+  else
+    snprintf(status, sizeof(status), "%lu KB, %lu KB/s",
+             (unsigned long)(ota.received / 1024), (unsigned long)kbps);
+
+  char msg[96];
+  int n = snprintf(msg, sizeof(msg), "{\"t\":\"ota\",\"ota_progress\":\"%s\"}", status);
+  stream_write(STREAM_JSON, msg, n);
+}
+
+static void ota_set_status(const char *fmt, const char *arg)
+{
+  snprintf(status, sizeof(status), fmt, arg);
+
+  char msg[96];
+  int n = snprintf(msg, sizeof(msg), "{\"t\":\"ota\",\"ota_progress\":\"%s\"}", status);
+  stream_write(STREAM_JSON, msg, n);
+}
+
+static esp_err_t ota_flash(const uint8_t *data, size_t len)
+{
+  uint32_t end = ota.written + len;
+
+  if (end > ota.part->size)
+    return ESP_ERR_INVALID_SIZE;
+
+  esp_err_t err = esp_ota_write(ota.handle, data, len);
+  if (err == ESP_OK)
+    ota.written = end;
+
+  return err;
+}
+
+static void ota_writer(void *arg)
+{
+  ota_job_t job;
+
+  while (xQueueReceive(ota.full_q, &job, portMAX_DELAY) == pdTRUE && job.idx >= 0)
+  {
+    if (ota.err == ESP_OK)
+    {
+      esp_err_t err = ota_flash(ota.buf[job.idx], job.len);
+      if (err != ESP_OK)
+      {
+        ESP_LOGE(TAG, "write at 0x%lx failed: %s",
+                 (unsigned long)ota.written, esp_err_to_name(err));
+        ota.err = err;
+      }
+    }
+
+    xQueueSend(ota.free_q, &job.idx, portMAX_DELAY);
+  }
+
+  xSemaphoreGive(ota.done);
+  vTaskDelete(NULL);
+}
+
+static void ota_flush(void)
+{
+  if (ota.cur < 0 || ota.fill == 0)
+    return;
+
+  ota_job_t job = {ota.cur, ota.fill};
+  xQueueSend(ota.full_q, &job, portMAX_DELAY);
+
+  ota.cur = -1;
+  ota.fill = 0;
+}
+
+/* drain the writer and release everything but the OTA handle */
+static void ota_stop(void)
+{
+  ota_job_t stop = {-1, 0};
+
+  xQueueSend(ota.full_q, &stop, portMAX_DELAY);
+  xSemaphoreTake(ota.done, portMAX_DELAY);
+
+  mbedtls_sha256_free(&ota.sha);
+
+  free(ota.buf[0]);
+  free(ota.buf[1]);
+  vQueueDelete(ota.free_q);
+  vQueueDelete(ota.full_q);
+  vSemaphoreDelete(ota.done);
+
+  ota.active = false;
+}
+
+esp_err_t ota_begin(uint32_t total)
+{
+  if (ota.active)
+    return ESP_ERR_INVALID_STATE;
+
+  ota.part = esp_ota_get_next_update_partition(NULL);
+  if (!ota.part)
+  {
+    ota_set_status("failed: %s", "no OTA slot");
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  if (total > ota.part->size)
+  {
+    ota_set_status("failed: %s", "image larger than slot");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  ota.buf[0] = malloc(OTA_CHUNK_SIZE);
+  ota.buf[1] = malloc(OTA_CHUNK_SIZE);
+  ota.free_q = xQueueCreate(2, sizeof(int));
+  ota.full_q = xQueueCreate(3, sizeof(ota_job_t));
+  ota.done = xSemaphoreCreateBinary();
+
+  esp_err_t err = ESP_ERR_NO_MEM;
+
+  ota.t0 = esp_timer_get_time();
+
+  /* nothing is erased here; esp_ota_write erases each sector as it gets there */
+  if (ota.buf[0] && ota.buf[1] && ota.free_q && ota.full_q && ota.done)
+    err = esp_ota_begin(ota.part, OTA_WITH_SEQUENTIAL_WRITES, &ota.handle);
+
+  if (err != ESP_OK)
+  {
+    free(ota.buf[0]);
+    free(ota.buf[1]);
+    if (ota.free_q)
+      vQueueDelete(ota.free_q);
+    if (ota.full_q)
+      vQueueDelete(ota.full_q);
+    if (ota.done)
+      vSemaphoreDelete(ota.done);
+
+    ota_set_status("failed: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  for (int i = 0; i < 2; i++)
+    xQueueSend(ota.free_q, &i, 0);
+
+  ota.cur = -1;
+  ota.fill = 0;
+  ota.total = total;
+  ota.received = 0;
+  ota.written = 0;
+  ota.err = ESP_OK;
+  ota.progress_last = 0;
+
+  mbedtls_sha256_init(&ota.sha);
+  mbedtls_sha256_starts(&ota.sha, 0);
+
+  xTaskCreate(ota_writer, "ota_writer", 3072, NULL, 5, NULL);
+  ota.active = true;
+
+  ESP_LOGI(TAG, "writing %lu bytes to %s", (unsigned long)total, ota.part->label);
+  ota_progress(true);
+
+  return ESP_OK;
+}
+
+uint8_t *ota_buf(size_t *cap)
+{
+  if (ota.cur < 0)
+    xQueueReceive(ota.free_q, &ota.cur, portMAX_DELAY);
+
+  *cap = OTA_CHUNK_SIZE - ota.fill;
+  return ota.buf[ota.cur] + ota.fill;
+}
+
+esp_err_t ota_submit(size_t len)
+{
+  mbedtls_sha256_update(&ota.sha, ota.buf[ota.cur] + ota.fill, len);
+
+  ota.fill += len;
+  ota.received += len;
+
+  if (ota.fill == OTA_CHUNK_SIZE)
+    ota_flush();
+
+  ota_progress(false);
+
+  return ota.err;
+}
+
+esp_err_t ota_write(const void *data, size_t len)
+{
+  const uint8_t *p = data;
+
+  while (len && ota.err == ESP_OK)
+  {
+    size_t cap;
+    uint8_t *dst = ota_buf(&cap);
+    size_t n = len < cap ? len : cap;
+
+    memcpy(dst, p, n);
+    ota_submit(n);
+
+    p += n;
+    len -= n;
+  }
+
+  return ota.err;
+}
+
+esp_err_t ota_finish(const uint8_t *expect_sha256, ota_result_t *res)
+{
+  ota_flush();
+  mbedtls_sha256_finish(&ota.sha, res->sha256);
+  ota_stop();
+
+  res->size = ota.received;
+  res->elapsed_us = esp_timer_get_time() - ota.t0;
+  res->kbps = res->elapsed_us > 0 ? (uint64_t)ota.received * 1000000 / 1024 / res->elapsed_us : 0;
+
+  esp_err_t err = ota.err;
+
+  if (err == ESP_OK && ota.total && ota.received != ota.total)
+    err = ESP_ERR_INVALID_SIZE;
+
+  if (err == ESP_OK && expect_sha256 && memcmp(expect_sha256, res->sha256, 32) != 0)
+  {
+    ESP_LOGE(TAG, "SHA-256 mismatch");
+    err = ESP_ERR_INVALID_CRC;
+  }
+
+  if (err != ESP_OK)
+    esp_ota_abort(ota.handle);
+  else if ((err = esp_ota_end(ota.handle)) == ESP_OK) // validates the image
+    err = esp_ota_set_boot_partition(ota.part);
+
+  if (err != ESP_OK)
+  {
+    ota_set_status("failed: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  ota_progress(true);
+  ESP_LOGI(TAG, "%lu bytes in %lld ms, %lu KB/s",
+           (unsigned long)res->size, (long long)(res->elapsed_us / 1000),
+           (unsigned long)res->kbps);
+
+  return ESP_OK;
+}
+
+void ota_abort(void)
+{
+  if (!ota.active)
+    return;
+
+  ota_flush();
+  ota_stop();
+  esp_ota_abort(ota.handle);
+
+  ESP_LOGW(TAG, "aborted after %lu bytes", (unsigned long)ota.received);
+  ota_set_status("%s", "aborted");
+}
+
+void ota_status_str(char *out, size_t len)
+{
+  snprintf(out, len, "%s", status);
+}
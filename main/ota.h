@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+/*
+ * Streaming OTA writer.
+ *
+ * The producer (an HTTP handler, the delta patcher) fills one of two large
+ * buffers while a writer task flashes the other, so receiving and flash
+ * writes overlap. The slot is opened for sequential writes, so each sector
+ * is erased by the writer task just before it is written, while the
+ * other buffer fills, and nothing stalls the receive up front. The image
+ * is SHA-256'd on the way through so it can be checked against a digest
+ * supplied by the client before the slot is made bootable.
+ *
+ * Progress goes out as {"t":"ota",...} records on the stream ring. Any
+ * failure aborts the update and leaves the running image as the boot one.
+ */
+
+#define OTA_CHUNK_SIZE 8192   // per buffer, two of them
+#define OTA_PROGRESS_MS 500
+#define OTA_RECV_RETRIES 5    // consecutive socket timeouts before giving up
+
+typedef struct
+{
+  uint32_t size;       // bytes written
+  int64_t elapsed_us;
+  uint32_t kbps;
+  uint8_t sha256[32];
+} ota_result_t;
+
+esp_err_t ota_begin(uint32_t total);
+
+/* zero-copy: fill up to *cap bytes at the returned pointer, then submit */
+uint8_t *ota_buf(size_t *cap);
+esp_err_t ota_submit(size_t len);
+
+esp_err_t ota_write(const void *data, size_t len);
+
+/* expect_sha256 may be NULL; on success the new image boots next */
+esp_err_t ota_finish(const uint8_t *expect_sha256, ota_result_t *res);
+void ota_abort(void);
+
+void ota_status_str(char *out, size_t len);
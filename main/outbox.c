@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "outbox.h"
+
+static const char *TAG = "outbox";
+
+static const esp_partition_t *part;
+static uint32_t nslots;
+static SemaphoreHandle_t lock;
+
+static uint32_t head;   // next position to write
+static uint32_t tail;   // oldest undelivered
+static uint32_t oldest; // oldest still in flash
+
+/* acked but not yet at the tail, by pos % OUTBOX_ACK_WINDOW */
+static uint32_t ahead[OUTBOX_ACK_WINDOW / 32];
+
+static struct
+{
+  uint32_t appended;
+  uint32_t acked;
+  uint32_t lost; // erased before delivery
+  uint32_t erases;
+  uint32_t errors;
+  uint32_t reads;
+  int64_t recover_us;
+  uint32_t recover_reads;
+} stats;
+
+static uint32_t rec_crc(const outbox_rec_t *r)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)r, offsetof(outbox_rec_t, crc));
+}
+
+static size_t rec_offset(uint32_t pos)
+{
+  return (size_t)(pos % nslots) * sizeof(outbox_rec_t);
+}
+
+/* false if the slot holds no record for pos */
+static bool rec_read(uint32_t pos, outbox_rec_t *r)
+{
+  stats.reads++;
+
+  if (esp_partition_read(part, rec_offset(pos), r, sizeof(*r)) != ESP_OK)
+    return false;
+
+  return r->pos == pos && r->crc == rec_crc(r);
+}
+
+static bool rec_sent(uint32_t pos)
+{
+  outbox_rec_t r;
+  return rec_read(pos, &r) && r.sent == 0;
+}
+
+static bool ahead_test(uint32_t pos)
+{
+  uint32_t i = pos % OUTBOX_ACK_WINDOW;
+  return ahead[i / 32] & (1u << (i % 32));
+}
+
+static void ahead_set(uint32_t pos, bool on)
+{
+  uint32_t i = pos % OUTBOX_ACK_WINDOW;
+
+  if (on)
+    ahead[i / 32] |= 1u << (i % 32);
+  else
+    ahead[i / 32] &= ~(1u << (i % 32));
+}
+
+/* move the tail, forgetting any acks held for what it passes */
+static void tail_to(uint32_t pos)
+{
+  for (uint32_t p = tail; p < pos && p - tail < OUTBOX_ACK_WINDOW; p++)
+    ahead_set(p, false);
+
+  tail = pos;
+}
+
+static void outbox_recover(void)
+{
+  int64_t t0 = esp_timer_get_time();
+  int nsectors = nslots / OUTBOX_SECTOR_RECS;
+  outbox_rec_t r;
+  bool found = false;
+
+  /* the newest sector by the position of its first record */
+  for (int s = 0; s < nsectors; s++)
+  {
+    esp_partition_read(part, s * OUTBOX_SECTOR_SIZE, &r, sizeof(r));
+    stats.reads++;
+
+    if (r.crc != rec_crc(&r) || r.pos % nslots != s * OUTBOX_SECTOR_RECS)
+      continue;
+
+    if (!found || r.pos >= head)
+    {
+      head = r.pos;
+      found = true;
+    }
+  }
+
+  if (!found)
+  {
+    head = tail = oldest = 0;
+    stats.recover_us = esp_timer_get_time() - t0;
+    ESP_LOGI(TAG, "empty");
+    return;
+  }
+
+  /* then its last record */
+  uint32_t first = head;
+  for (uint32_t pos = first; pos < first + OUTBOX_SECTOR_RECS && rec_read(pos, &r); pos++)
+    head = pos + 1;
+
+  /* every other sector is full; the one after the head's is the oldest */
+  uint32_t start = first - first % OUTBOX_SECTOR_RECS;
+  uint32_t span = (nsectors - 1) * OUTBOX_SECTOR_RECS;
+  oldest = start > span ? start - span : 0;
+
+  /*
+   * delivered records come first. An unreadable one reads as undelivered,
+   * which can only put the tail early and resend a few, never past a fix
+   * that wasn't delivered.
+   */
+  uint32_t lo = oldest, hi = head;
+  while (lo < hi)
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (rec_sent(mid))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  tail = lo;
+
+  stats.recover_us = esp_timer_get_time() - t0;
+  stats.recover_reads = stats.reads;
+
+  ESP_LOGI(TAG, "%lu waiting (positions %lu..%lu), recovered in %lld us / %lu reads",
+           (unsigned long)(head - tail), (unsigned long)tail, (unsigned long)head,
+           stats.recover_us, (unsigned long)stats.recover_reads);
+}
+
+bool outbox_append(const track_rec_t *rec)
+{
+  if (!lock)
+    return false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  /* entering a sector: erase it, dropping the oldest records once full */
+  if (head % OUTBOX_SECTOR_RECS == 0)
+  {
+    if (head >= nslots)
+    {
+      uint32_t next = head - nslots + OUTBOX_SECTOR_RECS;
+      if (tail < next)
+      {
+        stats.lost += next - tail;
+        tail_to(next);
+      }
+      oldest = next;
+    }
+
+    if (esp_partition_erase_range(part, rec_offset(head), OUTBOX_SECTOR_SIZE) != ESP_OK)
+    {
+      stats.errors++;
+      xSemaphoreGive(lock);
+      return false;
+    }
+    stats.erases++;
+  }
+
+  outbox_rec_t r;
+  memset(&r, 0xFF, sizeof(r));
+  r.pos = head;
+  r.rec = *rec;
+  r.crc = rec_crc(&r);
+
+  esp_err_t err = esp_partition_write(part, rec_offset(head), &r, sizeof(r));
+  if (err == ESP_OK)
+  {
+    head++;
+    stats.appended++;
+  }
+  else
+  {
+    stats.errors++;
+  }
+
+  xSemaphoreGive(lock);
+
+  return err == ESP_OK;
+}
+
+uint32_t outbox_head(void)
+{
+  return head;
+}
+
+uint32_t outbox_tail(void)
+{
+  return tail;
+}
+
+bool outbox_available(void)
+{
+  return lock != NULL;
+}
+
+int outbox_read(uint32_t *pos, outbox_rec_t *out, int max)
+{
+  if (!lock)
+    return 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  int n = 0;
+  if (*pos < tail)
+    *pos = tail;
+
+  while (n < max && *pos < head)
+  {
+    /* unreadable ones are skipped, not retried forever */
+    if (rec_read(*pos, &out[n]))
+      n++;
+    else
+      stats.errors++;
+    (*pos)++;
+  }
+
+  xSemaphoreGive(lock);
+
+  return n;
+}
+
+void outbox_ack(uint32_t pos, int count)
+{
+  if (!lock)
+    return;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  static const uint8_t zero = 0;
+  outbox_rec_t r;
+
+  /* before the tail is already done or erased; too far ahead comes again */
+  for (uint32_t p = pos; p < pos + count && p < head; p++)
+  {
+    if (p >= tail && p - tail < OUTBOX_ACK_WINDOW && !ahead_test(p))
+    {
+      ahead_set(p, true);
+      stats.acked++;
+    }
+  }
+
+  /*
+   * flags are only written in order from the tail, so flash never holds an
+   * ack past an undelivered record. Unreadable records are never sent and
+   * so never acked; the tail steps over them.
+   */
+  while (tail < head && (ahead_test(tail) || !rec_read(tail, &r)))
+  {
+    if (ahead_test(tail))
+      esp_partition_write(part, rec_offset(tail) + offsetof(outbox_rec_t, sent), &zero, 1);
+
+    ahead_set(tail, false);
+    tail++;
+  }
+
+  xSemaphoreGive(lock);
+}
+
+void outbox_stats_str(char *out, size_t len)
+{
+  if (!lock)
+  {
+    snprintf(out, len, "no outbox partition");
+    return;
+  }
+
+  snprintf(out, len, "%lu waiting of %lu, %lu appended, %lu acked, %lu lost, %lu erases, %lu errors, recovery %lld us",
+           (unsigned long)(head - tail), (unsigned long)nslots,
+           (unsigned long)stats.appended, (unsigned long)stats.acked,
+           (unsigned long)stats.lost, (unsigned long)stats.erases,
+           (unsigned long)stats.errors, stats.recover_us);
+}
+
+void outbox_start(void)
+{
+  const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, OUTBOX_SUBTYPE, "outbox");
+  if (!p)
+  {
+    ESP_LOGW(TAG, "no outbox partition");
+    return;
+  }
+
+  int nsectors = p->size / OUTBOX_SECTOR_SIZE;
+  if (nsectors > OUTBOX_SECTORS_MAX)
+    nsectors = OUTBOX_SECTORS_MAX;
+  if (nsectors < 2)
+    return;
+
+  part = p;
+  nslots = nsectors * OUTBOX_SECTOR_RECS;
+
+  outbox_recover();
+
+  /* last, so nobody appends before the recovery is done */
+  lock = xSemaphoreCreateMutex();
+}
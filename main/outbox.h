@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "track.h"
+
+/*
+ * Persistent queue of fixes waiting for the MQTT broker, on the outbox
+ * data partition.
+ *
+ * Records are fixed-size slots written in order through the partition's
+ * 4 KB sectors as a ring, each with its position (a monotonic index) and a
+ * CRC. Delivery is marked in place by programming the record's sent byte
+ * from 0xFF to 0x00, so an ack costs one small flash write and never an
+ * erase. Acks can arrive out of order, so one ahead of the tail is held in
+ * RAM until the tail reaches it, and only then is the flag written: the
+ * cleared flags are always an unbroken run up to the tail. A restart finds
+ * the head from the newest sector and the tail by binary search on that
+ * run; acks still held in RAM are lost and those records are sent again.
+ *
+ * When the ring is full the oldest sector is erased, undelivered or not,
+ * and the records lost are counted.
+ */
+
+#define OUTBOX_SECTOR_SIZE 4096
+#define OUTBOX_SECTORS_MAX 64 // 256 KB; a larger partition is used up to this
+#define OUTBOX_SUBTYPE 0x41
+#define OUTBOX_ACK_WINDOW 256 // acks held ahead of the tail; later ones are dropped
+
+typedef struct __attribute__((packed))
+{
+  uint32_t pos;
+  track_rec_t rec;
+  uint32_t crc;    // over pos and rec
+  uint8_t sent;    // 0xFF until the broker acked it
+  uint8_t reserved[3];
+} outbox_rec_t;
+
+_Static_assert(sizeof(outbox_rec_t) == 32, "outbox record size");
+
+#define OUTBOX_SECTOR_RECS (OUTBOX_SECTOR_SIZE / sizeof(outbox_rec_t))
+
+void outbox_start(void);
+bool outbox_available(void);
+
+bool outbox_append(const track_rec_t *r);
+
+/* [tail, head) is waiting; positions only grow */
+uint32_t outbox_head(void);
+uint32_t outbox_tail(void);
+
+/* up to max records from *pos on, which is moved past them; returns the count */
+int outbox_read(uint32_t *pos, outbox_rec_t *out, int max);
+
+/* the broker has count records from pos on */
+void outbox_ack(uint32_t pos, int count);
+
+void outbox_stats_str(char *out, size_t len);
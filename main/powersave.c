@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "storage.h"
+#include "stream.h"
+#include "powersave.h"
+
+static const char *TAG = "powersave";
+
+static const char *const mode_names[] = {
+    [WIFI_PS_NONE] = "none",
+    [WIFI_PS_MIN_MODEM] = "min",
+    [WIFI_PS_MAX_MODEM] = "max",
+};
+
+static atomic_int holds;
+static atomic_llong last_kick_us;
+
+static esp_timer_handle_t timer;
+static wifi_ps_type_t mode = WIFI_PS_MIN_MODEM; // the driver's default
+static int64_t mode_since_us;
+static int64_t idle_since_us;
+static uint32_t last_head;
+
+static struct
+{
+  uint32_t transitions;
+  int64_t mode_us[3]; // indexed by wifi_ps_type_t
+  uint32_t rate;      // stream bytes/s at the last tick
+  bool ap_up;         // the last tick found the soft-AP running
+} stats;
+
+static wifi_ps_type_t pick(int64_t now)
+{
+  switch (devcfg.wifi_ps)
+  {
+  case POWERSAVE_NONE:
+    return WIFI_PS_NONE;
+  case POWERSAVE_MIN:
+    return WIFI_PS_MIN_MODEM;
+  case POWERSAVE_MAX:
+    return WIFI_PS_MAX_MODEM;
+  }
+
+  bool busy = atomic_load(&holds) > 0 ||
+              now - atomic_load(&last_kick_us) < POWERSAVE_LINGER_MS * 1000LL ||
+              stats.rate >= POWERSAVE_UART_BPS;
+
+  if (busy)
+  {
+    idle_since_us = now;
+    return WIFI_PS_NONE;
+  }
+
+  return now - idle_since_us >= POWERSAVE_DEEP_IDLE_S * 1000000LL
+             ? WIFI_PS_MAX_MODEM
+             : WIFI_PS_MIN_MODEM;
+}
+
+static void tick(void *arg)
+{
+  int64_t now = esp_timer_get_time();
+
+  uint32_t head = stream_head();
+  stats.rate = (head - last_head) * 1000 / POWERSAVE_TICK_MS;
+  last_head = head;
+
+  /* modem sleep is station-only; with the soft-AP up the radio stays on */
+  wifi_mode_t wm;
+  stats.ap_up = esp_wifi_get_mode(&wm) == ESP_OK && wm != WIFI_MODE_STA;
+
+  wifi_ps_type_t next = stats.ap_up ? WIFI_PS_NONE : pick(now);
+  if (next == mode)
+    return;
+
+  if (esp_wifi_set_ps(next) != ESP_OK)
+    return;
+
+  stats.mode_us[mode] += now - mode_since_us;
+  stats.transitions++;
+
+  ESP_LOGI(TAG, "%s -> %s after %lld s", mode_names[mode], mode_names[next],
+           (now - mode_since_us) / 1000000);
+
+  mode = next;
+  mode_since_us = now;
+}
+
+void powersave_hold(void)
+{
+  atomic_fetch_add(&holds, 1);
+  powersave_kick();
+}
+
+void powersave_release(void)
+{
+  atomic_fetch_sub(&holds, 1);
+  powersave_kick();
+}
+
+void powersave_kick(void)
+{
+  atomic_store(&last_kick_us, esp_timer_get_time());
+}
+
+void powersave_stats_str(char *out, size_t len)
+{
+  int64_t now = esp_timer_get_time();
+  int64_t us[3];
+
+  for (int i = 0; i < 3; i++)
+    us[i] = stats.mode_us[i] + (i == mode ? now - mode_since_us : 0);
+
+  snprintf(out, len, "%s%s, %d clients, %lu B/s, %lu changes; none %llu / min %llu / max %llu s",
+           mode_names[mode], devcfg.wifi_ps == POWERSAVE_AUTO ? " (auto)" : " (fixed)",
+           atomic_load(&holds), (unsigned long)stats.rate, (unsigned long)stats.transitions,
+           (unsigned long long)(us[WIFI_PS_NONE] / 1000000),
+           (unsigned long long)(us[WIFI_PS_MIN_MODEM] / 1000000),
+           (unsigned long long)(us[WIFI_PS_MAX_MODEM] / 1000000));
+
+  if (stats.ap_up)
+  {
+    size_t used = strlen(out);
+    snprintf(out + used, len - used, "; no effect while the soft-AP is up");
+  }
+}
+
+void powersave_start(void)
+{
+  mode_since_us = idle_since_us = esp_timer_get_time();
+  last_head = stream_head();
+  esp_wifi_set_ps(mode);
+
+  const esp_timer_create_args_t args = {
+      .callback = tick,
+      .name = "powersave"};
+  ESP_ERROR_CHECK(esp_timer_create(&args, &timer));
+  ESP_ERROR_CHECK(esp_timer_start_periodic(timer, POWERSAVE_TICK_MS * 1000LL));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Wi-Fi power-save governor.
+ *
+ * Modem sleep holds inbound frames at the AP until the next DTIM, which
+ * adds tens of milliseconds to every request and stream frame; keeping the
+ * radio on costs power on a unit nobody is talking to. Once a second the
+ * governor looks at the traffic and picks:
+ *
+ *   none       a client is connected, a request came in during the last
+ *              POWERSAVE_LINGER_MS, or the UART stream is busy
+ *   min modem  idle
+ *   max modem  idle for POWERSAVE_DEEP_IDLE_S
+ *
+ * The wifi_ps config field pins a mode instead, which is how the modes are
+ * compared (tools/ps_latency.py).
+ *
+ * The driver only does modem sleep in station-only mode. network.c drops
+ * the soft-AP once the STA is online and nobody is on it; while it is up
+ * the governor holds "none" (the radio is on regardless) and /system says
+ * so.
+ */
+
+#define POWERSAVE_TICK_MS 1000
+#define POWERSAVE_LINGER_MS 10000
+#define POWERSAVE_DEEP_IDLE_S 300
+#define POWERSAVE_UART_BPS 2000 // stream bytes/s that count as busy
+
+/* wifi_ps config values */
+#define POWERSAVE_AUTO 0
+#define POWERSAVE_NONE 1
+#define POWERSAVE_MIN 2
+#define POWERSAVE_MAX 3
+
+void powersave_start(void); // after esp_wifi_start()
+
+/* long-lived clients: a bridge socket, WebSocket or stream */
+void powersave_hold(void);
+void powersave_release(void);
+
+/* any request */
+void powersave_kick(void);
+
+void powersave_stats_str(char *out, size_t len);
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "mqtt_client.h"
+
+#include "storage.h"
+#include "network.h"
+#include "track.h"
+#include "outbox.h"
+#include "publisher.h"
+
+static const char *TAG = "publisher";
+
+/* publisher task only */
+static esp_mqtt_client_handle_t client;
+static char client_uri[128];
+static int64_t last_stats_us;
+static outbox_rec_t batch[MQTT_BATCH];
+static char msg[MQTT_MSG_MAX];
+
+/* uart2 task only */
+static time_t last_fix;
+
+/* shared with the MQTT task, under the lock */
+static SemaphoreHandle_t lock;
+static bool connected;
+static uint32_t next_pos; // next outbox position to publish
+
+static struct
+{
+  int msg_id;
+  uint32_t pos;
+  int count;
+} inflight[MQTT_INFLIGHT];
+static int ninflight;
+
+/* PUBACKs that may have beaten the publisher back to the inflight table */
+static int early[MQTT_INFLIGHT];
+static int nearly;
+
+static struct
+{
+  uint32_t connects;
+  uint32_t disconnects;
+  uint32_t published; // fix messages
+  uint32_t acked;     // fixes
+  uint32_t deleted;   // messages the client gave up on
+
+  int64_t backlog_us; // connected with a backlog, 0 once drained
+  uint32_t backlog;
+  int64_t recover_us; // the last drain
+  uint32_t recovered;
+} stats;
+
+void publisher_fix(const gps_data_t *g)
+{
+  if (!devcfg.mqtt_enable || !g->fix || !outbox_available())
+    return;
+
+  time_t ts = gps_epoch(g);
+  if (ts <= 0 || ts - last_fix < (devcfg.mqtt_interval ? devcfg.mqtt_interval : 1))
+    return;
+
+  last_fix = ts;
+
+  track_rec_t r;
+  track_rec_from(g, ts, &r);
+  outbox_append(&r);
+}
+
+/* under the lock */
+static void acked(int i)
+{
+  outbox_ack(inflight[i].pos, inflight[i].count);
+  stats.acked += inflight[i].count;
+  inflight[i] = inflight[--ninflight];
+
+  if (stats.backlog_us && outbox_head() - outbox_tail() <= 1)
+  {
+    stats.recover_us = esp_timer_get_time() - stats.backlog_us;
+    stats.recovered = stats.backlog;
+    stats.backlog_us = 0;
+
+    ESP_LOGI(TAG, "backlog of %lu fixes sent in %lld ms",
+             (unsigned long)stats.recovered, stats.recover_us / 1000);
+  }
+}
+
+static void mqtt_event(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+  esp_mqtt_event_handle_t event = data;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  switch (event->event_id)
+  {
+  case MQTT_EVENT_CONNECTED:
+  {
+    /*
+     * the client resends what was in flight from its own outbox, under the
+     * same ids, so the window carries on rather than starting again
+     */
+    connected = true;
+    stats.connects++;
+
+    uint32_t waiting = outbox_head() - outbox_tail();
+    if (waiting > MQTT_BATCH)
+    {
+      stats.backlog_us = esp_timer_get_time();
+      stats.backlog = waiting;
+    }
+
+    ESP_LOGI(TAG, "connected, %lu fixes waiting", (unsigned long)waiting);
+    break;
+  }
+
+  case MQTT_EVENT_DISCONNECTED:
+    connected = false;
+    stats.disconnects++;
+    break;
+
+  case MQTT_EVENT_PUBLISHED:
+  {
+    int i = 0;
+    while (i < ninflight && inflight[i].msg_id != event->msg_id)
+      i++;
+
+    if (i < ninflight)
+      acked(i);
+    else if (nearly < MQTT_INFLIGHT)
+      early[nearly++] = event->msg_id;
+    break;
+  }
+
+  case MQTT_EVENT_DELETED:
+    /* expired in the client's own outbox: ours still has it */
+    for (int i = 0; i < ninflight; i++)
+    {
+      if (inflight[i].msg_id != event->msg_id)
+        continue;
+
+      if (inflight[i].pos < next_pos)
+        next_pos = inflight[i].pos;
+      inflight[i] = inflight[--ninflight];
+      stats.deleted++;
+      break;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  xSemaphoreGive(lock);
+}
+
+static int format_batch(int n)
+{
+  int len = snprintf(msg, sizeof(msg), "[");
+
+  for (int i = 0; i < n; i++)
+  {
+    const track_rec_t *r = &batch[i].rec;
+
+    len += snprintf(msg + len, sizeof(msg) - len,
+                    "%s{\"seq\":%lu,\"ts\":%lu,\"lat\":%.7f,\"lon\":%.7f,\"alt\":%.1f,"
+                    "\"speed\":%.2f,\"sats\":%u,\"fix\":%u}",
+                    i ? "," : "", (unsigned long)batch[i].pos, (unsigned long)r->ts,
+                    r->lat / 1e7, r->lon / 1e7, r->alt / 10.0, r->speed / 100.0,
+                    r->sats, r->fix);
+  }
+
+  len += snprintf(msg + len, sizeof(msg) - len, "]");
+
+  return len < (int)sizeof(msg) ? len : -1;
+}
+
+/*
+ * Keep the window full. The publish itself runs without the lock: the MQTT
+ * task holds its own lock while calling mqtt_event, and publish takes it.
+ */
+static void pump(void)
+{
+  char topic[80];
+  snprintf(topic, sizeof(topic), "%s/fix", devcfg.mqtt_topic);
+
+  while (1)
+  {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool room = connected && ninflight < MQTT_INFLIGHT;
+    uint32_t pos = next_pos;
+    xSemaphoreGive(lock);
+
+    if (!room)
+      return;
+
+    uint32_t first = pos < outbox_tail() ? outbox_tail() : pos;
+    pos = first;
+    int n = outbox_read(&pos, batch, MQTT_BATCH);
+    int len = n ? format_batch(n) : 0;
+
+    if (len <= 0)
+    {
+      xSemaphoreTake(lock, portMAX_DELAY);
+      if (next_pos < pos)
+        next_pos = pos;
+      xSemaphoreGive(lock);
+      return;
+    }
+
+    int msg_id = esp_mqtt_client_publish(client, topic, msg, len, 1, 0);
+    if (msg_id < 0)
+      return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    stats.published++;
+    next_pos = pos;
+    inflight[ninflight].msg_id = msg_id;
+    inflight[ninflight].pos = first;
+    inflight[ninflight].count = pos - first;
+    ninflight++;
+
+    /* only this message can have been acked early; the rest are stale */
+    for (int i = 0; i < nearly; i++)
+    {
+      if (early[i] == msg_id)
+      {
+        acked(ninflight - 1);
+        break;
+      }
+    }
+    nearly = 0;
+
+    xSemaphoreGive(lock);
+  }
+}
+
+static void publish_stats(void)
+{
+  int64_t now = esp_timer_get_time();
+
+  if (!devcfg.mqtt_stats || now - last_stats_us < devcfg.mqtt_stats * 1000000LL)
+    return;
+
+  last_stats_us = now;
+
+  wifi_ap_record_t ap;
+  int rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+
+  char topic[80];
+  snprintf(topic, sizeof(topic), "%s/stats", devcfg.mqtt_topic);
+
+  char body[192];
+  int len = snprintf(body, sizeof(body),
+                     "{\"uptime\":%lld,\"heap\":%lu,\"rssi\":%d,\"waiting\":%lu,"
+                     "\"published\":%lu,\"acked\":%lu,\"connects\":%lu}",
+                     now / 1000000, (unsigned long)esp_get_free_heap_size(), rssi,
+                     (unsigned long)(outbox_head() - outbox_tail()),
+                     (unsigned long)stats.published, (unsigned long)stats.acked,
+                     (unsigned long)stats.connects);
+
+  esp_mqtt_client_publish(client, topic, body, len, 0, 0);
+}
+
+static void client_stop(void)
+{
+  if (!client)
+    return;
+
+  esp_mqtt_client_destroy(client);
+  client = NULL;
+
+  /* its outbox went with it: start again from the tail */
+  xSemaphoreTake(lock, portMAX_DELAY);
+  connected = false;
+  ninflight = nearly = 0;
+  next_pos = 0;
+  xSemaphoreGive(lock);
+}
+
+static void client_begin(void)
+{
+  esp_mqtt_client_config_t config = {
+      .broker.address.uri = devcfg.mqtt_uri,
+      .buffer.out_size = MQTT_MSG_MAX + 128,
+      .outbox.limit = MQTT_INFLIGHT * (MQTT_MSG_MAX + 128),
+  };
+
+  client = esp_mqtt_client_init(&config);
+  if (!client)
+    return;
+
+  strlcpy(client_uri, devcfg.mqtt_uri, sizeof(client_uri));
+  esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event, NULL);
+  esp_mqtt_client_start(client);
+}
+
+static void publisher_task(void *arg)
+{
+  while (1)
+  {
+    vTaskDelay(pdMS_TO_TICKS(MQTT_POLL_MS));
+
+    if (!devcfg.mqtt_enable || !outbox_available())
+    {
+      client_stop();
+      continue;
+    }
+
+    if (client && strcmp(client_uri, devcfg.mqtt_uri) != 0)
+      client_stop();
+
+    /* the client reconnects by itself once it has been started */
+    if (!client)
+    {
+      if (network_wait_online(MQTT_POLL_MS))
+        client_begin();
+      continue;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool up = connected;
+    xSemaphoreGive(lock);
+
+    if (!up)
+      continue;
+
+    pump();
+    publish_stats();
+  }
+}
+
+void publisher_stats_str(char *out, size_t len)
+{
+  if (!devcfg.mqtt_enable)
+  {
+    snprintf(out, len, "off");
+    return;
+  }
+
+  snprintf(out, len, "%s, %d in flight, %lu messages / %lu fixes acked, %lu connects, %lu deleted",
+           connected ? "connected" : "offline", ninflight,
+           (unsigned long)stats.published, (unsigned long)stats.acked,
+           (unsigned long)stats.connects, (unsigned long)stats.deleted);
+
+  if (stats.backlog_us)
+  {
+    size_t used = strlen(out);
+    snprintf(out + used, len - used, ", draining %lu", (unsigned long)stats.backlog);
+  }
+  else if (stats.recovered)
+  {
+    size_t used = strlen(out);
+    int64_t ms = stats.recover_us / 1000;
+    snprintf(out + used, len - used, ", last backlog %lu fixes in %lld ms (%lu/s)",
+             (unsigned long)stats.recovered, ms,
+             (unsigned long)(ms ? stats.recovered * 1000LL / ms : 0));
+  }
+}
+
+void publisher_start(void)
+{
+  lock = xSemaphoreCreateMutex();
+
+  xTaskCreate(publisher_task, "publisher", 6144, NULL, 4, NULL);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "nmea_parser.h"
+
+/*
+ * MQTT telemetry for the "MQTT" settings.
+ *
+ * A fix every mqtt_interval seconds goes into the flash outbox first and
+ * is published from there, QoS 1, to <mqtt_topic>/fix as a JSON array of
+ * fixes, each carrying its outbox position as "seq" so a subscriber can
+ * drop the duplicates at-least-once delivery allows. It leaves the outbox
+ * only when the broker's PUBACK arrives.
+ *
+ * Up to MQTT_INFLIGHT messages are unacknowledged at a time, so after a
+ * coverage gap the backlog drains in MQTT_BATCH-fix messages without
+ * waiting a round trip for each. Across a reconnect esp-mqtt resends those
+ * from its own outbox; only what it gives up on (MQTT_EVENT_DELETED) is
+ * published again from the flash outbox. Bridge stats go to <mqtt_topic>/stats
+ * every mqtt_stats seconds, QoS 0 and never stored: only the latest
+ * matters.
+ */
+
+#define MQTT_BATCH 16    // fixes per message
+#define MQTT_INFLIGHT 8  // messages awaiting PUBACK
+#define MQTT_POLL_MS 100
+#define MQTT_MSG_MAX (MQTT_BATCH * 128)
+
+void publisher_start(void); // after the network stack
+
+/* every RMC */
+void publisher_fix(const gps_data_t *g);
+
+void publisher_stats_str(char *out, size_t len);
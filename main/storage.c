@@ -1,7 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_rom_crc.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 
@@ -11,35 +19,263 @@ static const char *TAG = "storage";
 
 device_config_t devcfg = {0};
 
+/* blob layout in NVS: header, then the first `size` bytes of device_config_t */
+typedef struct
+{
+    uint16_t version;
+    uint16_t size;
+    uint32_t crc;
+} config_blob_hdr_t;
+
+typedef struct
+{
+    config_blob_hdr_t hdr;
+    device_config_t cfg;
+} config_blob_t;
+
+static SemaphoreHandle_t lock;
+static esp_timer_handle_t commit_timer;
+
+static config_blob_t blob;         // load/commit buffer
+static device_config_t committed;  // what NVS holds
+static device_config_t pending;    // waiting for the commit timer
+static bool dirty;
+
+static config_stats_t stats;
+
+#define CONFIG_DESC(type, name, lim, def, group, label)                           \
+    {#name, label, offsetof(device_config_t, name), sizeof(((device_config_t *)0)->name), \
+     lim, CONFIG_##type, CONFIG_GROUP_##group},
+
+const config_field_t config_fields[] = {CONFIG_FIELDS(CONFIG_DESC)};
+const int config_field_count = sizeof(config_fields) / sizeof(config_fields[0]);
+
+#define CONFIG_GROUP_DESC(id, label, name) {label, name},
+
+const config_group_desc_t config_groups[CONFIG_GROUP_COUNT] = {CONFIG_GROUPS(CONFIG_GROUP_DESC)};
+
+#define CONFIG_DEFAULT_STR(name, def) strlcpy(cfg->name, def, sizeof(cfg->name));
+#define CONFIG_DEFAULT_SSID(name, def) CONFIG_DEFAULT_STR(name, def)
+#define CONFIG_DEFAULT_BOOL(name, def) cfg->name = def;
+#define CONFIG_DEFAULT_U16(name, def) cfg->name = def;
+#define CONFIG_DEFAULT(type, name, lim, def, group, label) CONFIG_DEFAULT_##type(name, def)
+
 static void config_apply_defaults(device_config_t *cfg)
 {
     ESP_LOGI(TAG, "applying default config");
 
-    strcpy(cfg->ap_ssid, "ESP32");
-    strcpy(cfg->ap_key, "12345678");
+    CONFIG_FIELDS(CONFIG_DEFAULT)
+}
+
+/* per-type handlers, indexed by config_type_t */
+
+static esp_err_t str_nvs_get(nvs_handle_t nvs, const config_field_t *f, void *p)
+{
+    size_t len = f->size;
+    return nvs_get_str(nvs, f->name, p, &len);
+}
+
+static esp_err_t u8_nvs_get(nvs_handle_t nvs, const config_field_t *f, void *p)
+{
+    return nvs_get_u8(nvs, f->name, p);
+}
+
+static esp_err_t u16_nvs_get(nvs_handle_t nvs, const config_field_t *f, void *p)
+{
+    return nvs_get_u16(nvs, f->name, p);
+}
+
+static bool str_valid(const config_field_t *f, const void *p)
+{
+    return memchr(p, 0, f->size) != NULL;
+}
+
+static bool bool_valid(const config_field_t *f, const void *p)
+{
+    return *(const uint8_t *)p <= 1;
+}
+
+static bool u16_valid(const config_field_t *f, const void *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v <= f->lim;
+}
+
+static bool str_set(const config_field_t *f, void *p, const char *s)
+{
+    if (strlen(s) >= f->size)
+        return false;
+
+    strcpy(p, s);
+    return true;
+}
+
+static bool bool_set(const config_field_t *f, void *p, const char *s)
+{
+    *(uint8_t *)p = strcmp(s, "1") == 0;
+    return true;
+}
+
+static bool u16_set(const config_field_t *f, void *p, const char *s)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 10);
+
+    if (end == s || *end || v > f->lim)
+        return false;
+
+    uint16_t u = v;
+    memcpy(p, &u, sizeof(u));
+    return true;
+}
+
+static void str_get(const config_field_t *f, const void *p, char *out, size_t len)
+{
+    strlcpy(out, p, len);
+}
+
+static void bool_get(const config_field_t *f, const void *p, char *out, size_t len)
+{
+    snprintf(out, len, "%u", *(const uint8_t *)p);
+}
+
+static void u16_get(const config_field_t *f, const void *p, char *out, size_t len)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    snprintf(out, len, "%u", v);
+}
+
+static const struct
+{
+    esp_err_t (*nvs_get)(nvs_handle_t nvs, const config_field_t *f, void *p);
+    bool (*valid)(const config_field_t *f, const void *p);
+    bool (*set)(const config_field_t *f, void *p, const char *s);
+    void (*get)(const config_field_t *f, const void *p, char *out, size_t len);
+} ops[CONFIG_TYPES] = {
+    [CONFIG_STR] = {str_nvs_get, str_valid, str_set, str_get},
+    [CONFIG_SSID] = {str_nvs_get, str_valid, str_set, str_get},
+    [CONFIG_BOOL] = {u8_nvs_get, bool_valid, bool_set, bool_get},
+    [CONFIG_U16] = {u16_nvs_get, u16_valid, u16_set, u16_get},
+};
+
+const config_field_t *config_field_find(const char *name)
+{
+    for (int i = 0; i < config_field_count; i++)
+        if (strcmp(config_fields[i].name, name) == 0)
+            return &config_fields[i];
+
+    return NULL;
+}
+
+bool config_field_set(device_config_t *cfg, const config_field_t *f, const char *value)
+{
+    return ops[f->type].set(f, (uint8_t *)cfg + f->offset, value);
+}
+
+void config_field_get(const device_config_t *cfg, const config_field_t *f, char *out, size_t len)
+{
+    ops[f->type].get(f, (const uint8_t *)cfg + f->offset, out, len);
+}
+
+/* anything out of range in a loaded config goes back to its default */
+static void config_validate(device_config_t *cfg)
+{
+    device_config_t def = {0};
+    bool have_def = false;
+
+    for (int i = 0; i < config_field_count; i++)
+    {
+        const config_field_t *f = &config_fields[i];
+        uint8_t *p = (uint8_t *)cfg + f->offset;
+
+        if (ops[f->type].valid(f, p))
+            continue;
+
+        if (!have_def)
+        {
+            config_apply_defaults(&def);
+            have_def = true;
+        }
 
-    cfg->sta_enable = 1;
-    strcpy(cfg->sta_ssid, "KERPZ-AP2");
-    strcpy(cfg->sta_key, "yourpassword");
+        ESP_LOGW(TAG, "%s invalid, using the default", f->name);
+        memcpy(p, (uint8_t *)&def + f->offset, f->size);
+    }
+}
+
+/*
+ * Bring a blob written by older firmware up to CONFIG_VERSION. Fields are
+ * only ever appended, so whatever lies past the stored size simply takes
+ * its default; a field whose meaning changes gets a case here, one per
+ * version step, falling through to the current one.
+ */
+static void config_migrate(device_config_t *cfg, uint16_t version, size_t size)
+{
+    if (size < sizeof(*cfg))
+    {
+        device_config_t def = {0};
+        config_apply_defaults(&def);
+
+        memcpy((uint8_t *)cfg + size, (uint8_t *)&def + size, sizeof(*cfg) - size);
+    }
+
+    switch (version)
+    {
+    case 1:
+        /* current */
+        break;
+    }
+
+    if (version != CONFIG_VERSION)
+        ESP_LOGI(TAG, "config migrated from v%u (%u bytes)", version, (unsigned)size);
+}
+
+static esp_err_t config_load_blob(nvs_handle_t nvs, device_config_t *cfg)
+{
+    size_t len = sizeof(blob);
+    esp_err_t err = nvs_get_blob(nvs, CONFIG_KEY, &blob, &len);
+
+    stats.load_ops++;
+
+    if (err != ESP_OK)
+        return err;
+
+    config_blob_hdr_t *h = &blob.hdr;
+
+    if (len < sizeof(*h) || h->size != len - sizeof(*h) ||
+        h->version == 0 || h->version > CONFIG_VERSION ||
+        h->crc != esp_rom_crc32_le(0, (const uint8_t *)&blob.cfg, h->size))
+        return ESP_ERR_INVALID_CRC;
 
-    cfg->beep_enable = 1;
-    cfg->analog_enable = 1;
-    cfg->display_enable = 0;
-    cfg->ads1115_enable = 0;
+    memcpy(cfg, &blob.cfg, h->size);
+    config_migrate(cfg, h->version, h->size);
 
-    cfg->post_enable = 0;
-    strcpy(cfg->api_url, "https://192.168.2.1:8001/cgi-bin/custom-full.cgi?a=iot");
-    strcpy(cfg->api_key, "NIJCG7UI28O9CAYD");
+    return ESP_OK;
+}
 
-    cfg->http_timeout = 0;
+/* one key per field, as stored before the blob */
+static void config_load_legacy(nvs_handle_t nvs, device_config_t *cfg)
+{
+    nvs_get_u8(nvs, "magic", &cfg->magic);
+
+    for (int i = 0; i < config_field_count; i++)
+    {
+        const config_field_t *f = &config_fields[i];
+        ops[f->type].nvs_get(nvs, f, (uint8_t *)cfg + f->offset);
+    }
+
+    stats.load_ops += 1 + config_field_count;
+    stats.legacy = true;
 }
 
 void config_load(device_config_t *cfg)
 {
+    int64_t t0 = esp_timer_get_time();
+
     memset(cfg, 0, sizeof(*cfg));
 
     nvs_handle_t nvs;
-    size_t len;
 
     if (nvs_open("cfg", NVS_READONLY, &nvs) != ESP_OK)
     {
@@ -47,73 +283,130 @@ void config_load(device_config_t *cfg)
         return;
     }
 
-    nvs_get_u8(nvs, "magic", &cfg->magic);
+    esp_err_t err = config_load_blob(nvs, cfg);
 
-    len = sizeof(cfg->ap_ssid);
-    nvs_get_str(nvs, "ap_ssid", cfg->ap_ssid, &len);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        config_load_legacy(nvs, cfg);
+    }
+    else if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "config blob unusable (%s)", esp_err_to_name(err));
+        memset(cfg, 0, sizeof(*cfg));
+    }
 
-    len = sizeof(cfg->ap_key);
-    nvs_get_str(nvs, "ap_key", cfg->ap_key, &len);
+    nvs_close(nvs);
 
-    nvs_get_u8(nvs, "sta_enable", &cfg->sta_enable);
+    if (cfg->magic == CONFIG_MAGIC)
+        config_validate(cfg);
 
-    len = sizeof(cfg->sta_ssid);
-    nvs_get_str(nvs, "sta_ssid", cfg->sta_ssid, &len);
+    stats.load_us = esp_timer_get_time() - t0;
+    memcpy(&committed, cfg, sizeof(committed));
 
-    len = sizeof(cfg->sta_key);
-    nvs_get_str(nvs, "sta_key", cfg->sta_key, &len);
+    ESP_LOGI(TAG, "config loaded in %lld us, %lu NVS reads%s",
+             stats.load_us, (unsigned long)stats.load_ops,
+             stats.legacy ? " (per-key)" : "");
+}
 
-    nvs_get_u8(nvs, "beep_enable", &cfg->beep_enable);
-    nvs_get_u8(nvs, "analog_enable", &cfg->analog_enable);
-    nvs_get_u8(nvs, "display_enable", &cfg->display_enable);
-    nvs_get_u8(nvs, "ads1115_enable", &cfg->ads1115_enable);
+static void config_mark_dirty(const device_config_t *cfg)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memcpy(&pending, cfg, sizeof(pending));
+    dirty = true;
+    xSemaphoreGive(lock);
+}
 
-    nvs_get_u8(nvs, "post_enable", &cfg->post_enable);
+/* writes pending to NVS now if it differs from what's there */
+void config_flush(void)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
 
-    len = sizeof(cfg->api_url);
-    nvs_get_str(nvs, "api_url", cfg->api_url, &len);
+    if (!dirty)
+    {
+        xSemaphoreGive(lock);
+        return;
+    }
 
-    len = sizeof(cfg->api_key);
-    nvs_get_str(nvs, "api_key", cfg->api_key, &len);
+    int64_t t0 = esp_timer_get_time();
+    nvs_handle_t nvs;
+    nvs_stats_t before = {0}, after = {0};
 
-    nvs_get_u16(nvs, "http_timeout", &cfg->http_timeout);
+    esp_err_t err = nvs_open("cfg", NVS_READWRITE, &nvs);
 
-    nvs_close(nvs);
-}
+    if (err == ESP_OK)
+    {
+        nvs_get_stats(NULL, &before);
 
-void config_save(device_config_t *cfg)
-{
-    nvs_handle_t nvs;
+        /* the per-key config goes along with the first blob */
+        if (stats.legacy)
+            nvs_erase_all(nvs);
 
-    if (nvs_open("cfg", NVS_READWRITE, &nvs) != ESP_OK)
-        return;
+        memcpy(&blob.cfg, &pending, sizeof(blob.cfg));
+        blob.hdr.version = CONFIG_VERSION;
+        blob.hdr.size = sizeof(blob.cfg);
+        blob.hdr.crc = esp_rom_crc32_le(0, (const uint8_t *)&blob.cfg, sizeof(blob.cfg));
 
-    cfg->magic = CONFIG_MAGIC;
+        err = nvs_set_blob(nvs, CONFIG_KEY, &blob, sizeof(blob));
+        if (err == ESP_OK)
+            err = nvs_commit(nvs);
 
-    nvs_set_u8(nvs, "magic", cfg->magic);
+        nvs_get_stats(NULL, &after);
+        nvs_close(nvs);
+    }
 
-    nvs_set_str(nvs, "ap_ssid", cfg->ap_ssid);
-    nvs_set_str(nvs, "ap_key", cfg->ap_key);
+    /* entries used up, i.e. written; a page GC in between hides some */
+    int written = before.free_entries > after.free_entries ? before.free_entries - after.free_entries : 0;
 
-    nvs_set_u8(nvs, "sta_enable", cfg->sta_enable);
-    nvs_set_str(nvs, "sta_ssid", cfg->sta_ssid);
-    nvs_set_str(nvs, "sta_key", cfg->sta_key);
+    if (err == ESP_OK)
+    {
+        memcpy(&committed, &pending, sizeof(committed));
+        dirty = false;
+        stats.legacy = false;
+        stats.commits++;
+        stats.entries += written;
+    }
 
-    nvs_set_u8(nvs, "beep_enable", cfg->beep_enable);
-    nvs_set_u8(nvs, "analog_enable", cfg->analog_enable);
-    nvs_set_u8(nvs, "display_enable", cfg->display_enable);
-    nvs_set_u8(nvs, "ads1115_enable", cfg->ads1115_enable);
+    xSemaphoreGive(lock);
 
-    nvs_set_u8(nvs, "post_enable", cfg->post_enable);
-    nvs_set_str(nvs, "api_url", cfg->api_url);
-    nvs_set_str(nvs, "api_key", cfg->api_key);
+    if (err == ESP_OK)
+        ESP_LOGI(TAG, "config saved, %d NVS entries written in %lld us",
+                 written, esp_timer_get_time() - t0);
+    else
+        ESP_LOGE(TAG, "config save failed: %s", esp_err_to_name(err));
+}
 
-    nvs_set_u16(nvs, "http_timeout", cfg->http_timeout);
+static void config_commit_cb(void *arg)
+{
+    config_flush();
+}
 
-    nvs_commit(nvs);
-    nvs_close(nvs);
+/* cheap to call: unchanged config is dropped, bursts share one commit */
+void config_save(device_config_t *cfg)
+{
+    cfg->magic = CONFIG_MAGIC;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
 
-    ESP_LOGI(TAG, "config saved");
+    stats.saves++;
+    dirty = memcmp(cfg, &committed, sizeof(*cfg)) != 0;
+
+    if (dirty)
+        memcpy(&pending, cfg, sizeof(pending));
+    else
+        stats.unchanged++;
+
+    xSemaphoreGive(lock);
+
+    esp_timer_stop(commit_timer);
+    if (dirty)
+        esp_timer_start_once(commit_timer, CONFIG_COMMIT_MS * 1000ULL);
+}
+
+void config_stats(config_stats_t *out)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(lock);
 }
 
 void storage_start(void)
@@ -127,6 +420,16 @@ void storage_start(void)
         nvs_flash_init();
     }
 
+    lock = xSemaphoreCreateMutex();
+
+    const esp_timer_create_args_t commit_timer_args = {
+        .callback = config_commit_cb,
+        .name = "config_commit"};
+    esp_timer_create(&commit_timer_args, &commit_timer);
+
+    /* a change still waiting for the timer is written before a restart */
+    esp_register_shutdown_handler(config_flush);
+
     config_load(&devcfg);
 
     if (devcfg.magic != CONFIG_MAGIC)
@@ -134,6 +437,14 @@ void storage_start(void)
         ESP_LOGI(TAG, "first boot detected");
 
         config_apply_defaults(&devcfg);
-        config_save(&devcfg);
+        devcfg.magic = CONFIG_MAGIC;
+        config_mark_dirty(&devcfg);
+    }
+    else if (stats.legacy)
+    {
+        config_mark_dirty(&devcfg);
     }
+
+    /* defaults and per-key configs go to the blob now, not after the timer */
+    config_flush();
 }
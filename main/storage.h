@@ -2,38 +2,155 @@
 #define STORAGE_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 /* Config magic for first boot detection */
 #define CONFIG_MAGIC 0xA5
 
+/*
+ * The config lives in NVS as one CRC-checked blob under CONFIG_KEY,
+ * tagged with CONFIG_VERSION. Bump the version when a field changes
+ * meaning and handle it in config_migrate(); new fields go at the end of
+ * device_config_t and pick up their defaults from older blobs.
+ *
+ * config_save() only updates RAM and (re)arms a timer; the blob is
+ * committed CONFIG_COMMIT_MS after the last change, and only if
+ * something actually changed.
+ */
+#define CONFIG_VERSION 1
+#define CONFIG_KEY "config"
+#define CONFIG_COMMIT_MS 2000
+
+/*
+ * Config schema: every field is listed once, here, and the struct, the
+ * defaults, the per-key NVS names, validation, the /config JSON and the
+ * form layout are all generated from it.
+ *
+ *   X(type, name, lim, default, group, label)
+ *
+ *   STR   char[lim], at most lim - 1 characters
+ *   SSID  STR shown as the scanned-network picker
+ *   BOOL  uint8_t 0/1, an Enabled/Disabled select
+ *   U16   uint16_t, 0..lim, a text box
+ *
+ * group is one of CONFIG_GROUPS or NONE to keep a field off the form.
+ * The order is the blob layout; append only (see CONFIG_VERSION).
+ */
+#define CONFIG_GROUPS(G)                           \
+    G(WIFIAP, "Wifi AP", "expand_wifiap")          \
+    G(WIFISTA, "Wifi Sta", "expand_wifista")       \
+    G(COMPONENT, "Components", "expand_component") \
+    G(POST, "API Post", "expand_post")             \
+    G(REPLAY, "Stream Replay", "expand_replay")    \
+    G(TRACK, "Track Log", "expand_track")          \
+    G(GPS, "GPS", "expand_gps")                    \
+    G(MQTT, "MQTT", "expand_mqtt")
+
+#define CONFIG_FIELDS(X)                                                                              \
+    X(STR, ap_ssid, 32, "ESP32", WIFIAP, "AP SSID")                                                   \
+    X(STR, ap_key, 16, "12345678", WIFIAP, "AP Key")                                                  \
+    X(BOOL, sta_enable, 1, 1, WIFISTA, "Wifi Sta")                                                    \
+    X(SSID, sta_ssid, 32, "KERPZ-AP2", WIFISTA, "Sta SSID")                                           \
+    X(STR, sta_key, 16, "yourpassword", WIFISTA, "Sta Key")                                           \
+    X(BOOL, beep_enable, 1, 1, COMPONENT, "Beep")                                                     \
+    X(BOOL, analog_enable, 1, 1, COMPONENT, "Analog")                                                 \
+    X(BOOL, display_enable, 1, 0, COMPONENT, "Display")                                               \
+    X(BOOL, ads1115_enable, 1, 0, COMPONENT, "ADS1115")                                               \
+    X(BOOL, post_enable, 1, 0, POST, "API Post")                                                      \
+    X(STR, api_url, 256, "https://192.168.2.1:8001/cgi-bin/custom-full.cgi?a=iot", POST, "API url")   \
+    X(STR, api_key, 32, "NIJCG7UI28O9CAYD", POST, "API key")                                          \
+    X(U16, http_timeout, 65535, 0, NONE, "HTTP Timeout")                                              \
+    X(U16, replay_sec, 3600, 10, REPLAY, "Seconds")                                                   \
+    X(U16, replay_kb, 16, 8, REPLAY, "Max KB")                                                        \
+    X(BOOL, track_enable, 1, 1, TRACK, "Record")                                                      \
+    X(U16, gps_aid, 2, 0, GPS, "Aiding (0 off, 1 PMTK, 2 UBX)")                                       \
+    X(U16, wifi_ps, 3, 0, WIFISTA, "Power Save (0 auto, 1 off, 2 min, 3 max)")                        \
+    X(U16, post_batch, 100, 10, POST, "Batch (records)")                                              \
+    X(U16, post_interval, 3600, 10, POST, "Interval (s)")                                             \
+    X(BOOL, post_raw, 1, 0, POST, "Raw NMEA")                                                         \
+    X(BOOL, mqtt_enable, 1, 0, MQTT, "MQTT")                                                          \
+    X(STR, mqtt_uri, 128, "mqtt://192.168.2.1", MQTT, "Broker URI")                                   \
+    X(STR, mqtt_topic, 64, "gps/bridge", MQTT, "Topic prefix")                                        \
+    X(U16, mqtt_interval, 3600, 1, MQTT, "Fix every (s)")                                             \
+    X(U16, mqtt_stats, 3600, 60, MQTT, "Stats every (s)")                                             \
+    X(BOOL, ap_sta_off, 1, 1, WIFIAP, "Off while Sta online")
+
+#define CONFIG_MEMBER_STR(name, lim) char name[lim];
+#define CONFIG_MEMBER_SSID(name, lim) char name[lim];
+#define CONFIG_MEMBER_BOOL(name, lim) uint8_t name;
+#define CONFIG_MEMBER_U16(name, lim) uint16_t name;
+#define CONFIG_MEMBER(type, name, lim, def, group, label) CONFIG_MEMBER_##type(name, lim)
+
 typedef struct
 {
     uint8_t magic;
 
-    /* WiFi AP */
-    char ap_ssid[32];
-    char ap_key[16];
+    CONFIG_FIELDS(CONFIG_MEMBER)
 
-    /* WiFi STA */
-    uint8_t sta_enable;
-    char sta_ssid[32];
-    char sta_key[16];
+} device_config_t;
 
-    /* Components */
-    uint8_t beep_enable;
-    uint8_t analog_enable;
-    uint8_t display_enable;
-    uint8_t ads1115_enable;
+typedef enum
+{
+    CONFIG_STR,
+    CONFIG_SSID,
+    CONFIG_BOOL,
+    CONFIG_U16,
+    CONFIG_TYPES
+} config_type_t;
 
-    /* API */
-    uint8_t post_enable;
-    char api_url[256];
-    char api_key[32];
+#define CONFIG_GROUP_ENUM(id, label, name) CONFIG_GROUP_##id,
 
-    uint16_t http_timeout;
+typedef enum
+{
+    CONFIG_GROUP_NONE = -1,
+    CONFIG_GROUPS(CONFIG_GROUP_ENUM)
+    CONFIG_GROUP_COUNT
+} config_group_t;
 
-} device_config_t;
+typedef struct
+{
+    const char *label;
+    const char *name;
+} config_group_desc_t;
+
+/* one per field, in schema order; offsets are compile-time constants */
+typedef struct
+{
+    const char *name;
+    const char *label;
+    uint16_t offset;
+    uint16_t size;
+    uint16_t lim;
+    uint8_t type;
+    int8_t group;
+} config_field_t;
+
+/* longest value config_field_get() produces, NUL included */
+#define CONFIG_VALUE_MAX 256
+
+extern const config_field_t config_fields[];
+extern const int config_field_count;
+extern const config_group_desc_t config_groups[CONFIG_GROUP_COUNT];
+
+/* NULL if there's no such field */
+const config_field_t *config_field_find(const char *name);
+
+/* from/to the form's string form; false (and no change) if out of range */
+bool config_field_set(device_config_t *cfg, const config_field_t *f, const char *value);
+void config_field_get(const device_config_t *cfg, const config_field_t *f, char *out, size_t len);
+
+typedef struct
+{
+    int64_t load_us;    // boot-time config_load
+    uint32_t load_ops;  // NVS reads it took
+    bool legacy;        // per-key config not yet converted
+    uint32_t saves;
+    uint32_t unchanged; // saves that changed nothing
+    uint32_t commits;
+    uint32_t entries;   // NVS entries written by commits
+} config_stats_t;
 
 /* Global config */
 extern device_config_t devcfg;
@@ -42,5 +159,7 @@ extern device_config_t devcfg;
 void storage_start(void);
 void config_load(device_config_t *cfg);
 void config_save(device_config_t *cfg);
+void config_flush(void);
+void config_stats(config_stats_t *out);
 
 #endif
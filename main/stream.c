@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "stream.h"
+
+static const char *TAG = "stream";
+
+typedef struct
+{
+  uint16_t len;
+  uint8_t type;
+  uint8_t reserved;
+  uint32_t ms; // arrival, esp_timer
+} rec_hdr_t;
+
+static uint8_t ring[STREAM_RING_SIZE];
+static uint32_t head; // next write offset
+static uint32_t tail; // oldest record still in the ring
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buf;
+
+static stream_notify_t subscribers[STREAM_MAX_SUBSCRIBERS];
+static int subscriber_count;
+
+static void ring_put(uint32_t off, const void *src, size_t len)
+{
+  size_t i = off & (STREAM_RING_SIZE - 1);
+  size_t n = STREAM_RING_SIZE - i;
+
+  if (n > len)
+    n = len;
+
+  memcpy(&ring[i], src, n);
+  memcpy(ring, (const uint8_t *)src + n, len - n);
+}
+
+static void ring_get(uint32_t off, void *dst, size_t len)
+{
+  size_t i = off & (STREAM_RING_SIZE - 1);
+  size_t n = STREAM_RING_SIZE - i;
+
+  if (n > len)
+    n = len;
+
+  memcpy(dst, &ring[i], n);
+  memcpy((uint8_t *)dst + n, ring, len - n);
+}
+
+void stream_init(void)
+{
+  lock = xSemaphoreCreateMutexStatic(&lock_buf);
+  head = tail = 0;
+
+  ESP_LOGI(TAG, "stream ring %d bytes", STREAM_RING_SIZE);
+}
+
+void stream_subscribe(stream_notify_t fn)
+{
+  if (subscriber_count < STREAM_MAX_SUBSCRIBERS)
+    subscribers[subscriber_count++] = fn;
+}
+
+void stream_write(uint8_t type, const void *data, size_t len)
+{
+  if (len > STREAM_REC_MAX)
+    len = STREAM_REC_MAX;
+
+  rec_hdr_t hdr = {
+      .len = len,
+      .type = type,
+      .ms = esp_timer_get_time() / 1000};
+  size_t need = sizeof(hdr) + len;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  /* evict whole records until the new one fits */
+  while (head + need - tail > STREAM_RING_SIZE)
+  {
+    rec_hdr_t old;
+    ring_get(tail, &old, sizeof(old));
+    tail += sizeof(old) + old.len;
+  }
+
+  ring_put(head, &hdr, sizeof(hdr));
+  ring_put(head + sizeof(hdr), data, len);
+  head += need;
+
+  xSemaphoreGive(lock);
+
+  for (int i = 0; i < subscriber_count; i++)
+    subscribers[i]();
+}
+
+uint32_t stream_head(void)
+{
+  return head;
+}
+
+/* oldest record younger than max_age_ms that is within max_bytes of the head */
+uint32_t stream_replay_cursor(uint32_t max_age_ms, size_t max_bytes)
+{
+  uint32_t now = esp_timer_get_time() / 1000;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  uint32_t cursor = tail;
+
+  while (cursor != head)
+  {
+    rec_hdr_t hdr;
+    ring_get(cursor, &hdr, sizeof(hdr));
+
+    if (head - cursor <= max_bytes && now - hdr.ms <= max_age_ms)
+      break;
+
+    cursor += sizeof(hdr) + hdr.len;
+  }
+
+  xSemaphoreGive(lock);
+
+  return cursor;
+}
+
+size_t stream_read(uint32_t *cursor, uint8_t mask, uint8_t *type,
+                   void *buf, size_t cap, uint32_t *dropped)
+{
+  size_t n = 0;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  if ((int32_t)(*cursor - tail) < 0)
+  {
+    if (dropped)
+      *dropped += tail - *cursor;
+    *cursor = tail;
+  }
+
+  while (*cursor != head)
+  {
+    rec_hdr_t hdr;
+    ring_get(*cursor, &hdr, sizeof(hdr));
+
+    if (!(hdr.type & mask))
+    {
+      *cursor += sizeof(hdr) + hdr.len;
+      continue;
+    }
+
+    /* only raw bytes coalesce, and only with raw bytes */
+    if (n > 0 && (hdr.type != STREAM_RAW || *type != STREAM_RAW || n + hdr.len > cap))
+      break;
+
+    if (hdr.len > cap)
+    {
+      if (dropped)
+        *dropped += hdr.len;
+      *cursor += sizeof(hdr) + hdr.len;
+      continue;
+    }
+
+    ring_get(*cursor + sizeof(hdr), (uint8_t *)buf + n, hdr.len);
+    n += hdr.len;
+    *type = hdr.type;
+    *cursor += sizeof(hdr) + hdr.len;
+
+    if (hdr.type != STREAM_RAW)
+      break;
+  }
+
+  xSemaphoreGive(lock);
+
+  return n;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Fan-out ring for the bridged UART stream.
+ *
+ * One producer appends records; any number of consumers each keep their
+ * own cursor (a monotonic byte offset) and read at their own pace. A
+ * consumer that falls more than STREAM_RING_SIZE behind loses the oldest
+ * records and is told how many bytes it missed.
+ *
+ * Records carry their arrival time, so a new consumer can start from a
+ * point in the recent past (stream_replay_cursor) instead of the head and
+ * get the history straight out of the ring before the live data.
+ */
+
+#define STREAM_RING_SIZE 16384 // power of two, also bounds the replay history
+#define STREAM_REC_MAX 512    // largest record payload
+
+/* record types, also used as read masks */
+#define STREAM_RAW 0x01  // UART bytes, adjacent records may be coalesced
+#define STREAM_JSON 0x02 // {"t":...} event for the web UI, one per frame
+#define STREAM_FIX 0x04  // parsed fix as a JSON object, one per RMC
+
+#define STREAM_MAX_SUBSCRIBERS 4
+
+typedef void (*stream_notify_t)(void);
+
+void stream_init(void);
+void stream_subscribe(stream_notify_t fn);
+
+void stream_write(uint8_t type, const void *data, size_t len);
+uint32_t stream_head(void);
+uint32_t stream_replay_cursor(uint32_t max_age_ms, size_t max_bytes);
+size_t stream_read(uint32_t *cursor, uint8_t mask, uint8_t *type,
+                   void *buf, size_t cap, uint32_t *dropped);
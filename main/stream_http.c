@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "storage.h"
+#include "stream.h"
+#include "powersave.h"
+#include "stream_http.h"
+
+static const char *TAG = "stream_http";
+
+typedef struct
+{
+  httpd_req_t *req; // async copy, NULL if the slot is free
+  int fd;
+  bool sse;
+  uint8_t mask; // STREAM_RAW or STREAM_FIX
+
+  uint32_t cursor;
+  uint32_t sent;
+  uint32_t dropped;
+  uint32_t dropped_told;
+  int64_t last_send; // us
+
+  char line[STREAM_LINE_MAX]; // SSE + NMEA: sentence being assembled
+  size_t line_len;
+} stream_conn_t;
+
+static stream_conn_t conns[STREAM_HTTP_MAX];
+static SemaphoreHandle_t lock;
+static TaskHandle_t task;
+
+/* task only */
+static char out[STREAM_HTTP_BATCH * 2];
+static size_t out_len;
+
+static esp_err_t conn_flush(stream_conn_t *c)
+{
+  if (!out_len)
+    return ESP_OK;
+
+  esp_err_t err = httpd_resp_send_chunk(c->req, out, out_len);
+
+  c->sent += out_len;
+  c->last_send = esp_timer_get_time();
+  out_len = 0;
+
+  return err;
+}
+
+static esp_err_t conn_put(stream_conn_t *c, const char *data, size_t len)
+{
+  while (len)
+  {
+    if (out_len == sizeof(out))
+    {
+      esp_err_t err = conn_flush(c);
+      if (err != ESP_OK)
+        return err;
+    }
+
+    size_t n = sizeof(out) - out_len;
+    if (n > len)
+      n = len;
+
+    memcpy(out + out_len, data, n);
+    out_len += n;
+    data += n;
+    len -= n;
+  }
+
+  return ESP_OK;
+}
+
+static esp_err_t conn_event(stream_conn_t *c, const char *data, size_t len)
+{
+  esp_err_t err = conn_put(c, "data: ", 6);
+  if (err == ESP_OK)
+    err = conn_put(c, data, len);
+  if (err == ESP_OK)
+    err = conn_put(c, "\n\n", 2);
+  return err;
+}
+
+static esp_err_t conn_emit(stream_conn_t *c, const uint8_t *buf, size_t n)
+{
+  if (c->mask == STREAM_FIX && c->sse)
+    return conn_event(c, (const char *)buf, n);
+
+  if (c->mask == STREAM_FIX)
+  {
+    esp_err_t err = conn_put(c, (const char *)buf, n);
+    return err == ESP_OK ? conn_put(c, "\n", 1) : err;
+  }
+
+  if (!c->sse)
+    return conn_put(c, (const char *)buf, n);
+
+  /* one event per sentence; SSE data can't span raw line breaks */
+  for (size_t i = 0; i < n; i++)
+  {
+    char ch = buf[i];
+
+    if (ch == '\n' || ch == '\r')
+    {
+      if (c->line_len)
+      {
+        esp_err_t err = conn_event(c, c->line, c->line_len);
+        if (err != ESP_OK)
+          return err;
+      }
+      c->line_len = 0;
+    }
+    else if (c->line_len < sizeof(c->line))
+    {
+      c->line[c->line_len++] = ch;
+    }
+  }
+
+  return ESP_OK;
+}
+
+static bool conn_writable(int fd)
+{
+  fd_set wfds;
+  struct timeval tv = {0};
+
+  FD_ZERO(&wfds);
+  FD_SET(fd, &wfds);
+
+  return select(fd + 1, NULL, &wfds, NULL, &tv) > 0;
+}
+
+static esp_err_t conn_serve(stream_conn_t *c, int64_t now)
+{
+  static uint8_t buf[STREAM_HTTP_BATCH];
+  esp_err_t err = ESP_OK;
+
+  while (err == ESP_OK && c->cursor != stream_head() && conn_writable(c->fd))
+  {
+    uint8_t type;
+    size_t n = stream_read(&c->cursor, c->mask, &type, buf, sizeof(buf), &c->dropped);
+    if (n == 0)
+      break;
+
+    err = conn_emit(c, buf, n);
+    if (err == ESP_OK)
+      err = conn_flush(c);
+  }
+
+  if (err != ESP_OK)
+    return err;
+
+  if (c->sse && c->dropped != c->dropped_told && conn_writable(c->fd))
+  {
+    char msg[48];
+    int len = snprintf(msg, sizeof(msg), "event: dropped\ndata: %lu\n\n",
+                       (unsigned long)c->dropped);
+    c->dropped_told = c->dropped;
+    c->line_len = 0; // the partial sentence lost its tail
+    err = conn_put(c, msg, len);
+  }
+  else if (c->sse && now - c->last_send > STREAM_HTTP_PING_MS * 1000LL)
+  {
+    err = conn_put(c, ": ping\n\n", 8); // also finds dead peers
+  }
+
+  if (err == ESP_OK)
+    err = conn_flush(c);
+
+  return err;
+}
+
+static void stream_http_task(void *arg)
+{
+  while (1)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+
+    int64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < STREAM_HTTP_MAX; i++)
+    {
+      stream_conn_t *c = &conns[i];
+      if (!c->req)
+        continue;
+
+      if (conn_serve(c, now) == ESP_OK)
+        continue;
+
+      ESP_LOGI(TAG, "fd=%d closed, sent %lu B, dropped %lu B",
+               c->fd, (unsigned long)c->sent, (unsigned long)c->dropped);
+
+      out_len = 0;
+      httpd_sess_trigger_close(c->req->handle, c->fd);
+      httpd_req_async_handler_complete(c->req);
+
+      xSemaphoreTake(lock, portMAX_DELAY);
+      c->req = NULL;
+      xSemaphoreGive(lock);
+
+      powersave_release();
+    }
+  }
+}
+
+static void stream_http_notify(void)
+{
+  if (task)
+    xTaskNotifyGive(task);
+}
+
+esp_err_t stream_http_handler(httpd_req_t *req)
+{
+  char query[48];
+  char format[8] = "sse";
+  char data[8] = "nmea";
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    httpd_query_key_value(query, "format", format, sizeof(format));
+    httpd_query_key_value(query, "data", data, sizeof(data));
+  }
+
+  bool sse = strcmp(format, "raw") != 0;
+  bool json = strcmp(data, "json") == 0;
+
+  /* only this handler fills slots and it runs on the httpd task alone */
+  stream_conn_t *c = NULL;
+  for (int i = 0; i < STREAM_HTTP_MAX && !c; i++)
+    if (!conns[i].req)
+      c = &conns[i];
+
+  httpd_req_t *areq = NULL;
+
+  if (!c || httpd_req_async_handler_begin(req, &areq) != ESP_OK)
+  {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "5");
+    return httpd_resp_sendstr(req, "too many streams");
+  }
+
+  c->fd = httpd_req_to_sockfd(areq);
+  c->sse = sse;
+  c->mask = json ? STREAM_FIX : STREAM_RAW;
+  c->sent = 0;
+  c->dropped = 0;
+  c->dropped_told = 0;
+  c->line_len = 0;
+  c->last_send = esp_timer_get_time();
+  c->cursor = stream_replay_cursor(devcfg.replay_sec * 1000,
+                                   devcfg.replay_kb * 1024);
+
+  if (sse)
+    httpd_resp_set_type(areq, "text/event-stream");
+  else
+    httpd_resp_set_type(areq, json ? "application/x-ndjson" : "text/plain");
+
+  httpd_resp_set_hdr(areq, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(areq, "Access-Control-Allow-Origin", "*");
+
+  /* SSE headers go out now; a raw stream's go with its first data */
+  if (sse)
+    httpd_resp_send_chunk(areq, "retry: 2000\n\n", 13);
+
+  ESP_LOGI(TAG, "fd=%d %s %s", c->fd, sse ? "sse" : "raw", json ? "json" : "nmea");
+
+  /* the stream task owns the connection from here */
+  xSemaphoreTake(lock, portMAX_DELAY);
+  c->req = areq;
+  xSemaphoreGive(lock);
+
+  powersave_hold();
+
+  stream_http_notify();
+  return ESP_OK;
+}
+
+void stream_http_start(void)
+{
+  lock = xSemaphoreCreateMutex();
+  xTaskCreate(stream_http_task, "stream_http", 4096, NULL, 5, &task);
+  stream_subscribe(stream_http_notify);
+}
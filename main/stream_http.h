@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+/*
+ * GET /stream?format=sse|raw&data=nmea|json
+ *
+ * Long-lived HTTP views of the stream ring for clients that don't speak
+ * WebSocket: Server-Sent Events or a plain chunked body, carrying either
+ * the raw NMEA sentences or one JSON object per fix. Connections are
+ * handed off with the async request API to one task that serves each from
+ * its own ring cursor, and only while its socket can take more, so a slow
+ * reader loses data instead of holding anyone up.
+ */
+
+#define STREAM_HTTP_MAX 2        // concurrent /stream connections
+#define STREAM_HTTP_BATCH 1024   // ring bytes read per pass
+#define STREAM_HTTP_PING_MS 15000
+#define STREAM_LINE_MAX 128      // longest NMEA sentence kept whole for SSE
+
+void stream_http_start(void);
+esp_err_t stream_http_handler(httpd_req_t *req);
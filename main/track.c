@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "storage.h"
+#include "track.h"
+
+static const char *TAG = "track";
+
+static const esp_partition_t *part;
+static int nsectors;
+static SemaphoreHandle_t lock;
+
+/* what page 0 of each sector says; seq 0 = nothing valid there */
+static struct
+{
+  uint32_t seq;
+  uint32_t erases;
+  uint32_t first_ts; // time index
+} sectors[TRACK_SECTORS_MAX];
+
+static int head_sector; // next page to program
+static int head_page;
+static uint32_t next_seq = 1;
+
+static track_page_t cur; // page being filled
+static track_page_t scratch;
+
+static struct
+{
+  uint32_t records;
+  uint32_t stored;   // records programmed to flash
+  uint32_t pages;
+  uint32_t erases;
+  uint32_t errors;
+  int64_t busy_us;   // time spent in track_add, flash included
+  int64_t recover_us;
+  int recover_reads;
+} stats;
+
+/* last range query */
+static struct
+{
+  uint32_t queries;
+  uint32_t pages;   // flash pages read
+  uint32_t records; // records visited
+  int64_t seek_us;  // until the first record in range
+  int64_t us;
+} qstats;
+
+static uint32_t page_crc(const track_page_t *p)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)p + sizeof(p->crc),
+                          sizeof(*p) - sizeof(p->crc));
+}
+
+static bool page_valid(const track_page_t *p)
+{
+  return p->magic == TRACK_PAGE_MAGIC &&
+         p->count > 0 && p->count <= TRACK_PAGE_RECS &&
+         p->crc == page_crc(p);
+}
+
+static bool page_erased(const track_page_t *p)
+{
+  const uint8_t *b = (const uint8_t *)p;
+
+  for (size_t i = 0; i < sizeof(*p); i++)
+    if (b[i] != 0xFF)
+      return false;
+
+  return true;
+}
+
+static esp_err_t page_read(int sector, int page, track_page_t *p)
+{
+  return esp_partition_read(part, sector * TRACK_SECTOR_SIZE + page * TRACK_PAGE_SIZE,
+                            p, sizeof(*p));
+}
+
+static void page_reset(void)
+{
+  memset(&cur, 0xFF, sizeof(cur));
+  cur.count = 0;
+}
+
+static void track_recover(void)
+{
+  int64_t t0 = esp_timer_get_time();
+  int newest = -1;
+  uint32_t last = 0;
+
+  for (int s = 0; s < nsectors; s++)
+  {
+    sectors[s].seq = 0;
+    sectors[s].erases = 0;
+
+    stats.recover_reads++;
+    if (page_read(s, 0, &scratch) != ESP_OK || !page_valid(&scratch))
+      continue;
+
+    sectors[s].seq = scratch.seq;
+    sectors[s].erases = scratch.erases;
+    sectors[s].first_ts = scratch.rec[0].ts;
+
+    if (scratch.seq > last)
+    {
+      last = scratch.seq;
+      newest = s;
+    }
+  }
+
+  if (newest >= 0)
+  {
+    /* everything that isn't blank is used up, torn pages included */
+    head_sector = newest;
+    head_page = 1;
+
+    for (int p = 1; p < TRACK_PAGES; p++)
+    {
+      stats.recover_reads++;
+      if (page_read(newest, p, &scratch) != ESP_OK || page_erased(&scratch))
+        break;
+
+      head_page = p + 1;
+      if (page_valid(&scratch) && scratch.seq > last)
+        last = scratch.seq;
+    }
+
+    if (head_page == TRACK_PAGES)
+    {
+      head_sector = (head_sector + 1) % nsectors;
+      head_page = 0;
+    }
+  }
+
+  next_seq = last + 1;
+  stats.recover_us = esp_timer_get_time() - t0;
+}
+
+static void page_program(void)
+{
+  size_t sector_off = head_sector * TRACK_SECTOR_SIZE;
+  esp_err_t err = ESP_OK;
+
+  /* the oldest sector goes when the ring comes round to it */
+  if (head_page == 0)
+  {
+    err = esp_partition_erase_range(part, sector_off, TRACK_SECTOR_SIZE);
+    sectors[head_sector].seq = 0;
+    sectors[head_sector].erases++;
+    stats.erases++;
+  }
+
+  cur.magic = TRACK_PAGE_MAGIC;
+  cur.version = 1;
+  cur.seq = next_seq++;
+  cur.erases = sectors[head_sector].erases;
+  cur.crc = page_crc(&cur);
+
+  if (err == ESP_OK)
+    err = esp_partition_write(part, sector_off + head_page * TRACK_PAGE_SIZE,
+                              &cur, sizeof(cur));
+
+  if (err == ESP_OK)
+  {
+    if (head_page == 0)
+    {
+      sectors[head_sector].seq = cur.seq;
+      sectors[head_sector].first_ts = cur.rec[0].ts;
+    }
+
+    stats.pages++;
+    stats.stored += cur.count;
+  }
+  else
+  {
+    stats.errors++;
+    ESP_LOGE(TAG, "sector %d page %d: %s", head_sector, head_page, esp_err_to_name(err));
+  }
+
+  /* a failed page is skipped, not retried */
+  if (++head_page == TRACK_PAGES)
+  {
+    head_sector = (head_sector + 1) % nsectors;
+    head_page = 0;
+  }
+
+  page_reset();
+}
+
+void track_rec_from(const gps_data_t *g, time_t ts, track_rec_t *r)
+{
+  float speed = g->speed_knots * 51.4444f; // cm/s
+
+  r->ts = (uint32_t)ts;
+  r->lat = (int32_t)lround(g->latitude * 1e7);
+  r->lon = (int32_t)lround(g->longitude * 1e7);
+  r->alt = (int32_t)lroundf(g->altitude * 10);
+  r->speed = speed > 65535 ? 65535 : (uint16_t)speed;
+  r->sats = g->satellites > 255 ? 255 : g->satellites;
+  r->fix = g->fix;
+}
+
+void track_add(const gps_data_t *g)
+{
+  if (!part || !devcfg.track_enable || !g->fix)
+    return;
+
+  time_t ts = gps_epoch(g);
+  if (ts <= 0)
+    return;
+
+  int64_t t0 = esp_timer_get_time();
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  track_rec_from(g, ts, &cur.rec[cur.count++]);
+
+  stats.records++;
+
+  if (cur.count == TRACK_PAGE_RECS)
+    page_program();
+
+  stats.busy_us += esp_timer_get_time() - t0;
+
+  xSemaphoreGive(lock);
+}
+
+void track_flush(void)
+{
+  if (!part)
+    return;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  if (cur.count)
+    page_program();
+
+  xSemaphoreGive(lock);
+}
+
+bool track_available(void)
+{
+  return part != NULL;
+}
+
+/* ring position 0 is the oldest sector; with head_page 0 that's the head */
+static int ring_sector(int pos)
+{
+  return (head_sector + (head_page ? 1 : 0) + pos) % nsectors;
+}
+
+/* first_ts at pos, or of the nearest sector before it with data */
+static uint32_t ring_key(int pos)
+{
+  for (; pos >= 0; pos--)
+  {
+    int s = ring_sector(pos);
+    if (sectors[s].seq)
+      return sectors[s].first_ts;
+  }
+
+  return 0;
+}
+
+/* last ring position whose sector starts at or before ts */
+static int ring_seek(uint32_t ts)
+{
+  int lo = 0, hi = nsectors - 1, found = 0;
+
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    if (ring_key(mid) <= ts)
+    {
+      found = mid;
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+
+  return found;
+}
+
+typedef struct
+{
+  uint32_t from, to;
+  track_visit_t visit;
+  void *ctx;
+  bool done;
+  bool first;
+  int64_t t0;
+} query_t;
+
+static void query_page(query_t *q, const track_rec_t *rec, int count)
+{
+  for (int i = 0; i < count && !q->done; i++)
+  {
+    if (rec[i].ts < q->from)
+      continue;
+
+    if (rec[i].ts > q->to)
+    {
+      q->done = true;
+      break;
+    }
+
+    if (!q->first)
+    {
+      q->first = true;
+      qstats.seek_us = esp_timer_get_time() - q->t0;
+    }
+
+    qstats.records++;
+    if (!q->visit(q->ctx, &rec[i]))
+      q->done = true;
+  }
+}
+
+esp_err_t track_query(uint32_t from, uint32_t to, track_visit_t visit, void *ctx)
+{
+  if (!part)
+    return ESP_ERR_NOT_FOUND;
+
+  query_t q = {from, to, visit, ctx, false, false, esp_timer_get_time()};
+  track_page_t page;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int s = ring_sector(ring_seek(from));
+  xSemaphoreGive(lock);
+
+  qstats.queries++;
+  qstats.pages = 0;
+  qstats.records = 0;
+  qstats.seek_us = 0;
+
+  /*
+   * Walk the ring by sector rather than by position, which moves when the
+   * writer does. Sequence numbers rise all the way round, so a drop means
+   * we're back at the oldest. The lock is only held per page read.
+   */
+  uint32_t prev = 0;
+
+  for (int k = 0; k < nsectors && !q.done; k++, s = (s + 1) % nsectors)
+  {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t seq = sectors[s].seq;
+    xSemaphoreGive(lock);
+
+    if (!seq && !prev)
+      continue; // not written yet on the first lap
+    if (seq < prev || !seq)
+      break;
+    prev = seq;
+
+    for (int p = 0; p < TRACK_PAGES && !q.done; p++)
+    {
+      xSemaphoreTake(lock, portMAX_DELAY);
+      /* the writer may have come round and erased it */
+      bool same = sectors[s].seq == seq;
+      esp_err_t err = same ? page_read(s, p, &page) : ESP_ERR_INVALID_STATE;
+      xSemaphoreGive(lock);
+
+      if (err != ESP_OK || page_erased(&page))
+        break;
+
+      qstats.pages++;
+      if (page_valid(&page))
+        query_page(&q, page.rec, page.count);
+    }
+  }
+
+  if (!q.done)
+  {
+    track_rec_t rec[TRACK_PAGE_RECS];
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int count = cur.count;
+    memcpy(rec, cur.rec, count * sizeof(rec[0]));
+    xSemaphoreGive(lock);
+
+    query_page(&q, rec, count);
+  }
+
+  qstats.us = esp_timer_get_time() - q.t0;
+
+  ESP_LOGI(TAG, "query %lu..%lu: %lu recs, %lu pages, first after %lld us, %lld us",
+           (unsigned long)from, (unsigned long)to,
+           (unsigned long)qstats.records, (unsigned long)qstats.pages,
+           qstats.seek_us, qstats.us);
+
+  return ESP_OK;
+}
+
+void track_query_str(char *out, size_t len)
+{
+  snprintf(out, len, "%lu queries, last %lu recs / %lu pages, first %lu us, total %lu ms",
+           (unsigned long)qstats.queries, (unsigned long)qstats.records,
+           (unsigned long)qstats.pages, (unsigned long)qstats.seek_us,
+           (unsigned long)(qstats.us / 1000));
+}
+
+void track_stats_str(char *out, size_t len)
+{
+  if (!part)
+  {
+    snprintf(out, len, "no partition");
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+
+  uint32_t wear = 0;
+  for (int s = 0; s < nsectors; s++)
+    if (sectors[s].erases > wear)
+      wear = sectors[s].erases;
+
+  /* bytes programmed per byte of fixes; partial pages push it up */
+  float wa = stats.stored ? (float)stats.pages * TRACK_PAGE_SIZE / (stats.stored * sizeof(track_rec_t)) : 0;
+  unsigned long rate = stats.busy_us ? (unsigned long)(stats.records * 1000000LL / stats.busy_us) : 0;
+
+  snprintf(out, len, "%lu recs, %lu pages, WA %.2f, %lu rec/s max, wear %lu, %lu err, recovery %lu us",
+           (unsigned long)stats.records, (unsigned long)stats.pages, wa, rate,
+           (unsigned long)wear, (unsigned long)stats.errors, (unsigned long)stats.recover_us);
+
+  xSemaphoreGive(lock);
+}
+
+void track_start(void)
+{
+  /* held through recovery: uart2 is already running and may add fixes */
+  lock = xSemaphoreCreateMutex();
+  xSemaphoreTake(lock, portMAX_DELAY);
+  page_reset();
+
+  part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+  if (!part)
+  {
+    xSemaphoreGive(lock);
+    ESP_LOGW(TAG, "no spiffs partition, track log disabled");
+    return;
+  }
+
+  nsectors = part->size / TRACK_SECTOR_SIZE;
+  if (nsectors > TRACK_SECTORS_MAX)
+    nsectors = TRACK_SECTORS_MAX;
+
+  track_recover();
+
+  xSemaphoreGive(lock);
+
+  /* the page being filled goes to flash on esp_restart() */
+  esp_register_shutdown_handler(track_flush);
+
+  ESP_LOGI(TAG, "%d sectors, head %d/%d, seq %lu, recovered in %lld us (%d reads)",
+           nsectors, head_sector, head_page, (unsigned long)next_seq,
+           stats.recover_us, stats.recover_reads);
+}
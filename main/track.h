@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#include "nmea_parser.h"
+
+/*
+ * Append-only track log on the spiffs data partition.
+ *
+ * Fixes are stored as fixed-point records, TRACK_PAGE_RECS to a 256 byte
+ * flash page. A page is programmed once, when it fills (or on restart), and
+ * carries its own sequence number and CRC. Pages fill a 4 KB sector front
+ * to back and sectors are used as a ring, so every sector is erased once
+ * per lap and the oldest track is the first to go.
+ *
+ * Recovery reads the first page of every sector and then the pages of the
+ * newest one, so it costs the same whatever the log holds. A page torn by
+ * a power cut fails its CRC and is skipped; at most one page of fixes is
+ * lost.
+ *
+ * The first timestamp of every sector is kept in RAM as a sparse time
+ * index, so a range query binary-searches to the sector holding its start
+ * and reads flash only from there on.
+ */
+
+#define TRACK_PAGE_SIZE 256
+#define TRACK_SECTOR_SIZE 4096
+#define TRACK_PAGES (TRACK_SECTOR_SIZE / TRACK_PAGE_SIZE)
+#define TRACK_SECTORS_MAX 256  // 1 MB; a larger partition is used up to this
+#define TRACK_PAGE_MAGIC 0x54B1
+#define TRACK_PAGE_RECS 12
+
+typedef struct __attribute__((packed))
+{
+  uint32_t ts;     // UTC seconds
+  int32_t lat;     // 1e-7 degrees
+  int32_t lon;     // 1e-7 degrees
+  int32_t alt;     // decimetres
+  uint16_t speed;  // cm/s
+  uint8_t sats;
+  uint8_t fix;
+} track_rec_t;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t crc;    // over the rest of the page
+  uint16_t magic;
+  uint8_t count;
+  uint8_t version;
+  uint32_t seq;    // page sequence, increasing
+  uint32_t erases; // times this sector has been erased
+  track_rec_t rec[TRACK_PAGE_RECS];
+} track_page_t;
+
+_Static_assert(sizeof(track_rec_t) == 20, "track record size");
+_Static_assert(sizeof(track_page_t) == TRACK_PAGE_SIZE, "track page size");
+
+/* false stops the query */
+typedef bool (*track_visit_t)(void *ctx, const track_rec_t *r);
+
+void track_start(void);
+void track_add(const gps_data_t *g);
+void track_rec_from(const gps_data_t *g, time_t ts, track_rec_t *r); // ts from gps_epoch()
+void track_flush(void);
+bool track_available(void);
+
+/* records with from <= ts <= to, oldest first, unflushed ones included */
+esp_err_t track_query(uint32_t from, uint32_t to, track_visit_t visit, void *ctx);
+
+void track_stats_str(char *out, size_t len);
+void track_query_str(char *out, size_t len);
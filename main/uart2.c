@@ -5,16 +5,26 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <string.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
-#include "webserver.h"
+#include "storage.h"
+#include "stream.h"
 #include "nmea_parser.h"
+#include "track.h"
+#include "aiding.h"
+#include "boot.h"
+#include "powersave.h"
+#include "ntp.h"
+#include "gpsd.h"
+#include "publisher.h"
 #include "uart2.h"
 
 static const char *TAG = "uart2";
 
-static int tcp_client_sock = -1;
+static QueueHandle_t uart_queue;
 
 void uart2_tcp_task(void *arg)
 {
@@ -34,10 +44,19 @@ void uart2_tcp_task(void *arg)
   {
     sock = accept(listen_sock, NULL, NULL);
     ESP_LOGI(TAG, "TCP client connected");
-
-    tcp_client_sock = sock;
-
-    while (1)
+    powersave_hold();
+
+    /* start in the recent past so the client has a full picture at once;
+       the first one after boot gets everything captured while Wi-Fi came up */
+    static bool first = true;
+    uint32_t cursor = first ? stream_replay_cursor(esp_timer_get_time() / 1000, STREAM_RING_SIZE)
+                            : stream_replay_cursor(devcfg.replay_sec * 1000,
+                                                   devcfg.replay_kb * 1024);
+    first = false;
+    uint32_t dropped = 0;
+    bool alive = true;
+
+    while (alive)
     {
       uint8_t buf[128];
 
@@ -57,13 +76,31 @@ void uart2_tcp_task(void *arg)
         break;
       }
 
+      /* UART -> TCP */
+      uint8_t out[STREAM_REC_MAX];
+      uint8_t type;
+      size_t n;
+
+      while ((n = stream_read(&cursor, STREAM_RAW, &type,
+                              out, sizeof(out), &dropped)) > 0)
+      {
+        if (send(sock, out, n, 0) < 0)
+        {
+          alive = false;
+          break;
+        }
+
+        boot_mark(BOOT_TCP_SERVED);
+      }
+
       vTaskDelay(pdMS_TO_TICKS(20));
     }
 
     close(sock);
-    tcp_client_sock = -1;
+    powersave_release();
 
-    ESP_LOGI(TAG, "TCP client disconnected");
+    ESP_LOGI(TAG, "TCP client disconnected (dropped %lu bytes)",
+             (unsigned long)dropped);
   }
 }
 
@@ -74,24 +111,45 @@ void uart2_task(void *arg)
   static char linebuf[256];
   static int linepos = 0;
 
+  uart_event_t event;
+
   while (1)
   {
-    int len = uart_read_bytes(
-        UART_NUM_2,
-        buf,
-        sizeof(buf),
-        pdMS_TO_TICKS(100));
+    if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+    {
+      ESP_LOGW(TAG, "RX overflow, input flushed");
+      uart_flush_input(UART2_PORT);
+      xQueueReset(uart_queue);
+      continue;
+    }
+
+    if (event.type != UART_DATA)
+      continue;
+
+    int64_t now = esp_timer_get_time();
+    int len = uart_read_bytes(UART2_PORT, buf, sizeof(buf), 0);
 
     if (len > 0)
     {
-      ws_broadcast((char *)buf, len);
+      /*
+       * the driver hands bytes over at the FIFO threshold or after the
+       * line has been idle UART2_RX_TOUT characters, so the first byte
+       * came in len (+ the timeout) character times ago
+       */
+      int64_t first_us = now - (len + (event.timeout_flag ? UART2_RX_TOUT : 0)) * UART2_CHAR_US;
 
-      if (tcp_client_sock >= 0)
-      {
-        send(tcp_client_sock, buf, len, 0);
-      }
+      ntp_uart_rx(first_us, now);
+
+      stream_write(STREAM_RAW, buf, len);
+      boot_mark(BOOT_UART_RX);
+
+      /* the receiver is up and listening */
+      aiding_inject();
 
-      ESP_LOGI("GPS_RAW", "%.*s", len, buf);
+      ESP_LOGD("GPS_RAW", "%.*s", len, buf);
 
       for (int i = 0; i < len; i++)
       {
@@ -107,31 +165,25 @@ void uart2_task(void *arg)
 
             gps_data_t *g = gps_get_data();
 
-            if (g->fix)
+            gps_update_system_time(g);
+
+            /* one parsed record per epoch, for the JSON stream views */
+            if (linepos > 6 && strncmp(linebuf + 3, "RMC", 3) == 0)
             {
-              struct tm t = {0};
-
-              if (strlen(g->utc_time) >= 6)
-                sscanf(g->utc_time, "%2d%2d%2d",
-                       &t.tm_hour,
-                       &t.tm_min,
-                       &t.tm_sec);
-
-              int day, mon, year;
-              if (strlen(g->utc_date) >= 6)
-              {
-                sscanf(g->utc_date, "%2d%2d%2d",
-                       &day, &mon, &year);
-                t.tm_mday = day;
-                t.tm_mon = mon - 1;
-                t.tm_year = year + 100; // 2000+
-              }
-
-              time_t epoch = mktime(&t);
-              struct timeval now = {
-                  .tv_sec = epoch,
-                  .tv_usec = 0};
-              settimeofday(&now, NULL);
+              char fix[192];
+              int n = snprintf(fix, sizeof(fix),
+                               "{\"t\":\"fix\",\"time\":\"%s\",\"date\":\"%s\",\"fix\":%d,"
+                               "\"lat\":%.6f,\"lon\":%.6f,\"alt\":%.1f,\"speed\":%.2f,\"sats\":%d}",
+                               g->utc_time, g->utc_date, g->fix,
+                               g->latitude, g->longitude, g->altitude,
+                               g->speed_knots, g->satellites);
+              stream_write(STREAM_FIX, fix, n);
+
+              track_add(g);
+              aiding_update(g);
+              ntp_gps_fix(g);
+              gpsd_epoch(g);
+              publisher_fix(g);
             }
 
             ESP_LOGI("GPS_PARSED",
@@ -167,13 +219,23 @@ void uart2_start(void)
       .source_clk = UART_SCLK_DEFAULT,
   };
 
-  ESP_ERROR_CHECK(uart_driver_install(UART2_PORT, BUF_SIZE, BUF_SIZE, 0, NULL, 0));
+  ESP_ERROR_CHECK(uart_driver_install(UART2_PORT, BUF_SIZE, BUF_SIZE, 20, &uart_queue, 0));
   ESP_ERROR_CHECK(uart_param_config(UART2_PORT, &uart_config));
   ESP_ERROR_CHECK(uart_set_pin(UART2_PORT, UART2_TXD, UART2_RXD,
                                UART2_RTS, UART2_CTS));
 
+  /* the default FIFO threshold keeps records large; the timeout is pinned for the stamp */
+  ESP_ERROR_CHECK(uart_set_rx_timeout(UART2_PORT, UART2_RX_TOUT));
+
   xTaskCreate(uart2_task, "uart2_task", 4096, NULL, 5, NULL);
+
+  boot_mark(BOOT_UART);
+}
+
+/* needs the network stack */
+void uart2_bridge_start(void)
+{
   xTaskCreate(uart2_tcp_task, "uart2_tcp", 4096, NULL, 5, NULL);
 
-  ESP_LOGI(TAG, "uart2 started");
+  ESP_LOGI(TAG, "uart2 bridge on port %d", UART2_TCP_BRIDGE_PORT);
 }
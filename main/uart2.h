@@ -11,6 +11,10 @@
 
 #define UART2_TCP_BRIDGE_PORT 5000
 
+#define UART2_CHAR_US (10 * 1000000 / UART2_BAUD_RATE)
+#define UART2_RX_TOUT 10 // idle characters before the driver hands over a short read
+
 #define BUF_SIZE 1024
 
-void uart2_start(void);
\ No newline at end of file
+void uart2_start(void); // capture only
+void uart2_bridge_start(void);
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+
+#include "storage.h"
+#include "stream.h"
+#include "network.h"
+#include "assets.h"
+#include "boot.h"
+#include "uploader.h"
+
+static const char *TAG = "uploader";
+
+/* task only */
+static esp_http_client_handle_t client;
+static char client_url[256];
+static char *ca_pem; // UPLOAD_CA_PATH while the client is open, NUL terminated
+
+static char queue[UPLOAD_QUEUE_SIZE]; // '\n' terminated records, oldest first
+static size_t queue_len;
+static int queue_count;
+
+static char body[UPLOAD_BODY_MAX];
+static char line[128]; // raw sentence being assembled
+static size_t line_len;
+
+static uint32_t cursor;
+static uint8_t mask;
+static int retry;
+static int64_t retry_at_us;
+static int64_t last_post_us;
+
+/* set from network_changed */
+static volatile bool online;
+static volatile bool relinked;
+
+static struct
+{
+  int64_t since_us; // first post
+  uint32_t requests;
+  uint32_t failures;
+  uint32_t connects;
+  uint32_t records;
+  uint32_t dropped; // queue overflow
+  uint64_t bytes;   // request bodies
+  int64_t last_us;  // round trip of the last post
+  int last_status;
+} stats;
+
+static void queue_drop(int n)
+{
+  size_t off = 0;
+
+  for (int i = 0; i < n && off < queue_len; i++)
+    off += (char *)memchr(queue + off, '\n', queue_len - off) - (queue + off) + 1;
+
+  memmove(queue, queue + off, queue_len - off);
+  queue_len -= off;
+  queue_count -= n;
+}
+
+static void queue_push(const char *rec, size_t len)
+{
+  if (len + 1 > sizeof(queue))
+    return;
+
+  while (queue_len + len + 1 > sizeof(queue))
+  {
+    queue_drop(1);
+    stats.dropped++;
+  }
+
+  memcpy(queue + queue_len, rec, len);
+  queue[queue_len + len] = '\n';
+  queue_len += len + 1;
+  queue_count++;
+}
+
+static void queue_clear(void)
+{
+  queue_len = queue_count = 0;
+  line_len = 0;
+}
+
+/* everything new in the stream ring, as records */
+static void drain(void)
+{
+  uint8_t buf[STREAM_REC_MAX];
+  uint8_t type;
+  uint32_t dropped = 0;
+  size_t n;
+
+  while ((n = stream_read(&cursor, mask, &type, buf, sizeof(buf), &dropped)) > 0)
+  {
+    if (type == STREAM_FIX)
+    {
+      queue_push((char *)buf, n);
+      continue;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+      char ch = buf[i];
+
+      if (ch == '\n' || ch == '\r')
+      {
+        if (line_len)
+          queue_push(line, line_len);
+        line_len = 0;
+      }
+      else if (line_len < sizeof(line))
+      {
+        line[line_len++] = ch;
+      }
+    }
+  }
+}
+
+static esp_err_t http_event(esp_http_client_event_t *evt)
+{
+  if (evt->event_id == HTTP_EVENT_ON_CONNECTED)
+    stats.connects++;
+  return ESP_OK;
+}
+
+static void client_close(void)
+{
+  if (!client)
+    return;
+
+  esp_http_client_cleanup(client);
+  client = NULL;
+
+  free(ca_pem);
+  ca_pem = NULL;
+}
+
+/* copied out: the client needs it on every reconnect, the bundle can change */
+static void ca_load(void)
+{
+  asset_t a;
+
+  boot_wait(BOOT_DATA); // assets mapped
+
+  if (!assets_get(UPLOAD_CA_PATH, &a))
+    return;
+
+  if (!(a.flags & ASSETS_GZIP) && (ca_pem = malloc(a.size + 1)))
+  {
+    memcpy(ca_pem, a.data, a.size);
+    ca_pem[a.size] = 0;
+  }
+
+  assets_release();
+}
+
+static bool client_open(void)
+{
+  if (client && strcmp(client_url, devcfg.api_url) == 0)
+    return true;
+
+  client_close();
+  ca_load();
+
+  esp_http_client_config_t config = {
+      .url = devcfg.api_url,
+      .method = HTTP_METHOD_POST,
+      .timeout_ms = devcfg.http_timeout ? devcfg.http_timeout : UPLOAD_TIMEOUT_MS,
+      .keep_alive_enable = true,
+      .save_client_session = true,
+      .cert_pem = ca_pem,
+      .crt_bundle_attach = ca_pem ? NULL : esp_crt_bundle_attach,
+      .event_handler = http_event,
+  };
+
+  client = esp_http_client_init(&config);
+  if (!client)
+  {
+    free(ca_pem);
+    ca_pem = NULL;
+    return false;
+  }
+
+  strlcpy(client_url, devcfg.api_url, sizeof(client_url));
+  return true;
+}
+
+/* the oldest records that fit in one body; returns how many */
+static int build_body(bool json, size_t *len)
+{
+  size_t off = 0, used = 0;
+  int n = 0;
+  int batch = devcfg.post_batch ? devcfg.post_batch : 1;
+
+  if (json)
+    body[used++] = '[';
+
+  while (n < batch && off < queue_len)
+  {
+    size_t rec = (char *)memchr(queue + off, '\n', queue_len - off) - (queue + off);
+
+    /* room for the separator and the closing bracket */
+    if (used + rec + 2 > sizeof(body))
+      break;
+
+    if (json && n)
+      body[used++] = ',';
+    memcpy(body + used, queue + off, rec);
+    used += rec;
+    if (!json)
+      body[used++] = '\n';
+
+    off += rec + 1;
+    n++;
+  }
+
+  if (json)
+    body[used++] = ']';
+
+  *len = used;
+  return n;
+}
+
+static void post(void)
+{
+  bool json = mask == STREAM_FIX;
+  size_t len;
+  int n = build_body(json, &len);
+
+  if (!n)
+  {
+    /* a record larger than the body; it can never go */
+    queue_drop(1);
+    stats.dropped++;
+    return;
+  }
+
+  if (!client_open())
+    return;
+
+  esp_http_client_set_header(client, "Content-Type", json ? "application/json" : "text/plain");
+  esp_http_client_set_header(client, "X-API-Key", devcfg.api_key);
+  esp_http_client_set_post_field(client, body, len);
+
+  int64_t t0 = esp_timer_get_time();
+  esp_err_t err = esp_http_client_perform(client);
+  int status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+  int64_t now = esp_timer_get_time();
+
+  if (!stats.since_us)
+    stats.since_us = t0;
+  stats.requests++;
+  stats.last_us = now - t0;
+  stats.last_status = status;
+  last_post_us = now;
+
+  if (status >= 200 && status < 300)
+  {
+    queue_drop(n);
+    stats.records += n;
+    stats.bytes += len;
+    retry = 0;
+    return;
+  }
+
+  stats.failures++;
+
+  /* exponential with equal jitter, like the Wi-Fi retries */
+  int64_t ms = (int64_t)UPLOAD_RETRY_MIN_MS << (retry < 10 ? retry : 10);
+  if (ms > UPLOAD_RETRY_MAX_MS)
+    ms = UPLOAD_RETRY_MAX_MS;
+  retry++;
+  retry_at_us = now + (ms / 2 + esp_random() % (ms / 2 + 1)) * 1000;
+
+  ESP_LOGW(TAG, "post failed (%s, HTTP %d), retry %d in %lld ms",
+           esp_err_to_name(err), status, retry, (retry_at_us - now) / 1000);
+
+  /* a dead connection would fail the next try as well */
+  if (err != ESP_OK)
+    esp_http_client_close(client);
+}
+
+/* event loop or esp_timer task: flags only */
+static void network_changed(network_state_t s)
+{
+  if (s == NETWORK_ONLINE)
+    relinked = true;
+  online = s == NETWORK_ONLINE;
+}
+
+static void uploader_task(void *arg)
+{
+  while (1)
+  {
+    vTaskDelay(pdMS_TO_TICKS(UPLOAD_POLL_MS));
+
+    /* the kept-alive socket died with the link; post at once on a new one */
+    if (relinked)
+    {
+      relinked = false;
+      client_close();
+      retry = 0;
+      retry_at_us = 0;
+    }
+
+    uint8_t want = devcfg.post_raw ? STREAM_RAW : STREAM_FIX;
+
+    if (!devcfg.post_enable || want != mask)
+    {
+      client_close();
+      queue_clear();
+      cursor = stream_head();
+      mask = devcfg.post_enable ? want : 0;
+      continue;
+    }
+
+    drain();
+
+    int64_t now = esp_timer_get_time();
+    bool due = queue_count >= (devcfg.post_batch ? devcfg.post_batch : 1) ||
+               (queue_count && now - last_post_us >= devcfg.post_interval * 1000000LL);
+
+    if (!due || now < retry_at_us || !online)
+      continue;
+
+    post();
+  }
+}
+
+void uploader_stats_str(char *out, size_t len)
+{
+  if (!devcfg.post_enable)
+  {
+    snprintf(out, len, "off");
+    return;
+  }
+
+  if (!stats.requests)
+  {
+    snprintf(out, len, "%d queued, nothing posted", queue_count);
+    return;
+  }
+
+  int64_t secs = (esp_timer_get_time() - stats.since_us) / 1000000;
+
+  snprintf(out, len, "%lu posts (%lu failed, HTTP %d), %lu connects, %.2f req/s, "
+                     "%lu records, %llu B/record, %d queued (%lu dropped), last %lld ms",
+           (unsigned long)stats.requests, (unsigned long)stats.failures, stats.last_status,
+           (unsigned long)stats.connects, secs ? (double)stats.requests / secs : 0.0,
+           (unsigned long)stats.records,
+           (unsigned long long)(stats.records ? stats.bytes / stats.records : 0),
+           queue_count, (unsigned long)stats.dropped, stats.last_us / 1000);
+}
+
+void uploader_start(void)
+{
+  network_subscribe(network_changed);
+  online = network_state() == NETWORK_ONLINE;
+
+  xTaskCreate(uploader_task, "uploader", 8192, NULL, 4, NULL);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Poster for the "API Post" settings.
+ *
+ * Fixes (the stream's STREAM_FIX records) or, with post_raw, NMEA
+ * sentences are taken off the stream ring into a bounded RAM queue, one
+ * line per record; the oldest are dropped when it is full. Once post_batch
+ * records are queued, or post_interval seconds after the last post, they
+ * go to api_url in one POST (a JSON array of fixes, or the sentences as
+ * text) with api_key in the X-API-Key header.
+ *
+ * One esp_http_client is kept open across posts, so requests share a
+ * keep-alive connection, and an https reconnect resumes the TLS session
+ * instead of a full handshake. An https server is verified against
+ * UPLOAD_CA_PATH from the www bundle if there is one (a LAN server's own
+ * or private CA), otherwise against the certificate bundle, which only
+ * knows public CAs. A batch stays queued until a 2xx answer;
+ * failures retry with exponential backoff, cut short when the station
+ * comes back online.
+ */
+
+#define UPLOAD_QUEUE_SIZE 8192
+#define UPLOAD_BODY_MAX 4096
+#define UPLOAD_POLL_MS 250
+#define UPLOAD_TIMEOUT_MS 10000 // when http_timeout is 0
+#define UPLOAD_RETRY_MIN_MS 1000
+#define UPLOAD_RETRY_MAX_MS 300000
+#define UPLOAD_CA_PATH "api_ca.pem"
+
+void uploader_start(void);
+
+void uploader_stats_str(char *out, size_t len);
@@ -1,11 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/select.h>
 
 #include "cJSON.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 #include "esp_system.h"
 #include "esp_chip_info.h"
@@ -21,27 +26,179 @@
 #include "esp_partition.h"
 #include "esp_spiffs.h"
 #include "esp_event.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 
 #include "esp_log.h"
 
 #include "storage.h"
 #include "network.h"
-
-#include "html.h"
+#include "nmea_parser.h"
+
+#include "arena.h"
+#include "assets.h"
+#include "deflate.h"
+#include "delta.h"
+#include "ota.h"
+#include "stream.h"
+#include "stream_http.h"
+#include "track.h"
+#include "aiding.h"
+#include "boot.h"
+#include "powersave.h"
+#include "ntp.h"
+#include "gpsd.h"
+#include "uploader.h"
+#include "outbox.h"
+#include "publisher.h"
 #include "webserver.h"
 
 static const char *TAG = "webserver";
 
+/* fields pushed to subscribed WS clients, named after the UI elements */
+static const char *ws_push_keys[WS_PUSH_FIELDS] = {
+    "utc_time", "fix", "latitude", "longitude", "altitude", "speed",
+    "satellites", "free_heap", "connected_devices", "sys_date"};
+
+typedef char ws_push_vals_t[WS_PUSH_FIELDS][24];
+
+/* gzipped UI, generated by tools/www_gzip.py at build time */
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
+
+static char index_etag[12];
+
+typedef struct
+{
+  int fd;
+  uint32_t cursor;       // position in the stream ring
+  uint32_t sent;         // bytes
+  uint32_t dropped;      // bytes overwritten before they could be sent
+  uint32_t max_lag;      // bytes
+  int64_t behind_since;  // us, 0 while keeping up
+
+  uint16_t push_ms;        // status push period, 0 = not subscribed
+  int64_t push_last;       // us
+  ws_push_vals_t push_vals; // as last delivered, for diffing
+} ws_client_t;
+
 typedef struct
 {
   httpd_handle_t server;
-  int clients[MAX_WS_CLIENTS];
+  ws_client_t clients[MAX_WS_CLIENTS];
   int count;
   SemaphoreHandle_t lock;
+  atomic_bool drain_queued;
+  atomic_bool push_queued;
+  esp_timer_handle_t push_timer;
+  uint32_t evicted;
 } ws_manager_t;
 
 static ws_manager_t ws_mgr;
 
+typedef struct
+{
+  httpd_req_t *req;
+  deflate_stream_t *z;
+  int64_t t0;
+  int64_t send_us;
+} resp_stream_t;
+
+static struct
+{
+  uint32_t responses;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  int64_t cpu_us;
+} deflate_stats;
+
+static struct
+{
+  uint32_t parses;
+  uint32_t forms;
+  int64_t parse_us;
+  int64_t form_us;
+} config_form_stats;
+
+typedef struct
+{
+  const char *uri;
+  httpd_method_t method;
+  esp_err_t (*handler)(httpd_req_t *req);
+  int max_inflight; // 0 = run inline on the httpd task
+
+  atomic_int inflight;
+  uint32_t count;
+  uint32_t rejected;
+  int64_t sum_us;      // arrival to handler return
+  int64_t max_us;
+  int64_t max_busy_us; // worst case while another slow request was running
+} http_endpoint_t;
+
+typedef struct
+{
+  httpd_req_t *req;
+  http_endpoint_t *ep;
+  int64_t t0;
+} http_job_t;
+
+static QueueHandle_t http_jobs;
+static atomic_int http_inflight;
+static atomic_int http_running;
+
+static void http_stats_add(cJSON *elements);
+
+static void ws_push_snapshot(ws_push_vals_t v)
+{
+  gps_data_t *g = gps_get_data();
+
+  snprintf(v[0], sizeof(v[0]), "%s", g->utc_time);
+  snprintf(v[1], sizeof(v[1]), "%d", g->fix);
+  snprintf(v[2], sizeof(v[2]), "%.6f", g->latitude);
+  snprintf(v[3], sizeof(v[3]), "%.6f", g->longitude);
+  snprintf(v[4], sizeof(v[4]), "%.1f", g->altitude);
+  snprintf(v[5], sizeof(v[5]), "%.1f", g->speed_knots);
+  snprintf(v[6], sizeof(v[6]), "%d", g->satellites);
+  snprintf(v[7], sizeof(v[7]), "%lu", (unsigned long)esp_get_free_heap_size());
+
+  wifi_sta_list_t sta_list;
+  if (esp_wifi_ap_get_sta_list(&sta_list) != ESP_OK)
+    sta_list.num = 0;
+  snprintf(v[8], sizeof(v[8]), "%d", sta_list.num);
+
+  struct tm timeinfo = {0};
+  time_t now = 0;
+  time(&now);
+  localtime_r(&now, &timeinfo);
+  strftime(v[9], sizeof(v[9]), "%Y-%m-%d %H:%M:%S", &timeinfo);
+}
+
+static void ws_stats_str(char *out, size_t len)
+{
+  uint32_t lag = 0, max_lag = 0, dropped = 0;
+  uint32_t head = stream_head();
+
+  xSemaphoreTake(ws_mgr.lock, portMAX_DELAY);
+
+  for (int i = 0; i < ws_mgr.count; i++)
+  {
+    ws_client_t *c = &ws_mgr.clients[i];
+    if (head - c->cursor > lag)
+      lag = head - c->cursor;
+    if (c->max_lag > max_lag)
+      max_lag = c->max_lag;
+    dropped += c->dropped;
+  }
+
+  snprintf(out, len, "%d, lag %lu/%lu B, dropped %lu B, evicted %lu",
+           ws_mgr.count,
+           (unsigned long)lag, (unsigned long)max_lag,
+           (unsigned long)dropped, (unsigned long)ws_mgr.evicted);
+
+  xSemaphoreGive(ws_mgr.lock);
+}
+
 static void add_text_element(cJSON *arr,
                              const char *label,
                              const char *name,
@@ -85,23 +242,250 @@ static void json_add_select(cJSON *elements,
   cJSON_AddItemToArray(elements, sel);
 }
 
-static void json_copy_str(cJSON *doc,
-                          const char *key,
-                          char *dst,
-                          size_t maxlen)
+static int resp_pick_encoding(httpd_req_t *req)
+{
+  char ae[64];
+  esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept-Encoding", ae, sizeof(ae));
+
+  if (err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC)
+    return -1;
+
+  if (strstr(ae, "gzip"))
+    return DEFLATE_GZIP;
+  if (strstr(ae, "deflate"))
+    return DEFLATE_ZLIB;
+
+  return -1;
+}
+
+static esp_err_t resp_chunk_sink(void *ctx, const char *data, size_t len)
+{
+  resp_stream_t *rs = ctx;
+
+  int64_t t0 = esp_timer_get_time();
+  esp_err_t err = httpd_resp_send_chunk(rs->req, data, len);
+  rs->send_us += esp_timer_get_time() - t0;
+
+  return err;
+}
+
+/* chunked response body, deflated on the fly when enc >= 0 */
+static void resp_stream_begin(resp_stream_t *rs, httpd_req_t *req, int enc)
+{
+  rs->req = req;
+  rs->z = NULL;
+  rs->t0 = esp_timer_get_time();
+  rs->send_us = 0;
+
+  httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+  if (enc < 0)
+    return;
+
+  rs->z = arena_alloc(sizeof(deflate_stream_t));
+  if (!rs->z)
+    return; // identity is always acceptable
+
+  httpd_resp_set_hdr(req, "Content-Encoding",
+                     enc == DEFLATE_GZIP ? "gzip" : "deflate");
+  deflate_begin(rs->z, enc, resp_chunk_sink, rs);
+}
+
+static esp_err_t resp_stream_write(resp_stream_t *rs, const char *data, size_t len)
+{
+  if (rs->z)
+    return deflate_write(rs->z, data, len);
+
+  return httpd_resp_send_chunk(rs->req, data, len);
+}
+
+static esp_err_t resp_stream_end(resp_stream_t *rs)
+{
+  esp_err_t err = ESP_OK;
+
+  if (rs->z)
+  {
+    err = deflate_end(rs->z);
+
+    int64_t cpu_us = esp_timer_get_time() - rs->t0 - rs->send_us;
+
+    deflate_stats.responses++;
+    deflate_stats.bytes_in += rs->z->total_in;
+    deflate_stats.bytes_out += rs->z->total_out;
+    deflate_stats.cpu_us += cpu_us;
+
+    ESP_LOGD(TAG, "deflate %s: %lu -> %lu B in %lld us",
+             rs->req->uri,
+             (unsigned long)rs->z->total_in,
+             (unsigned long)rs->z->total_out,
+             (long long)cpu_us);
+
+    arena_free(rs->z);
+    rs->z = NULL;
+  }
+
+  if (err == ESP_OK)
+    err = httpd_resp_send_chunk(rs->req, NULL, 0);
+
+  return err;
+}
+
+static esp_err_t send_json(httpd_req_t *req, const char *json)
+{
+  size_t len = strlen(json);
+  int enc = resp_pick_encoding(req);
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_type(req, "application/json");
+
+  if (enc < 0 || len < DEFLATE_MIN_SIZE)
+    return httpd_resp_send(req, json, len);
+
+  resp_stream_t rs;
+  resp_stream_begin(&rs, req, enc);
+  resp_stream_write(&rs, json, len);
+  return resp_stream_end(&rs);
+}
+
+/* prints and frees the tree; the handler's arena below it is reused for deflate */
+static esp_err_t send_cjson(httpd_req_t *req, cJSON *root)
+{
+  char *json = arena_print(root);
+  cJSON_Delete(root);
+  arena_trim();
+
+  if (!json)
+    return httpd_resp_send_500(req);
+
+  esp_err_t err = send_json(req, json);
+  arena_free(json);
+
+  return err;
+}
+
+/* whole body, NUL terminated, from the arena; NULL once an error is sent */
+static char *recv_body(httpd_req_t *req)
 {
-  cJSON *it = cJSON_GetObjectItem(doc, key);
-  if (cJSON_IsString(it) && it->valuestring)
+  if (req->content_len > HTTP_BODY_MAX)
   {
-    strncpy(dst, it->valuestring, maxlen - 1);
-    dst[maxlen - 1] = '\0';
+    httpd_resp_set_status(req, "413 Payload Too Large");
+    httpd_resp_sendstr(req, "body too large");
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return NULL;
   }
+
+  char *buf = arena_alloc(req->content_len + 1);
+  if (!buf)
+  {
+    httpd_resp_send_500(req);
+    return NULL;
+  }
+
+  size_t got = 0;
+  int timeouts = 0;
+
+  while (got < req->content_len)
+  {
+    int n = httpd_req_recv(req, buf + got, req->content_len - got);
+    if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < 3)
+      continue;
+    if (n <= 0)
+    {
+      arena_free(buf);
+      return NULL;
+    }
+    got += n;
+  }
+
+  buf[got] = 0;
+  return buf;
+}
+
+static const char *asset_type(const char *path)
+{
+  static const char *types[][2] = {
+      {".html", "text/html"},
+      {".js", "application/javascript"},
+      {".css", "text/css"},
+      {".json", "application/json"},
+      {".svg", "image/svg+xml"},
+      {".png", "image/png"},
+      {".ico", "image/x-icon"},
+  };
+
+  const char *ext = strrchr(path, '.');
+
+  for (int i = 0; ext && i < sizeof(types) / sizeof(types[0]); i++)
+    if (strcmp(ext, types[i][0]) == 0)
+      return types[i][1];
+
+  return "application/octet-stream";
 }
 
-static esp_err_t index_handler(httpd_req_t *req)
+/* GET from the www bundle; "/" is index.html, built into the app as a fallback */
+static esp_err_t asset_handler(httpd_req_t *req)
 {
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_sendstr(req, INDEX_HTML);
+  char path[ASSETS_PATH_MAX];
+  const char *uri = req->uri + 1;
+  size_t n = strcspn(uri, "?");
+
+  if (n == 0)
+  {
+    uri = "index.html";
+    n = strlen(uri);
+  }
+
+  if (n >= sizeof(path))
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "not found");
+
+  memcpy(path, uri, n);
+  path[n] = 0;
+
+  asset_t a;
+  char etag[12];
+  bool mapped = assets_get(path, &a);
+
+  if (mapped)
+  {
+    snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)a.crc);
+  }
+  else if (strcmp(path, "index.html") == 0)
+  {
+    a.data = index_html_gz_start;
+    a.size = index_html_gz_end - index_html_gz_start;
+    a.flags = ASSETS_GZIP;
+    strcpy(etag, index_etag);
+  }
+  else
+  {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "not found");
+  }
+
+  char inm[64];
+
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+  /* same bundle → same CRC → browser revalidates with a bodiless 304 */
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", inm, sizeof(inm)) == ESP_OK &&
+      strstr(inm, etag))
+  {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+  }
+  else
+  {
+    httpd_resp_set_type(req, asset_type(path));
+    if (a.flags & ASSETS_GZIP)
+      httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+
+    /* straight out of the mapped partition */
+    httpd_resp_send(req, (const char *)a.data, a.size);
+  }
+
+  if (mapped)
+    assets_release();
+
   return ESP_OK;
 }
 
@@ -111,23 +495,15 @@ static esp_err_t system_handler(httpd_req_t *req)
   uint8_t expand_wifiap = 1;
   uint8_t expand_wifista = 1;
   uint8_t expand_command = 1;
+  uint8_t expand_http = 0;
 
   // uint8_t timezone = 8;
   // time_t epoch = 1700000000; // fixed epoch for demo
 
-  int total_len = req->content_len;
-  char *buf = malloc(total_len + 1);
+  char *buf = recv_body(req);
   if (!buf)
     return ESP_FAIL;
 
-  int recv_len = httpd_req_recv(req, buf, total_len);
-  if (recv_len <= 0)
-  {
-    free(buf);
-    return ESP_FAIL;
-  }
-  buf[recv_len] = 0;
-
   if (strcmp(buf, "{}") != 0)
   {
     cJSON *doc = cJSON_Parse(buf);
@@ -151,6 +527,10 @@ static esp_err_t system_handler(httpd_req_t *req)
       if (item)
         expand_command = item->valueint;
 
+      item = cJSON_GetObjectItem(doc, "expand_http");
+      if (item)
+        expand_http = item->valueint;
+
       item = cJSON_GetObjectItem(doc, "reboot");
       if (item)
         esp_restart();
@@ -159,7 +539,7 @@ static esp_err_t system_handler(httpd_req_t *req)
     }
   }
 
-  free(buf);
+  arena_free(buf);
 
   char datetime[20];
   struct tm timeinfo = {0};
@@ -214,6 +594,76 @@ static esp_err_t system_handler(httpd_req_t *req)
   char sta_count_str[8];
   sprintf(sta_count_str, "%d", sta_list.num);
 
+  char ws_str[64];
+  ws_stats_str(ws_str, sizeof(ws_str));
+
+  char arena_str[64];
+  arena_stats_str(arena_str, sizeof(arena_str));
+
+  multi_heap_info_t heap;
+  heap_caps_get_info(&heap, MALLOC_CAP_DEFAULT);
+
+  char blocks_str[32];
+  sprintf(blocks_str, "%u used, largest free %u",
+          (unsigned)heap.allocated_blocks, (unsigned)heap.largest_free_block);
+
+  config_stats_t cs;
+  config_stats(&cs);
+
+  char config_str[96];
+  snprintf(config_str, sizeof(config_str),
+           "load %lu us / %lu reads, %lu saves (%lu unchanged), %lu commits / %lu entries",
+           (unsigned long)cs.load_us, (unsigned long)cs.load_ops,
+           (unsigned long)cs.saves, (unsigned long)cs.unchanged,
+           (unsigned long)cs.commits, (unsigned long)cs.entries);
+
+  char form_str[48];
+  snprintf(form_str, sizeof(form_str), "parse %lu us, form %lu us",
+           config_form_stats.parses ? (unsigned long)(config_form_stats.parse_us / config_form_stats.parses) : 0,
+           config_form_stats.forms ? (unsigned long)(config_form_stats.form_us / config_form_stats.forms) : 0);
+
+  char assets_str[96];
+  assets_stats_str(assets_str, sizeof(assets_str));
+
+  char track_str[128];
+  track_stats_str(track_str, sizeof(track_str));
+
+  char query_str[96];
+  track_query_str(query_str, sizeof(query_str));
+
+  char aiding_str[128];
+  aiding_stats_str(aiding_str, sizeof(aiding_str));
+
+  char boot_str[128];
+  boot_timeline_str(boot_str, sizeof(boot_str));
+
+  char wifi_str[192];
+  network_stats_str(wifi_str, sizeof(wifi_str));
+
+  char ps_str[128];
+  powersave_stats_str(ps_str, sizeof(ps_str));
+
+  char ntp_str[128];
+  ntp_stats_str(ntp_str, sizeof(ntp_str));
+
+  char gpsd_str[128];
+  gpsd_stats_str(gpsd_str, sizeof(gpsd_str));
+
+  char upload_str[192];
+  uploader_stats_str(upload_str, sizeof(upload_str));
+
+  char mqtt_str[192];
+  publisher_stats_str(mqtt_str, sizeof(mqtt_str));
+
+  char outbox_str[160];
+  outbox_stats_str(outbox_str, sizeof(outbox_str));
+
+  char deflate_str[48];
+  sprintf(deflate_str, "%lu/%lu B, %lu us/resp",
+          (unsigned long)deflate_stats.bytes_out,
+          (unsigned long)deflate_stats.bytes_in,
+          deflate_stats.responses ? (unsigned long)(deflate_stats.cpu_us / deflate_stats.responses) : 0);
+
   wifi_config_t wifi_cfg;
 
   cJSON *root = cJSON_CreateArray();
@@ -231,6 +681,24 @@ static esp_err_t system_handler(httpd_req_t *req)
   add_text_element(sys_elements, "Flash Size", "flash_size", flash_str);
   add_text_element(sys_elements, "App Code", "app_code", APPCODE);
   add_text_element(sys_elements, "System Date", "sys_date", datetime);
+  add_text_element(sys_elements, "Heap Blocks", "heap_blocks", blocks_str);
+  add_text_element(sys_elements, "Arena", "arena", arena_str);
+  add_text_element(sys_elements, "Deflate", "deflate", deflate_str);
+  add_text_element(sys_elements, "Config", "config_stats", config_str);
+  add_text_element(sys_elements, "Config Form", "config_form", form_str);
+  add_text_element(sys_elements, "Web Assets", "assets", assets_str);
+  add_text_element(sys_elements, "Track Log", "track", track_str);
+  add_text_element(sys_elements, "Track Query", "track_query", query_str);
+  add_text_element(sys_elements, "GPS Aiding", "gps_aiding", aiding_str);
+  add_text_element(sys_elements, "Boot", "boot", boot_str);
+  add_text_element(sys_elements, "Wi-Fi", "wifi", wifi_str);
+  add_text_element(sys_elements, "Power Save", "powersave", ps_str);
+  add_text_element(sys_elements, "NTP", "ntp", ntp_str);
+  add_text_element(sys_elements, "gpsd", "gpsd", gpsd_str);
+  add_text_element(sys_elements, "API Post", "api_post", upload_str);
+  add_text_element(sys_elements, "MQTT", "mqtt", mqtt_str);
+  add_text_element(sys_elements, "Outbox", "outbox", outbox_str);
+  add_text_element(sys_elements, "WS Clients", "ws_clients", ws_str);
 
   cJSON_AddItemToArray(root, sys);
 
@@ -283,263 +751,159 @@ static esp_err_t system_handler(httpd_req_t *req)
 
   cJSON_AddItemToArray(root, cmd);
 
-  char *json_out = cJSON_PrintUnformatted(root);
-
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json_out, HTTPD_RESP_USE_STRLEN);
+  cJSON *http = cJSON_CreateObject();
+  cJSON_AddStringToObject(http, "label", "HTTP");
+  cJSON_AddStringToObject(http, "name", "expand_http");
+  cJSON_AddNumberToObject(http, "value", expand_http);
 
-  cJSON_Delete(root);
-  free(json_out);
+  cJSON *http_elements = cJSON_CreateArray();
+  cJSON_AddItemToObject(http, "elements", http_elements);
 
-  return ESP_OK;
-}
+  http_stats_add(http_elements);
 
-esp_err_t config_handler(httpd_req_t *req)
-{
-  int total = req->content_len;
-  char *buf = malloc(total + 1);
-  if (!buf)
-    return ESP_ERR_NO_MEM;
+  cJSON_AddItemToArray(root, http);
 
-  int received = httpd_req_recv(req, buf, total);
-  if (received <= 0)
-  {
-    free(buf);
-    return ESP_FAIL;
-  }
-  buf[received] = 0;
+  cJSON *page = cJSON_CreateObject();
+  cJSON_AddStringToObject(page, "label", "Page");
+  cJSON_AddStringToObject(page, "name", "expand_page");
+  cJSON_AddNumberToObject(page, "value", 1);
 
-  if (strcmp(buf, "{}") != 0)
-  {
-    cJSON *doc = cJSON_Parse(buf);
-    if (doc)
-    {
+  cJSON *page_elements = cJSON_CreateArray();
+  cJSON_AddItemToObject(page, "elements", page_elements);
 
-      json_copy_str(doc, "ap_ssid", devcfg.ap_ssid, sizeof(devcfg.ap_ssid));
-      json_copy_str(doc, "ap_key", devcfg.ap_key, sizeof(devcfg.ap_key));
-
-      cJSON *v;
-      if ((v = cJSON_GetObjectItem(doc, "sta_enable")))
-        // devcfg.sta_enable = v->valueint;
-        devcfg.sta_enable = (strcmp(v->valuestring, "1") == 0) ? 1 : 0;
-      json_copy_str(doc, "sta_ssid", devcfg.sta_ssid, sizeof(devcfg.sta_ssid));
-      json_copy_str(doc, "sta_key", devcfg.sta_key, sizeof(devcfg.sta_key));
-
-      if ((v = cJSON_GetObjectItem(doc, "beep_enable")))
-        devcfg.beep_enable = (strcmp(v->valuestring, "1") == 0) ? 1 : 0;
-      if ((v = cJSON_GetObjectItem(doc, "analog_enable")))
-        devcfg.analog_enable = (strcmp(v->valuestring, "1") == 0) ? 1 : 0;
-      if ((v = cJSON_GetObjectItem(doc, "display_enable")))
-        devcfg.display_enable = (strcmp(v->valuestring, "1") == 0) ? 1 : 0;
-      if ((v = cJSON_GetObjectItem(doc, "ads1115_enable")))
-        devcfg.ads1115_enable = (strcmp(v->valuestring, "1") == 0) ? 1 : 0;
-
-      if ((v = cJSON_GetObjectItem(doc, "post_enable")))
-        devcfg.post_enable = (strcmp(v->valuestring, "1") == 0) ? 1 : 0;
-      json_copy_str(doc, "api_url", devcfg.api_url, sizeof(devcfg.api_url));
-      json_copy_str(doc, "api_key", devcfg.api_key, sizeof(devcfg.api_key));
-
-      // if ((v = cJSON_GetObjectItem(doc, "alarm_duration_limit")))
-      //   alarm_duration_limit = v->valueint;
+  cJSON *refresh = cJSON_CreateObject();
+  cJSON_AddStringToObject(refresh, "type", "refresh");
+  cJSON_AddStringToObject(refresh, "label", "Refresh");
+  cJSON_AddStringToObject(refresh, "name", "refresh");
+  cJSON_AddNumberToObject(refresh, "value", 2);
+  cJSON_AddItemToArray(page_elements, refresh);
 
-      config_save(&devcfg);
-      cJSON_Delete(doc);
-    }
-  }
-  free(buf);
+  cJSON_AddItemToArray(root, page);
 
-  cJSON *root = cJSON_CreateArray();
+  send_cjson(req, root);
 
-  cJSON *ap = cJSON_CreateObject();
-  cJSON_AddStringToObject(ap, "label", "Wifi AP");
-  cJSON_AddStringToObject(ap, "name", "expand_wifiap");
-  cJSON_AddNumberToObject(ap, "value", 1);
-  cJSON *ap_elements = cJSON_CreateArray();
-  cJSON_AddItemToObject(ap, "elements", ap_elements);
+  return ESP_OK;
+}
 
+static void config_add_text(cJSON *elements, const config_field_t *f, const char *value)
+{
   cJSON *txt = cJSON_CreateObject();
   cJSON_AddStringToObject(txt, "type", "text");
-  cJSON_AddStringToObject(txt, "label", "AP SSID");
-  cJSON_AddStringToObject(txt, "name", "ap_ssid");
-  cJSON_AddStringToObject(txt, "value", devcfg.ap_ssid);
-  cJSON_AddItemToArray(ap_elements, txt);
-
-  txt = cJSON_CreateObject();
-  cJSON_AddStringToObject(txt, "type", "text");
-  cJSON_AddStringToObject(txt, "label", "AP Key");
-  cJSON_AddStringToObject(txt, "name", "ap_key");
-  cJSON_AddStringToObject(txt, "value", devcfg.ap_key);
-  cJSON_AddItemToArray(ap_elements, txt);
-
-  cJSON_AddItemToArray(root, ap);
-
-  cJSON *sta = cJSON_CreateObject();
-  cJSON_AddStringToObject(sta, "label", "Wifi Sta");
-  cJSON_AddStringToObject(sta, "name", "expand_wifista");
-  cJSON_AddNumberToObject(sta, "value", 1);
-
-  cJSON *sta_elements = cJSON_CreateArray();
-  cJSON_AddItemToObject(sta, "elements", sta_elements);
+  cJSON_AddStringToObject(txt, "label", f->label);
+  cJSON_AddStringToObject(txt, "name", f->name);
+  cJSON_AddStringToObject(txt, "value", value);
+  cJSON_AddItemToArray(elements, txt);
+}
 
-  /*
+static void config_add_ssid(cJSON *elements, const config_field_t *f, const char *value)
+{
+  /* options come from /scan on the page */
   cJSON *sel = cJSON_CreateObject();
   cJSON_AddStringToObject(sel, "type", "select");
-  cJSON_AddStringToObject(sel, "label", "Wifi Sta");
-  cJSON_AddStringToObject(sel, "name", "sta_enable");
-  cJSON_AddNumberToObject(sel, "value", devcfg.sta_enable);
-
-  cJSON *options = cJSON_CreateArray();
-  cJSON *opt = cJSON_CreateArray();
-  cJSON_AddItemToArray(opt, cJSON_CreateString("0"));
-  cJSON_AddItemToArray(opt, cJSON_CreateString("Disabled"));
-  cJSON_AddItemToArray(options, opt);
-
-  opt = cJSON_CreateArray();
-  cJSON_AddItemToArray(opt, cJSON_CreateString("1"));
-  cJSON_AddItemToArray(opt, cJSON_CreateString("Enabled"));
-  cJSON_AddItemToArray(options, opt);
-
-  cJSON_AddItemToObject(sel, "options", options);
-  cJSON_AddItemToArray(sta_elements, sel);
-  */
-  json_add_select(sta_elements, "sta_enable", "Wifi Sta", devcfg.sta_enable);
-
-  /*
-  uint16_t ap_count = 0;
-  wifi_scan_config_t scan_config = {
-      .ssid = 0,
-      .bssid = 0,
-      .channel = 0,
-      .show_hidden = true};
-
-  esp_wifi_scan_start(&scan_config, true);
-  esp_wifi_scan_get_ap_num(&ap_count);
-  wifi_ap_record_t *ap_records = malloc(sizeof(wifi_ap_record_t) * ap_count);
-  esp_wifi_scan_get_ap_records(&ap_count, ap_records);
-  */
-
-  cJSON *sel_ssid = cJSON_CreateObject();
-  cJSON_AddStringToObject(sel_ssid, "type", "select");
-  cJSON_AddStringToObject(sel_ssid, "label", "Sta SSID");
-  cJSON_AddStringToObject(sel_ssid, "name", "sta_ssid");
-  cJSON_AddStringToObject(sel_ssid, "value", devcfg.sta_ssid);
-
-  cJSON *options = cJSON_CreateArray();
-  /*
-   for (int i = 0; i < ap_count; i++)
-   {
-     int rssi = ap_records[i].rssi;
-
-     int quality;
-     if (rssi <= -100)
-       quality = 0;
-     else if (rssi >= -50)
-       quality = 100;
-     else
-       quality = 2 * (rssi + 100);
-
-     char label[96];
-
-     if (ap_records[i].authmode != WIFI_AUTH_OPEN)
-       snprintf(label, sizeof(label), "%s %d%% 🔒", ap_records[i].ssid, quality);
-     else
-       snprintf(label, sizeof(label), "%s %d%%", ap_records[i].ssid, quality);
-
-     cJSON *opt = cJSON_CreateArray();
-     cJSON_AddItemToArray(opt, cJSON_CreateString((char *)ap_records[i].ssid));
-     cJSON_AddItemToArray(opt, cJSON_CreateString(label));
-     cJSON_AddItemToArray(options, opt);
-   }
-  if (ap_count == 0)
-  {
-    cJSON *opt = cJSON_CreateArray();
-    cJSON_AddItemToArray(opt, cJSON_CreateString(""));
-    cJSON_AddItemToArray(opt, cJSON_CreateString(""));
-    cJSON_AddItemToArray(options, opt);
-  }
-
-  cJSON_AddItemToObject(sel_ssid, "options", options);
-   */
-  cJSON *opt = cJSON_CreateArray();
-  cJSON_AddItemToArray(opt, cJSON_CreateString(""));
-  cJSON_AddItemToArray(opt, cJSON_CreateString(""));
-  cJSON_AddItemToArray(options, opt);
-  cJSON_AddItemToArray(sta_elements, sel_ssid);
-
-  // txt = cJSON_CreateObject();
-  // cJSON_AddStringToObject(txt, "type", "text");
-  // cJSON_AddStringToObject(txt, "label", "Sta SSID");
-  // cJSON_AddStringToObject(txt, "name", "sta_ssid");
-  // cJSON_AddStringToObject(txt, "value", devcfg.sta_ssid);
-  // cJSON_AddItemToArray(sta_elements, txt);
+  cJSON_AddStringToObject(sel, "label", f->label);
+  cJSON_AddStringToObject(sel, "name", f->name);
+  cJSON_AddStringToObject(sel, "value", value);
+  cJSON_AddItemToArray(elements, sel);
+}
 
-  txt = cJSON_CreateObject();
-  cJSON_AddStringToObject(txt, "type", "text");
-  cJSON_AddStringToObject(txt, "label", "Sta Key");
-  cJSON_AddStringToObject(txt, "name", "sta_key");
-  cJSON_AddStringToObject(txt, "value", devcfg.sta_key);
-  cJSON_AddItemToArray(sta_elements, txt);
+static void config_add_bool(cJSON *elements, const config_field_t *f, const char *value)
+{
+  json_add_select(elements, f->name, f->label, value[0] == '1');
+}
 
-  cJSON_AddItemToArray(root, sta);
+/* form element per config_type_t */
+static void (*const config_add[CONFIG_TYPES])(cJSON *, const config_field_t *, const char *) = {
+    [CONFIG_STR] = config_add_text,
+    [CONFIG_SSID] = config_add_ssid,
+    [CONFIG_BOOL] = config_add_bool,
+    [CONFIG_U16] = config_add_text,
+};
 
-  cJSON *comp = cJSON_CreateObject();
-  cJSON_AddStringToObject(comp, "label", "Components");
-  cJSON_AddStringToObject(comp, "name", "expand_component");
-  cJSON_AddNumberToObject(comp, "value", 1);
+static void config_parse(cJSON *doc)
+{
+  for (cJSON *v = doc->child; v; v = v->next)
+  {
+    const config_field_t *f = config_field_find(v->string);
+    if (!f)
+      continue;
 
-  cJSON *comp_elements = cJSON_CreateArray();
-  cJSON_AddItemToObject(comp, "elements", comp_elements);
+    char num[12];
+    const char *value;
 
-  json_add_select(comp_elements, "beep_enable", "Beep", devcfg.beep_enable);
-  json_add_select(comp_elements, "analog_enable", "Analog", devcfg.analog_enable);
-  json_add_select(comp_elements, "display_enable", "Display", devcfg.display_enable);
-  json_add_select(comp_elements, "ads1115_enable", "ADS1115", devcfg.ads1115_enable);
+    if (cJSON_IsString(v))
+      value = v->valuestring;
+    else if (cJSON_IsNumber(v))
+    {
+      snprintf(num, sizeof(num), "%d", v->valueint);
+      value = num;
+    }
+    else if (cJSON_IsBool(v))
+      value = cJSON_IsTrue(v) ? "1" : "0";
+    else
+      continue;
 
-  cJSON_AddItemToArray(root, comp);
+    if (!config_field_set(&devcfg, f, value))
+      ESP_LOGW(TAG, "config: %s rejected", f->name);
+  }
+}
 
-  cJSON *api = cJSON_CreateObject();
-  cJSON_AddStringToObject(api, "label", "API Post");
-  cJSON_AddStringToObject(api, "name", "expand_post");
-  cJSON_AddNumberToObject(api, "value", 1);
+static cJSON *config_form(void)
+{
+  cJSON *root = cJSON_CreateArray();
+  cJSON *elements[CONFIG_GROUP_COUNT];
 
-  cJSON *api_elements = cJSON_CreateArray();
-  cJSON_AddItemToObject(api, "elements", api_elements);
+  for (int g = 0; g < CONFIG_GROUP_COUNT; g++)
+  {
+    cJSON *group = cJSON_CreateObject();
+    cJSON_AddStringToObject(group, "label", config_groups[g].label);
+    cJSON_AddStringToObject(group, "name", config_groups[g].name);
+    cJSON_AddNumberToObject(group, "value", 1);
+    elements[g] = cJSON_CreateArray();
+    cJSON_AddItemToObject(group, "elements", elements[g]);
+    cJSON_AddItemToArray(root, group);
+  }
 
-  json_add_select(api_elements, "post_enable", "API Post", devcfg.post_enable);
+  char value[CONFIG_VALUE_MAX];
 
-  txt = cJSON_CreateObject();
-  cJSON_AddStringToObject(txt, "type", "text");
-  cJSON_AddStringToObject(txt, "label", "API url");
-  cJSON_AddStringToObject(txt, "name", "api_url");
-  cJSON_AddStringToObject(txt, "value", devcfg.api_url);
-  cJSON_AddItemToArray(api_elements, txt);
+  for (int i = 0; i < config_field_count; i++)
+  {
+    const config_field_t *f = &config_fields[i];
+    if (f->group == CONFIG_GROUP_NONE)
+      continue;
 
-  txt = cJSON_CreateObject();
-  cJSON_AddStringToObject(txt, "type", "text");
-  cJSON_AddStringToObject(txt, "label", "API key");
-  cJSON_AddStringToObject(txt, "name", "api_key");
-  cJSON_AddStringToObject(txt, "value", devcfg.api_key);
-  cJSON_AddItemToArray(api_elements, txt);
+    config_field_get(&devcfg, f, value, sizeof(value));
+    config_add[f->type](elements[f->group], f, value);
+  }
 
-  cJSON_AddItemToArray(root, api);
+  return root;
+}
 
-  // cJSON *alarm = cJSON_CreateObject();
-  // cJSON_AddStringToObject(alarm, "label", "Alarm");
-  // cJSON_AddStringToObject(alarm, "name", "expand_alarm");
-  // cJSON_AddNumberToObject(alarm, "value", 1);
+esp_err_t config_handler(httpd_req_t *req)
+{
+  char *buf = recv_body(req);
+  if (!buf)
+    return ESP_FAIL;
 
-  // cJSON *alarm_elements = cJSON_CreateArray();
-  // cJSON_AddItemToObject(alarm, "elements", alarm_elements);
+  if (strcmp(buf, "{}") != 0)
+  {
+    cJSON *doc = cJSON_Parse(buf);
+    if (doc)
+    {
+      int64_t t0 = esp_timer_get_time();
+      config_parse(doc);
+      config_form_stats.parse_us += esp_timer_get_time() - t0;
+      config_form_stats.parses++;
 
-  // txt = cJSON_CreateObject();
-  // cJSON_AddStringToObject(txt, "type", "text");
-  // cJSON_AddStringToObject(txt, "label", "Alarm Duration");
-  // cJSON_AddStringToObject(txt, "name", "alarm_duration_limit");
-  // cJSON_AddNumberToObject(txt, "value", alarm_duration_limit);
-  // cJSON_AddItemToArray(alarm_elements, txt);
+      config_save(&devcfg);
+      cJSON_Delete(doc);
+    }
+  }
+  arena_free(buf);
 
-  // cJSON_AddItemToArray(root, alarm);
+  int64_t t0 = esp_timer_get_time();
+  cJSON *root = config_form();
+  config_form_stats.form_us += esp_timer_get_time() - t0;
+  config_form_stats.forms++;
 
   cJSON *page = cJSON_CreateObject();
   cJSON_AddStringToObject(page, "label", "Page");
@@ -549,7 +913,7 @@ esp_err_t config_handler(httpd_req_t *req)
   cJSON *page_elements = cJSON_CreateArray();
   cJSON_AddItemToObject(page, "elements", page_elements);
 
-  txt = cJSON_CreateObject();
+  cJSON *txt = cJSON_CreateObject();
   cJSON_AddStringToObject(txt, "type", "button");
   cJSON_AddStringToObject(txt, "label", "UPDATE");
   cJSON_AddStringToObject(txt, "name", "update");
@@ -558,13 +922,7 @@ esp_err_t config_handler(httpd_req_t *req)
 
   cJSON_AddItemToArray(root, page);
 
-  char *json_out = cJSON_PrintUnformatted(root);
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json_out, HTTPD_RESP_USE_STRLEN);
-
-  free(json_out);
-  cJSON_Delete(root);
+  send_cjson(req, root);
 
   return ESP_OK;
 }
@@ -572,18 +930,9 @@ esp_err_t config_handler(httpd_req_t *req)
 esp_err_t app_handler(httpd_req_t *req)
 {
   uint8_t refresh = 2;
-  int total = req->content_len;
-  char *buf = malloc(total + 1);
+  char *buf = recv_body(req);
   if (!buf)
-    return ESP_ERR_NO_MEM;
-
-  int received = httpd_req_recv(req, buf, total);
-  if (received <= 0)
-  {
-    free(buf);
     return ESP_FAIL;
-  }
-  buf[received] = 0;
 
   if (strcmp(buf, "{}") != 0)
   {
@@ -593,16 +942,38 @@ esp_err_t app_handler(httpd_req_t *req)
       cJSON *item;
 
       item = cJSON_GetObjectItem(doc, "refresh");
-      if (item)
+      if (cJSON_IsString(item))
+        refresh = atoi(item->valuestring);
+      else if (item)
         refresh = item->valueint;
 
       cJSON_Delete(doc);
     }
   }
-  free(buf);
+  arena_free(buf);
 
   cJSON *root = cJSON_CreateArray();
 
+  ws_push_vals_t vals;
+  ws_push_snapshot(vals);
+
+  cJSON *gps = cJSON_CreateObject();
+  cJSON_AddStringToObject(gps, "label", "GPS");
+  cJSON_AddStringToObject(gps, "name", "expand_gps");
+  cJSON_AddNumberToObject(gps, "value", 1);
+  cJSON *gps_elements = cJSON_CreateArray();
+  cJSON_AddItemToObject(gps, "elements", gps_elements);
+
+  add_text_element(gps_elements, "UTC Time", "utc_time", vals[0]);
+  add_text_element(gps_elements, "Fix", "fix", vals[1]);
+  add_text_element(gps_elements, "Latitude", "latitude", vals[2]);
+  add_text_element(gps_elements, "Longitude", "longitude", vals[3]);
+  add_text_element(gps_elements, "Altitude", "altitude", vals[4]);
+  add_text_element(gps_elements, "Speed (kn)", "speed", vals[5]);
+  add_text_element(gps_elements, "Satellites", "satellites", vals[6]);
+
+  cJSON_AddItemToArray(root, gps);
+
   cJSON *ws = cJSON_CreateObject();
   cJSON_AddStringToObject(ws, "label", "WS");
   cJSON_AddStringToObject(ws, "name", "expand_ws");
@@ -636,40 +1007,276 @@ esp_err_t app_handler(httpd_req_t *req)
 
   cJSON_AddItemToArray(root, page);
 
-  char *json_out = cJSON_PrintUnformatted(root);
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json_out, HTTPD_RESP_USE_STRLEN);
-
-  free(json_out);
-  cJSON_Delete(root);
+  send_cjson(req, root);
 
   return ESP_OK;
 }
 
+static bool sha256_from_hex(const char *hex, uint8_t out[32])
+{
+  for (int i = 0; i < 32; i++)
+  {
+    unsigned int b;
+    if (sscanf(hex + 2 * i, "%2x", &b) != 1)
+      return false;
+    out[i] = b;
+  }
+  return true;
+}
+
+/* patch_size is 0 for a full image */
+static void ota_respond(httpd_req_t *req, esp_err_t err, const ota_result_t *res,
+                        uint32_t patch_size)
+{
+  char msg[64], sha[65], stats[48], patch[48];
+
+  if (err == ESP_OK)
+    snprintf(msg, sizeof(msg), "Update complete. Rebooting...");
+  else
+    snprintf(msg, sizeof(msg), "Update failed: %s", esp_err_to_name(err));
+
+  for (int i = 0; i < 32; i++)
+    sprintf(sha + 2 * i, "%02x", res->sha256[i]);
+
+  snprintf(stats, sizeof(stats), "%lu B in %lld ms, %lu KB/s",
+           (unsigned long)res->size, (long long)(res->elapsed_us / 1000),
+           (unsigned long)res->kbps);
+
+  cJSON *root = cJSON_CreateArray();
+
+  cJSON *section = cJSON_CreateObject();
+  cJSON_AddStringToObject(section, "label", "Firmware Upgrade");
+  cJSON_AddStringToObject(section, "name", "firmware_upgrade");
+  cJSON_AddNumberToObject(section, "value", 1);
+
+  cJSON *elements = cJSON_CreateArray();
+  cJSON_AddItemToObject(section, "elements", elements);
+
+  cJSON *alert = cJSON_CreateObject();
+  cJSON_AddStringToObject(alert, "type", "alert");
+  cJSON_AddStringToObject(alert, "value", msg);
+  cJSON_AddItemToArray(elements, alert);
+
+  add_text_element(elements, "Received", "ota_stats", stats);
+  add_text_element(elements, "SHA-256", "ota_sha256", res->size ? sha : "");
+
+  if (patch_size)
+  {
+    snprintf(patch, sizeof(patch), "%lu B, %lu%% of the image",
+             (unsigned long)patch_size,
+             res->size ? (unsigned long)((uint64_t)patch_size * 100 / res->size) : 0);
+    add_text_element(elements, "Patch", "ota_patch", patch);
+  }
+
+  cJSON_AddItemToArray(root, section);
+
+  if (err == ESP_ERR_INVALID_CRC || err == ESP_ERR_INVALID_SIZE ||
+      err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_VERSION ||
+      err == ESP_ERR_OTA_VALIDATE_FAILED)
+    httpd_resp_set_status(req, "400 Bad Request");
+  else if (err != ESP_OK)
+    httpd_resp_set_status(req, "500 Internal Server Error");
+
+  send_cjson(req, root);
+}
+
+/*
+ * POST /upload, raw image as the body. An optional X-Image-SHA256 header
+ * (hex) must match the received image or it is not made bootable.
+ */
 static esp_err_t ota_update_handler(httpd_req_t *req)
 {
-  esp_ota_handle_t ota_handle;
-  const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
-  ESP_ERROR_CHECK(esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &ota_handle));
+  ota_result_t res = {0};
+  uint8_t expect[32];
+  char hex[72];
+
+  bool check = httpd_req_get_hdr_value_str(req, "X-Image-SHA256", hex, sizeof(hex)) == ESP_OK &&
+               sha256_from_hex(hex, expect);
+
+  esp_err_t err = ota_begin(req->content_len);
+  if (err != ESP_OK)
+  {
+    ota_respond(req, err, &res, 0);
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_FAIL;
+  }
+
+  int remaining = req->content_len;
+  int timeouts = 0;
+
+  while (err == ESP_OK && remaining > 0)
+  {
+    size_t cap;
+    uint8_t *p = ota_buf(&cap);
+
+    int n = httpd_req_recv(req, (char *)p, remaining < cap ? remaining : cap);
+    if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_RECV_RETRIES)
+      continue;
+    if (n <= 0)
+    {
+      err = ESP_ERR_TIMEOUT;
+      break;
+    }
+
+    timeouts = 0;
+    remaining -= n;
+    err = ota_submit(n);
+  }
+
+  if (err == ESP_OK)
+  {
+    err = ota_finish(check ? expect : NULL, &res);
+  }
+  else
+  {
+    ota_abort();
+    res.size = req->content_len - remaining;
+  }
+
+  ota_respond(req, err, &res, 0);
+
+  if (err != ESP_OK)
+  {
+    /* don't let httpd drain the rest of a megabyte we no longer want */
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_FAIL;
+  }
+
+  vTaskDelay(pdMS_TO_TICKS(1000));
+  esp_restart();
+  return ESP_OK;
+}
+
+/*
+ * POST /upload/delta, body is a patch from tools/delta_ota.py made against
+ * the image this device is running.
+ */
+static esp_err_t ota_delta_handler(httpd_req_t *req)
+{
+  ota_result_t res = {0};
   char buf[1024];
+
+  esp_err_t err = delta_begin();
+  if (err != ESP_OK)
+  {
+    ota_respond(req, err, &res, 0);
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_FAIL;
+  }
+
   int remaining = req->content_len;
-  while (remaining > 0)
+  int timeouts = 0;
+
+  while (err == ESP_OK && remaining > 0)
   {
-    int recv_len = httpd_req_recv(req, buf, remaining > sizeof(buf) ? sizeof(buf) : remaining);
-    if (recv_len <= 0)
-      return ESP_FAIL;
-    esp_ota_write(ota_handle, buf, recv_len);
-    remaining -= recv_len;
+    int n = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+    if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_RECV_RETRIES)
+      continue;
+    if (n <= 0)
+    {
+      err = ESP_ERR_TIMEOUT;
+      break;
+    }
+
+    timeouts = 0;
+    remaining -= n;
+    err = delta_write(buf, n);
   }
-  ESP_ERROR_CHECK(esp_ota_end(ota_handle));
-  ESP_ERROR_CHECK(esp_ota_set_boot_partition(update_partition));
-  httpd_resp_sendstr(req, "Update complete. Rebooting...");
+
+  if (err == ESP_OK)
+    err = delta_finish(&res);
+  else
+    delta_abort();
+
+  ota_respond(req, err, &res, req->content_len);
+
+  if (err != ESP_OK)
+  {
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_FAIL;
+  }
+
   vTaskDelay(pdMS_TO_TICKS(1000));
   esp_restart();
   return ESP_OK;
 }
 
+/* POST /assets: a bundle from tools/www_bundle.py, live without a reboot */
+static esp_err_t assets_upload_handler(httpd_req_t *req)
+{
+  char buf[1024], msg[64], stats[48];
+  int64_t t0 = esp_timer_get_time();
+
+  esp_err_t err = assets_begin(req->content_len);
+
+  int remaining = req->content_len;
+  int timeouts = 0;
+
+  while (err == ESP_OK && remaining > 0)
+  {
+    int n = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+    if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < OTA_RECV_RETRIES)
+      continue;
+    if (n <= 0)
+    {
+      err = ESP_ERR_TIMEOUT;
+      break;
+    }
+
+    timeouts = 0;
+    remaining -= n;
+    err = assets_write(buf, n);
+  }
+
+  if (err == ESP_OK)
+    err = assets_finish();
+  else
+    assets_abort();
+
+  if (err == ESP_OK)
+    snprintf(msg, sizeof(msg), "UI updated, reload the page");
+  else
+    snprintf(msg, sizeof(msg), "UI update failed: %s", esp_err_to_name(err));
+
+  snprintf(stats, sizeof(stats), "%lu B in %lld ms",
+           (unsigned long)(req->content_len - remaining),
+           (long long)((esp_timer_get_time() - t0) / 1000));
+
+  cJSON *root = cJSON_CreateArray();
+
+  cJSON *section = cJSON_CreateObject();
+  cJSON_AddStringToObject(section, "label", "Firmware Upgrade");
+  cJSON_AddStringToObject(section, "name", "firmware_upgrade");
+  cJSON_AddNumberToObject(section, "value", 1);
+
+  cJSON *elements = cJSON_CreateArray();
+  cJSON_AddItemToObject(section, "elements", elements);
+
+  cJSON *alert = cJSON_CreateObject();
+  cJSON_AddStringToObject(alert, "type", "alert");
+  cJSON_AddStringToObject(alert, "value", msg);
+  cJSON_AddItemToArray(elements, alert);
+
+  add_text_element(elements, "Received", "assets_stats", stats);
+
+  cJSON_AddItemToArray(root, section);
+
+  if (err == ESP_ERR_INVALID_CRC || err == ESP_ERR_INVALID_SIZE)
+    httpd_resp_set_status(req, "400 Bad Request");
+  else if (err != ESP_OK)
+    httpd_resp_set_status(req, "500 Internal Server Error");
+
+  send_cjson(req, root);
+
+  if (err != ESP_OK)
+  {
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
 static esp_err_t firmware_handler(httpd_req_t *req)
 {
   /*
@@ -696,9 +1303,13 @@ static esp_err_t firmware_handler(httpd_req_t *req)
   cJSON_AddStringToObject(file, "label", "File");
   cJSON_AddStringToObject(file, "name", "file");
   cJSON_AddStringToObject(file, "value", "");
-  cJSON_AddStringToObject(file, "accept", ".bin");
+  cJSON_AddStringToObject(file, "accept", ".bin,.www");
   cJSON_AddItemToArray(elements, file);
 
+  char ota_str[64];
+  ota_status_str(ota_str, sizeof(ota_str));
+  add_text_element(elements, "Progress", "ota_progress", ota_str);
+
   cJSON *btn = cJSON_CreateObject();
   cJSON_AddStringToObject(btn, "type", "button");
   cJSON_AddStringToObject(btn, "label", "UPLOAD");
@@ -708,39 +1319,45 @@ static esp_err_t firmware_handler(httpd_req_t *req)
 
   cJSON_AddItemToArray(root, section);
 
-  char *json_out = cJSON_PrintUnformatted(root);
-
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json_out, HTTPD_RESP_USE_STRLEN);
-
-  free(json_out);
-  cJSON_Delete(root);
+  send_cjson(req, root);
 
   return ESP_OK;
 }
 
+/*
+ * GET /scan returns the cached background scan at once.
+ * GET /scan?fresh=1 asks for a new scan and waits (up to SCAN_WAIT_MS)
+ * for it, falling back to the cache if the radio is busy.
+ */
 static esp_err_t wifi_scan_handler(httpd_req_t *req)
 {
-  wifi_scan_config_t scan_config = {
-      .ssid = 0,
-      .bssid = 0,
-      .channel = 0,
-      .show_hidden = true};
+  static wifi_ap_record_t ap_records[SCAN_MAX_AP];
 
-  ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, true));
+  char query[32];
+  char fresh[4] = "0";
 
-  uint16_t ap_count = 0;
-  esp_wifi_scan_get_ap_num(&ap_count);
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    httpd_query_key_value(query, "fresh", fresh, sizeof(fresh));
 
-  wifi_ap_record_t *ap_records = malloc(sizeof(wifi_ap_record_t) * ap_count);
+  uint32_t seq;
+  int64_t age_ms;
+  network_scan_get(ap_records, 0, &age_ms, &seq);
 
-  if (!ap_records)
-    return ESP_ERR_NO_MEM;
+  if (fresh[0] == '1' || age_ms < 0)
+  {
+    network_scan_request();
+    if (fresh[0] == '1')
+      network_scan_wait(seq, SCAN_WAIT_MS);
+  }
 
-  ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_records));
+  int ap_count = network_scan_get(ap_records, SCAN_MAX_AP, &age_ms, &seq);
 
-  cJSON *root = cJSON_CreateArray();
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddNumberToObject(root, "age_ms", age_ms);
+  cJSON_AddNumberToObject(root, "seq", seq);
+
+  cJSON *aps = cJSON_CreateArray();
+  cJSON_AddItemToObject(root, "aps", aps);
 
   for (int i = 0; i < ap_count; i++)
   {
@@ -774,20 +1391,240 @@ static esp_err_t wifi_scan_handler(httpd_req_t *req)
     cJSON_AddNumberToObject(obj, "secure", ap_records[i].authmode);
     cJSON_AddBoolToObject(obj, "hidden", strlen((char *)ap_records[i].ssid) == 0);
 
-    cJSON_AddItemToArray(root, obj);
+    cJSON_AddItemToArray(aps, obj);
+  }
+
+  send_cjson(req, root);
+
+  return ESP_OK;
+}
+
+enum
+{
+  TRACK_GPX,
+  TRACK_GEOJSON,
+  TRACK_CSV,
+};
+
+typedef struct
+{
+  resp_stream_t rs;
+  esp_err_t err;
+  char *buf; // TRACK_CHUNK
+  size_t len;
+
+  int format;
+  uint32_t step;
+  uint32_t next_ts;
+  uint32_t points;
+  uint32_t first_ts;
+  uint32_t last_ts;
+  char first_pos[48]; // GeoJSON: held back until there is a line
+} track_out_t;
+
+#define TRACK_GEOJSON_LINE "{\"type\":\"Feature\",\"geometry\":{\"type\":\"LineString\",\"coordinates\":["
+
+static void track_out(track_out_t *o, const char *data, size_t len)
+{
+  if (o->len + len > TRACK_CHUNK)
+  {
+    if (o->err == ESP_OK)
+      o->err = resp_stream_write(&o->rs, o->buf, o->len);
+    o->len = 0;
+  }
+
+  memcpy(o->buf + o->len, data, len);
+  o->len += len;
+}
+
+static void track_time_str(uint32_t ts, char *out, size_t len)
+{
+  time_t t = ts;
+  struct tm tm;
+
+  gmtime_r(&t, &tm);
+  strftime(out, len, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+static bool track_visit(void *ctx, const track_rec_t *r)
+{
+  track_out_t *o = ctx;
+
+  if (r->ts < o->next_ts)
+    return true;
+  o->next_ts = r->ts + o->step;
+
+  char t[24], line[160];
+  int n;
+
+  double lat = r->lat / 1e7;
+  double lon = r->lon / 1e7;
+  double alt = r->alt / 10.0;
+
+  track_time_str(r->ts, t, sizeof(t));
+
+  switch (o->format)
+  {
+  case TRACK_GEOJSON:
+    n = snprintf(line, sizeof(line), "[%.7f,%.7f,%.1f]", lon, lat, alt);
+
+    /* a LineString needs two positions; one alone ends up a Point */
+    if (!o->points)
+    {
+      strlcpy(o->first_pos, line, sizeof(o->first_pos));
+      n = 0;
+    }
+    else
+    {
+      if (o->points == 1)
+      {
+        track_out(o, TRACK_GEOJSON_LINE, strlen(TRACK_GEOJSON_LINE));
+        track_out(o, o->first_pos, strlen(o->first_pos));
+      }
+      track_out(o, ",", 1);
+    }
+    break;
+
+  case TRACK_CSV:
+    n = snprintf(line, sizeof(line), "%s,%.7f,%.7f,%.1f,%.2f,%u\n",
+                 t, lat, lon, alt, r->speed / 100.0, r->sats);
+    break;
+
+  default:
+    n = snprintf(line, sizeof(line),
+                 "<trkpt lat=\"%.7f\" lon=\"%.7f\"><ele>%.1f</ele><time>%s</time><sat>%u</sat></trkpt>\n",
+                 lat, lon, alt, t, r->sats);
+    break;
+  }
+
+  track_out(o, line, n);
+
+  if (!o->points++)
+    o->first_ts = r->ts;
+  o->last_ts = r->ts;
+
+  return o->err == ESP_OK;
+}
+
+/* "-3600" (before now), "2026-10-19T10:00:00" (UTC) or epoch seconds */
+static uint32_t track_parse_time(const char *s, time_t now)
+{
+  int y, mo, d, h = 0, mi = 0, sec = 0;
+
+  /* before the clock is set now is near 0; don't wrap round */
+  if (s[0] == '-')
+  {
+    int64_t t = now + atol(s);
+    return t > 0 ? t : 0;
   }
 
-  char *json = cJSON_PrintUnformatted(root);
+  if (sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d", &y, &mo, &d, &h, &mi, &sec) >= 3)
+    return utc_epoch(y, mo, d, h, mi, sec);
+
+  return strtoul(s, NULL, 10);
+}
 
+/* GET /track?from=&to=&format=gpx|geojson|csv&step= */
+static esp_err_t track_handler(httpd_req_t *req)
+{
+  static const char *types[] = {"application/gpx+xml", "application/geo+json", "text/csv"};
+  static const char *heads[] = {
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<gpx version=\"1.1\" creator=\"" APPCODE "\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+      "<trk><trkseg>\n",
+      "", // GeoJSON: known once there are two points
+      "time,lat,lon,alt,speed,sats\n"};
+
+  char query[128];
+  char from_s[24] = "-3600";
+  char to_s[24] = "";
+  char format[8] = "gpx";
+  char step_s[8] = "0";
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+  {
+    httpd_query_key_value(query, "from", from_s, sizeof(from_s));
+    httpd_query_key_value(query, "to", to_s, sizeof(to_s));
+    httpd_query_key_value(query, "format", format, sizeof(format));
+    httpd_query_key_value(query, "step", step_s, sizeof(step_s));
+  }
+
+  if (!track_available())
+  {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no track partition");
+    return ESP_OK;
+  }
+
+  time_t now = time(NULL);
+
+  track_out_t o = {0};
+  o.format = strcmp(format, "geojson") == 0 ? TRACK_GEOJSON : strcmp(format, "csv") == 0 ? TRACK_CSV
+                                                                                         : TRACK_GPX;
+  o.step = atoi(step_s);
+  o.buf = arena_alloc(TRACK_CHUNK);
+
+  if (!o.buf)
+    return httpd_resp_send_500(req);
+
+  uint32_t from = track_parse_time(from_s, now);
+  uint32_t to = to_s[0] ? track_parse_time(to_s, now) : UINT32_MAX;
+
+  httpd_resp_set_type(req, types[o.format]);
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+  resp_stream_begin(&o.rs, req, resp_pick_encoding(req));
 
-  free(json);
-  cJSON_Delete(root);
-  free(ap_records);
+  track_out(&o, heads[o.format], strlen(heads[o.format]));
+  track_query(from, to, track_visit, &o);
 
-  return ESP_OK;
+  if (o.format == TRACK_GPX)
+  {
+    track_out(&o, "</trkseg></trk>\n</gpx>\n", 23);
+  }
+  else if (o.format == TRACK_GEOJSON)
+  {
+    char first[24], last[24], tail[224];
+    int n;
+
+    if (!o.points)
+    {
+      n = snprintf(tail, sizeof(tail), "{\"type\":\"FeatureCollection\",\"features\":[]}\n");
+    }
+    else
+    {
+      track_time_str(o.first_ts, first, sizeof(first));
+      track_time_str(o.last_ts, last, sizeof(last));
+
+      if (o.points == 1)
+        n = snprintf(tail, sizeof(tail), "{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\",\"coordinates\":%s},", o.first_pos);
+      else
+        n = snprintf(tail, sizeof(tail), "]},");
+
+      n += snprintf(tail + n, sizeof(tail) - n,
+                    "\"properties\":{\"start\":\"%s\",\"end\":\"%s\",\"points\":%lu}}\n",
+                    first, last, (unsigned long)o.points);
+    }
+    track_out(&o, tail, n);
+  }
+
+  if (o.err == ESP_OK && o.len)
+    o.err = resp_stream_write(&o.rs, o.buf, o.len);
+  if (o.err == ESP_OK)
+    o.err = resp_stream_end(&o.rs);
+
+  arena_free(o.buf);
+
+  return o.err;
+}
+
+static void ws_notify(void);
+
+static void ws_remove_at(int i)
+{
+  for (int j = i; j < ws_mgr.count - 1; j++)
+    ws_mgr.clients[j] = ws_mgr.clients[j + 1];
+
+  ws_mgr.count--;
+  powersave_release();
 }
 
 static void ws_add_client(httpd_req_t *req)
@@ -799,12 +1636,18 @@ static void ws_add_client(httpd_req_t *req)
 
   if (ws_mgr.count < MAX_WS_CLIENTS)
   {
-    ws_mgr.clients[ws_mgr.count++] = fd;
+    ws_mgr.clients[ws_mgr.count++] = (ws_client_t){
+        .fd = fd,
+        .cursor = stream_replay_cursor(devcfg.replay_sec * 1000,
+                                       devcfg.replay_kb * 1024)};
     ESP_LOGI(TAG, "WS client added fd=%d total=%d",
              fd, ws_mgr.count);
+    powersave_hold();
   }
 
   xSemaphoreGive(ws_mgr.lock);
+
+  ws_notify(); // replay history now, not at the next UART read
 }
 
 static void ws_remove_client(int fd)
@@ -813,12 +1656,9 @@ static void ws_remove_client(int fd)
 
   for (int i = 0; i < ws_mgr.count; i++)
   {
-    if (ws_mgr.clients[i] == fd)
+    if (ws_mgr.clients[i].fd == fd)
     {
-      for (int j = i; j < ws_mgr.count - 1; j++)
-        ws_mgr.clients[j] = ws_mgr.clients[j + 1];
-
-      ws_mgr.count--;
+      ws_remove_at(i);
       break;
     }
   }
@@ -826,36 +1666,83 @@ static void ws_remove_client(int fd)
   xSemaphoreGive(ws_mgr.lock);
 }
 
-void ws_broadcast(const char *data, size_t len)
+static bool ws_writable(int fd)
 {
-  if (!ws_mgr.server)
-    return;
+  fd_set wfds;
+  struct timeval tv = {0};
 
-  httpd_ws_frame_t ws_pkt = {
-      .payload = (uint8_t *)data,
-      .len = len,
-      .type = HTTPD_WS_TYPE_TEXT};
+  FD_ZERO(&wfds);
+  FD_SET(fd, &wfds);
+
+  return select(fd + 1, NULL, &wfds, NULL, &tv) > 0;
+}
+
+/*
+ * Runs on the httpd task. Each client is served from its own cursor, as
+ * far as its socket will take without blocking; backlogged raw records
+ * are coalesced into frames of up to WS_BATCH_MAX bytes.
+ */
+static void ws_drain(void *arg)
+{
+  static uint8_t batch[WS_BATCH_MAX];
+
+  atomic_store(&ws_mgr.drain_queued, false);
+
+  int64_t now = esp_timer_get_time();
+  uint32_t head = stream_head();
 
   xSemaphoreTake(ws_mgr.lock, portMAX_DELAY);
 
   for (int i = 0; i < ws_mgr.count;)
   {
-    int fd = ws_mgr.clients[i];
+    ws_client_t *c = &ws_mgr.clients[i];
+    bool dead = false;
+
+    while (c->cursor != head && ws_writable(c->fd))
+    {
+      uint8_t type;
+      size_t n = stream_read(&c->cursor, STREAM_RAW | STREAM_JSON, &type,
+                             batch, sizeof(batch), &c->dropped);
+      if (n == 0)
+        break;
+
+      httpd_ws_frame_t ws_pkt = {
+          .payload = batch,
+          .len = n,
+          .type = HTTPD_WS_TYPE_TEXT};
+
+      if (httpd_ws_send_frame_async(ws_mgr.server, c->fd, &ws_pkt) != ESP_OK)
+      {
+        dead = true;
+        break;
+      }
+
+      c->sent += n;
+    }
+
+    uint32_t lag = stream_head() - c->cursor;
+    if (lag > c->max_lag)
+      c->max_lag = lag;
+
+    if (lag <= WS_EVICT_LAG)
+      c->behind_since = 0;
+    else if (!c->behind_since)
+      c->behind_since = now;
 
-    esp_err_t err = httpd_ws_send_frame_async(
-        ws_mgr.server,
-        fd,
-        &ws_pkt);
+    bool evict = c->behind_since &&
+                 now - c->behind_since > WS_EVICT_MS * 1000LL;
 
-    if (err != ESP_OK)
+    if (dead || evict)
     {
-      ESP_LOGW(TAG, "Removing dead WS client fd=%d", fd);
+      ESP_LOGW(TAG, "%s WS client fd=%d lag=%lu dropped=%lu",
+               dead ? "Removing dead" : "Evicting slow",
+               c->fd, (unsigned long)lag, (unsigned long)c->dropped);
 
-      /* remove client */
-      for (int j = i; j < ws_mgr.count - 1; j++)
-        ws_mgr.clients[j] = ws_mgr.clients[j + 1];
+      if (evict)
+        ws_mgr.evicted++;
 
-      ws_mgr.count--;
+      httpd_sess_trigger_close(ws_mgr.server, c->fd);
+      ws_remove_at(i);
       continue; // don't increment i
     }
 
@@ -865,6 +1752,112 @@ void ws_broadcast(const char *data, size_t len)
   xSemaphoreGive(ws_mgr.lock);
 }
 
+/* stream subscriber: O(1) for the producer, whatever the client count */
+static void ws_notify(void)
+{
+  if (!ws_mgr.server || ws_mgr.count == 0)
+    return;
+
+  if (atomic_exchange(&ws_mgr.drain_queued, true))
+    return;
+
+  if (httpd_queue_work(ws_mgr.server, ws_drain, NULL) != ESP_OK)
+    atomic_store(&ws_mgr.drain_queued, false);
+}
+
+/* httpd task: send each due subscriber the fields that changed for it */
+static void ws_push(void *arg)
+{
+  static ws_push_vals_t vals;
+  static char msg[WS_PUSH_FIELDS * 48];
+
+  atomic_store(&ws_mgr.push_queued, false);
+
+  int64_t now = esp_timer_get_time();
+  ws_push_snapshot(vals);
+
+  xSemaphoreTake(ws_mgr.lock, portMAX_DELAY);
+
+  for (int i = 0; i < ws_mgr.count; i++)
+  {
+    ws_client_t *c = &ws_mgr.clients[i];
+
+    if (!c->push_ms || now - c->push_last < c->push_ms * 1000LL)
+      continue;
+
+    int n = snprintf(msg, sizeof(msg), "{\"t\":\"status\"");
+    int empty = n;
+
+    for (int k = 0; k < WS_PUSH_FIELDS; k++)
+    {
+      if (strcmp(c->push_vals[k], vals[k]) != 0)
+        n += snprintf(msg + n, sizeof(msg) - n, ",\"%s\":\"%s\"",
+                      ws_push_keys[k], vals[k]);
+    }
+
+    c->push_last = now;
+
+    if (n == empty || !ws_writable(c->fd))
+      continue; // nothing new, or retry the whole diff next period
+
+    n += snprintf(msg + n, sizeof(msg) - n, "}");
+
+    httpd_ws_frame_t ws_pkt = {
+        .payload = (uint8_t *)msg,
+        .len = n,
+        .type = HTTPD_WS_TYPE_TEXT};
+
+    if (httpd_ws_send_frame_async(ws_mgr.server, c->fd, &ws_pkt) == ESP_OK)
+      memcpy(c->push_vals, vals, sizeof(vals));
+  }
+
+  xSemaphoreGive(ws_mgr.lock);
+}
+
+static void ws_push_tick(void *arg)
+{
+  if (!ws_mgr.server || ws_mgr.count == 0)
+    return;
+
+  if (atomic_exchange(&ws_mgr.push_queued, true))
+    return;
+
+  if (httpd_queue_work(ws_mgr.server, ws_push, NULL) != ESP_OK)
+    atomic_store(&ws_mgr.push_queued, false);
+}
+
+static void ws_set_push(int fd, int ms)
+{
+  if (ms > 0 && ms < WS_PUSH_TICK_MS)
+    ms = WS_PUSH_TICK_MS;
+  if (ms > 60000)
+    ms = 60000;
+
+  xSemaphoreTake(ws_mgr.lock, portMAX_DELAY);
+
+  for (int i = 0; i < ws_mgr.count; i++)
+  {
+    ws_client_t *c = &ws_mgr.clients[i];
+    if (c->fd == fd)
+    {
+      c->push_ms = ms;
+      c->push_last = 0;
+      memset(c->push_vals, 0, sizeof(c->push_vals)); // full snapshot first
+      break;
+    }
+  }
+
+  xSemaphoreGive(ws_mgr.lock);
+
+  ESP_LOGI(TAG, "WS fd=%d push every %d ms", fd, ms);
+}
+
+static void ws_close_fn(httpd_handle_t hd, int fd)
+{
+  ws_remove_client(fd);
+  close(fd);
+}
+
 static esp_err_t ws_handler(httpd_req_t *req)
 {
   if (req->method == HTTP_GET)
@@ -874,6 +1867,8 @@ static esp_err_t ws_handler(httpd_req_t *req)
     return ESP_OK;
   }
 
+  static uint8_t payload[WS_RX_MAX + 1]; // httpd task only
+
   httpd_ws_frame_t ws_pkt = {0};
   ws_pkt.type = HTTPD_WS_TYPE_TEXT;
 
@@ -882,10 +1877,15 @@ static esp_err_t ws_handler(httpd_req_t *req)
   if (ret != ESP_OK)
     return ret;
 
+  if (ws_pkt.len > WS_RX_MAX)
+    return ESP_ERR_INVALID_SIZE; // closes the socket
+
   if (ws_pkt.len)
   {
-    ws_pkt.payload = malloc(ws_pkt.len + 1);
-    httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
+    ws_pkt.payload = payload;
+    ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
+    if (ret != ESP_OK)
+      return ret;
     ws_pkt.payload[ws_pkt.len] = 0;
   }
 
@@ -897,33 +1897,205 @@ static esp_err_t ws_handler(httpd_req_t *req)
   if (ws_pkt.len)
   {
     ESP_LOGI(TAG, "Received: %s", ws_pkt.payload);
-    /* Echo back */
-    httpd_ws_send_frame(req, &ws_pkt);
-    free(ws_pkt.payload);
+
+    arena_begin();
+
+    /* {"push":ms} subscribes to status updates, anything else is echoed */
+    cJSON *doc = cJSON_Parse((char *)ws_pkt.payload);
+    cJSON *push = cJSON_GetObjectItem(doc, "push");
+
+    if (cJSON_IsNumber(push))
+      ws_set_push(httpd_req_to_sockfd(req), push->valueint);
+    else
+      httpd_ws_send_frame(req, &ws_pkt);
+
+    cJSON_Delete(doc);
+    arena_end();
+  }
+
+  return ESP_OK;
+}
+
+/*
+ * Slow handlers (OTA, scan long-poll, NVS writes, big JSON) run on a small
+ * worker pool through the async request API so the httpd task stays free
+ * for /ws and everybody else. Each endpoint has its own concurrency limit
+ * and the pool as a whole never holds more than HTTP_MAX_INFLIGHT requests;
+ * anything beyond that is turned away with a 503 instead of piling up
+ * open sockets.
+ */
+static http_endpoint_t endpoints[] = {
+    {"/app", HTTP_POST, app_handler, 0},
+    {"/firmware", HTTP_POST, firmware_handler, 0},
+    {"/system", HTTP_POST, system_handler, 2},
+    {"/config", HTTP_POST, config_handler, 1},
+    {"/scan", HTTP_GET, wifi_scan_handler, 1},
+    {"/upload", HTTP_POST, ota_update_handler, 1},
+    {"/upload/delta", HTTP_POST, ota_delta_handler, 1},
+    {"/track", HTTP_GET, track_handler, 1},
+    {"/assets", HTTP_POST, assets_upload_handler, 1},
+    {"/*", HTTP_GET, asset_handler, 0}, // last: catches every other GET
+};
+
+#define HTTP_ENDPOINTS (sizeof(endpoints) / sizeof(endpoints[0]))
+
+static void http_record(http_endpoint_t *ep, int64_t t0, bool busy)
+{
+  int64_t us = esp_timer_get_time() - t0;
+
+  ep->count++;
+  ep->sum_us += us;
+  if (us > ep->max_us)
+    ep->max_us = us;
+  if (busy && us > ep->max_busy_us)
+    ep->max_busy_us = us;
+
+  ESP_LOGD(TAG, "%s %lld us%s", ep->uri, (long long)us, busy ? " (busy)" : "");
+
+  boot_mark(BOOT_HTTP_SERVED);
+  powersave_kick();
+}
+
+static esp_err_t http_reject(httpd_req_t *req, http_endpoint_t *ep)
+{
+  ep->rejected++;
+  ESP_LOGW(TAG, "%s busy, rejecting", ep->uri);
+
+  httpd_resp_set_status(req, "503 Service Unavailable");
+  httpd_resp_set_hdr(req, "Retry-After", "1");
+  return httpd_resp_sendstr(req, "busy");
+}
+
+static void http_worker(void *arg)
+{
+  http_job_t job;
+
+  while (1)
+  {
+    if (xQueueReceive(http_jobs, &job, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    atomic_fetch_add(&http_running, 1);
+
+    arena_begin();
+    job.ep->handler(job.req);
+    arena_end();
+
+    http_record(job.ep, job.t0, atomic_load(&http_running) > 1);
+
+    httpd_req_async_handler_complete(job.req);
+
+    atomic_fetch_sub(&http_running, 1);
+    atomic_fetch_sub(&job.ep->inflight, 1);
+    atomic_fetch_sub(&http_inflight, 1);
+  }
+}
+
+static esp_err_t http_dispatch(httpd_req_t *req)
+{
+  http_endpoint_t *ep = req->user_ctx;
+  int64_t t0 = esp_timer_get_time();
+
+  if (!ep->max_inflight)
+  {
+    arena_begin();
+    esp_err_t err = ep->handler(req);
+    arena_end();
+
+    http_record(ep, t0, atomic_load(&http_running) > 0);
+    return err;
+  }
+
+  if (atomic_fetch_add(&ep->inflight, 1) >= ep->max_inflight)
+  {
+    atomic_fetch_sub(&ep->inflight, 1);
+    return http_reject(req, ep);
+  }
+
+  if (atomic_fetch_add(&http_inflight, 1) >= HTTP_MAX_INFLIGHT)
+  {
+    atomic_fetch_sub(&http_inflight, 1);
+    atomic_fetch_sub(&ep->inflight, 1);
+    return http_reject(req, ep);
+  }
+
+  http_job_t job = {.ep = ep, .t0 = t0};
+
+  if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK)
+  {
+    atomic_fetch_sub(&http_inflight, 1);
+    atomic_fetch_sub(&ep->inflight, 1);
+    return http_reject(req, ep);
   }
 
+  /* cannot fail: the queue is as deep as the in-flight limit */
+  xQueueSend(http_jobs, &job, 0);
+
   return ESP_OK;
 }
 
+static void http_stats_add(cJSON *elements)
+{
+  for (int i = 0; i < HTTP_ENDPOINTS; i++)
+  {
+    http_endpoint_t *ep = &endpoints[i];
+    char name[24], val[64];
+
+    snprintf(name, sizeof(name), "http_%s", ep->uri + 1);
+    snprintf(val, sizeof(val), "%lu req, avg %lu / max %lu / busy %lu ms, %lu 503",
+             (unsigned long)ep->count,
+             ep->count ? (unsigned long)(ep->sum_us / ep->count / 1000) : 0,
+             (unsigned long)(ep->max_us / 1000),
+             (unsigned long)(ep->max_busy_us / 1000),
+             (unsigned long)ep->rejected);
+
+    add_text_element(elements, ep->uri, name, val);
+  }
+}
+
 void webserver_start(void)
 {
+  snprintf(index_etag, sizeof(index_etag), "\"%08lx\"",
+           (unsigned long)esp_rom_crc32_le(0, index_html_gz_start,
+                                           index_html_gz_end - index_html_gz_start));
+
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.close_fn = ws_close_fn;
+  config.max_uri_handlers = HTTP_MAX_URIS;
+  config.uri_match_fn = httpd_uri_match_wildcard;
+
+  ws_mgr.lock = xSemaphoreCreateMutex();
+
+  http_jobs = xQueueCreate(HTTP_MAX_INFLIGHT, sizeof(http_job_t));
+  for (int i = 0; i < HTTP_WORKERS; i++)
+    xTaskCreate(http_worker, "http_worker", HTTP_WORKER_STACK, NULL, 5, NULL);
+
   httpd_handle_t server = NULL;
   if (httpd_start(&server, &config) == ESP_OK)
   {
-    httpd_uri_t uris[] = {
-        {"/", HTTP_GET, index_handler, NULL, false, false, NULL},
-        {"/system", HTTP_POST, system_handler, NULL, false, false, NULL},
-        {"/config", HTTP_POST, config_handler, NULL, false, false, NULL},
-        {"/app", HTTP_POST, app_handler, NULL, false, false, NULL},
-        {"/firmware", HTTP_POST, firmware_handler, NULL, false, false, NULL},
-        {"/upload", HTTP_POST, ota_update_handler, NULL, false, false, NULL},
-        {"/scan", HTTP_GET, wifi_scan_handler, NULL, false, false, NULL},
-        {"/ws", HTTP_GET, ws_handler, NULL, true, true, NULL}};
-    for (int i = 0; i < 8; i++)
-      httpd_register_uri_handler(server, &uris[i]);
-
-    ws_mgr.lock = xSemaphoreCreateMutex();
+    /* handlers match in registration order; these go before the catch-all */
+    httpd_uri_t ws_uri = {"/ws", HTTP_GET, ws_handler, NULL, true, true, NULL};
+    httpd_register_uri_handler(server, &ws_uri);
+
+    httpd_uri_t stream_uri = {"/stream", HTTP_GET, stream_http_handler, NULL, false, false, NULL};
+    httpd_register_uri_handler(server, &stream_uri);
+    stream_http_start();
+
+    for (int i = 0; i < HTTP_ENDPOINTS; i++)
+    {
+      httpd_uri_t uri = {endpoints[i].uri, endpoints[i].method,
+                         http_dispatch, &endpoints[i], false, false, NULL};
+      httpd_register_uri_handler(server, &uri);
+    }
+
+    ws_mgr.server = server;
+    stream_subscribe(ws_notify);
+
+    const esp_timer_create_args_t push_timer_args = {
+        .callback = ws_push_tick,
+        .name = "ws_push"};
+    esp_timer_create(&push_timer_args, &ws_mgr.push_timer);
+    esp_timer_start_periodic(ws_mgr.push_timer, WS_PUSH_TICK_MS * 1000);
   }
   ESP_LOGI(TAG, "webserver started");
 }
@@ -3,6 +3,21 @@
 #define APPCODE "ESP32-UART2-BRIDGE"
 
 #define MAX_WS_CLIENTS 4
+#define WS_BATCH_MAX 1024     // largest coalesced frame
+#define WS_EVICT_LAG 4096     // bytes behind the stream head ...
+#define WS_EVICT_MS 10000     // ... for this long gets a client closed
+#define WS_PUSH_TICK_MS 250   // status push granularity
+#define WS_PUSH_FIELDS 10
+#define WS_RX_MAX 128         // largest frame accepted from a client
+
+#define SCAN_WAIT_MS 8000 // /scan?fresh=1 long-poll limit
+
+#define HTTP_WORKERS 2        // tasks running the slow handlers
+#define HTTP_WORKER_STACK 6144
+#define HTTP_MAX_INFLIGHT 4   // queued + running, across all slow endpoints
+#define HTTP_MAX_URIS 16
+#define HTTP_BODY_MAX 2048    // form posts; OTA bodies are streamed
+
+#define TRACK_CHUNK 1024      // /track output batched per chunk
 
-void ws_broadcast(const char *data, size_t len);
 void webserver_start(void);
\ No newline at end of file
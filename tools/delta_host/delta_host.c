@@ -0,0 +1,298 @@
+/*
+ * Host build of main/delta.c, so the patches made by delta_ota.py are
+ * checked against the device applier and not just the Python one.
+ *
+ *   delta_host <running.bin> <patch> <out.bin> [seed]
+ *
+ * The running slot is the first file padded with 0xFF to a 64K boundary,
+ * the patch is fed to delta_write() in random 1 B..2 KB splits (seed picks
+ * them) and whatever reaches the OTA sink is written to out.bin. The sink
+ * checks size and SHA-256 the way ota_finish() does. Built and run by
+ * `delta_ota.py selftest`; the ROM inflater is stood in for by zlib.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_ota_ops.h"
+#include "esp32/rom/miniz.h"
+#include "mbedtls/sha256.h"
+
+#include "delta.h"
+
+static esp_partition_t running = {.label = "ota_0"};
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+  return &running;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t off, void *dst, size_t len)
+{
+  if (off > p->size || len > p->size - off)
+    return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, p->data + off, len);
+  return ESP_OK;
+}
+
+/* ---- OTA sink ---- */
+
+static struct
+{
+  uint8_t *buf;
+  uint32_t total, len;
+  mbedtls_sha256_context sha;
+  int open;
+} sink;
+
+esp_err_t ota_begin(uint32_t total)
+{
+  if (sink.open)
+    return ESP_ERR_INVALID_STATE;
+  sink.buf = malloc(total);
+  if (!sink.buf)
+    return ESP_ERR_NO_MEM;
+  sink.total = total;
+  sink.len = 0;
+  sink.open = 1;
+  mbedtls_sha256_init(&sink.sha);
+  mbedtls_sha256_starts(&sink.sha, 0);
+  return ESP_OK;
+}
+
+esp_err_t ota_write(const void *data, size_t len)
+{
+  if (!sink.open)
+    return ESP_ERR_INVALID_STATE;
+  if (len > sink.total - sink.len)
+    return ESP_ERR_INVALID_SIZE;
+  memcpy(sink.buf + sink.len, data, len);
+  sink.len += len;
+  mbedtls_sha256_update(&sink.sha, data, len);
+  return ESP_OK;
+}
+
+esp_err_t ota_finish(const uint8_t *expect_sha256, ota_result_t *res)
+{
+  if (!sink.open)
+    return ESP_ERR_INVALID_STATE;
+  sink.open = 0;
+  mbedtls_sha256_finish(&sink.sha, res->sha256);
+  res->size = sink.len;
+  res->elapsed_us = 0;
+  res->kbps = 0;
+  if (sink.len != sink.total)
+    return ESP_ERR_INVALID_SIZE;
+  if (expect_sha256 && memcmp(expect_sha256, res->sha256, 32) != 0)
+    return ESP_ERR_INVALID_CRC;
+  return ESP_OK;
+}
+
+void ota_abort(void)
+{
+  sink.open = 0;
+}
+
+/* ---- tinfl on zlib ---- */
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in, size_t *in_n,
+                              uint8_t *out_start, uint8_t *out_next, size_t *out_n, uint32_t flags)
+{
+  (void)out_start;
+  (void)flags;
+
+  if (!r->started)
+  {
+    memset(&r->z, 0, sizeof(r->z));
+    if (inflateInit2(&r->z, -15) != Z_OK)
+      return TINFL_STATUS_FAILED;
+    r->started = 1;
+  }
+
+  r->z.next_in = (Bytef *)in;
+  r->z.avail_in = *in_n;
+  r->z.next_out = out_next;
+  r->z.avail_out = *out_n;
+
+  int zr = inflate(&r->z, Z_NO_FLUSH);
+
+  *in_n -= r->z.avail_in;
+  *out_n -= r->z.avail_out;
+
+  if (zr == Z_STREAM_END)
+  {
+    inflateEnd(&r->z);
+    return TINFL_STATUS_DONE;
+  }
+  if (zr != Z_OK && zr != Z_BUF_ERROR)
+    return TINFL_STATUS_FAILED;
+  if (r->z.avail_out == 0)
+    return TINFL_STATUS_HAS_MORE_OUTPUT;
+  return TINFL_STATUS_NEEDS_MORE_INPUT;
+}
+
+/* ---- SHA-256 ---- */
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha_block(uint32_t *h, const uint8_t *p)
+{
+  uint32_t w[64], a[8];
+
+  for (int i = 0; i < 16; i++)
+    w[i] = (uint32_t)p[4 * i] << 24 | p[4 * i + 1] << 16 | p[4 * i + 2] << 8 | p[4 * i + 3];
+  for (int i = 16; i < 64; i++)
+    w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+           w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+  memcpy(a, h, sizeof(a));
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t t1 = a[7] + (ROR(a[4], 6) ^ ROR(a[4], 11) ^ ROR(a[4], 25)) +
+                  ((a[4] & a[5]) ^ (~a[4] & a[6])) + K[i] + w[i];
+    uint32_t t2 = (ROR(a[0], 2) ^ ROR(a[0], 13) ^ ROR(a[0], 22)) +
+                  ((a[0] & a[1]) ^ (a[0] & a[2]) ^ (a[1] & a[2]));
+    memmove(a + 1, a, 7 * sizeof(uint32_t));
+    a[4] += t1;
+    a[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++)
+    h[i] += a[i];
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *c)
+{
+  (void)c;
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *c, int is224)
+{
+  static const uint32_t iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  (void)is224;
+  memcpy(c->h, iv, sizeof(iv));
+  c->len = 0;
+  return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *c, const unsigned char *p, size_t n)
+{
+  while (n)
+  {
+    size_t have = c->len % 64, take = 64 - have < n ? 64 - have : n;
+    memcpy(c->buf + have, p, take);
+    c->len += take;
+    p += take;
+    n -= take;
+    if (c->len % 64 == 0)
+      sha_block(c->h, c->buf);
+  }
+  return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *c, unsigned char out[32])
+{
+  uint64_t bits = c->len * 8;
+  uint8_t pad[72] = {0x80};
+  size_t padn = (c->len % 64 < 56 ? 56 : 120) - c->len % 64;
+
+  for (int i = 0; i < 8; i++)
+    pad[padn + i] = bits >> (56 - 8 * i);
+  mbedtls_sha256_update(c, pad, padn + 8);
+
+  for (int i = 0; i < 8; i++)
+  {
+    out[4 * i] = c->h[i] >> 24;
+    out[4 * i + 1] = c->h[i] >> 16;
+    out[4 * i + 2] = c->h[i] >> 8;
+    out[4 * i + 3] = c->h[i];
+  }
+  return 0;
+}
+
+/* ---- driver ---- */
+
+static uint8_t *slurp(const char *path, size_t *len, size_t align)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    perror(path);
+    exit(2);
+  }
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  size_t cap = (*len + align - 1) / align * align;
+  uint8_t *p = malloc(cap ? cap : 1);
+  memset(p, 0xFF, cap);
+  if (fread(p, 1, *len, f) != *len)
+    exit(2);
+  fclose(f);
+  *len = cap;
+  return p;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 4)
+  {
+    fprintf(stderr, "usage: %s running.bin patch out.bin [seed]\n", argv[0]);
+    return 2;
+  }
+
+  size_t src_len, patch_len;
+  running.data = slurp(argv[1], &src_len, 65536);
+  running.size = src_len;
+  uint8_t *patch = slurp(argv[2], &patch_len, 1);
+  srand(argc > 4 ? atoi(argv[4]) : 1);
+
+  esp_err_t err = delta_begin();
+  for (size_t off = 0; err == ESP_OK && off < patch_len;)
+  {
+    size_t n = 1 + rand() % (1u << rand() % 12); // 1 B .. 2 KB, mostly small
+    if (n > patch_len - off)
+      n = patch_len - off;
+    err = delta_write(patch + off, n);
+    off += n;
+  }
+
+  ota_result_t res;
+  if (err == ESP_OK)
+    err = delta_finish(&res);
+  else
+    delta_abort();
+
+  if (err != ESP_OK)
+  {
+    fprintf(stderr, "delta failed: 0x%x\n", err);
+    return 1;
+  }
+
+  FILE *f = fopen(argv[3], "wb");
+  if (!f || fwrite(sink.buf, 1, sink.len, f) != sink.len || fclose(f) != 0)
+  {
+    perror(argv[3]);
+    return 2;
+  }
+  return 0;
+}
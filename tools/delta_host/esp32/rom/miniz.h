@@ -0,0 +1,24 @@
+#pragma once
+/* the ROM's tinfl interface, carried by zlib's raw inflate */
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+#define TINFL_LZ_DICT_SIZE 32768
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+typedef enum
+{
+  TINFL_STATUS_BAD_PARAM = -3,
+  TINFL_STATUS_ADLER32_MISMATCH = -2,
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+  TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+  TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+typedef struct
+{
+  int started;
+  z_stream z;
+} tinfl_decompressor;
+#define tinfl_init(r) ((r)->started = 0)
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in, size_t *in_n,
+                              uint8_t *out_start, uint8_t *out_next, size_t *out_n, uint32_t flags);
@@ -0,0 +1,11 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+typedef struct
+{
+  const uint8_t *data; // the whole slot, in RAM
+  uint32_t size;
+  const char *label;
+} esp_partition_t;
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t off, void *dst, size_t len);
@@ -0,0 +1,14 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+typedef struct
+{
+  uint32_t h[8];
+  uint8_t buf[64];
+  uint64_t len;
+} mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context *c);
+void mbedtls_sha256_free(mbedtls_sha256_context *c);
+int mbedtls_sha256_starts(mbedtls_sha256_context *c, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context *c, const unsigned char *p, size_t n);
+int mbedtls_sha256_finish(mbedtls_sha256_context *c, unsigned char out[32]);
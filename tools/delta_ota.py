@@ -0,0 +1,294 @@
+#!/usr/bin/env python3
+"""Delta OTA patches against the app image the device is running.
+
+usage: delta_ota.py diff <old.bin> <new.bin> <patch.bin>
+       delta_ota.py apply <old.bin> <patch.bin> <new.bin>
+       delta_ota.py check <old.bin> <new.bin>
+       delta_ota.py selftest
+
+Upload the patch with
+    curl --data-binary @patch.bin http://<device>/upload/delta
+
+<old.bin> must be the exact image running on the device; it refuses any
+patch whose source SHA-256 does not match its own slot.
+
+Patch layout (little endian):
+    "EDP1"  u32 src_size  src_sha256[32]  u32 dst_size  dst_sha256[32]
+followed by a raw deflate stream of operations:
+    0x00 COPY   u32 src_off  u32 len          dst += src[off:off+len]
+    0x01 ADD    u32 src_off  u32 len  bytes   dst += src[off:off+len] + bytes
+    0x02 INSERT u32 len      bytes            dst += bytes
+
+ADD is the bsdiff idea: a rebuilt function usually lines up with its old
+self except for a few shifted addresses, so the difference is mostly
+zeros and compresses to almost nothing.
+
+`check` and `selftest` diff, apply and compare the result byte for byte.
+`selftest` also builds main/delta.c for the host (tools/delta_host, needs
+cc and zlib) and feeds every patch through it in random splits, so the
+device applier has to rebuild the same bytes too.
+"""
+
+import hashlib
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+
+MAGIC = b'EDP1'
+HDR = struct.Struct('<4sI32sI32s')
+
+OP_COPY = 0
+OP_ADD = 1
+OP_INSERT = 2
+
+SEED = 8       # bytes that must match exactly to start a region
+STRIDE = 4     # source positions indexed
+GIVE_UP = 64   # approximate extension stops after this many bytes without gain
+
+
+def build_index(src):
+    index = {}
+    for i in range(0, len(src) - SEED + 1, STRIDE):
+        index.setdefault(src[i:i + SEED], i)
+    return index
+
+
+def find_seed(src, dst, index, j, last):
+    if last is not None and 0 <= j + last <= len(src) - SEED and \
+            src[j + last:j + last + SEED] == dst[j:j + SEED]:
+        return j + last
+
+    for s in range(STRIDE):
+        i = index.get(dst[j + s:j + s + SEED])
+        if i is not None and i >= s and src[i - s:i - s + SEED] == dst[j:j + SEED]:
+            return i - s
+
+    return None
+
+
+def extend(src, dst, i, j):
+    """length of the best approximate match of dst[j:] against src[i:]"""
+    best = score = 0
+    length = 0
+    k = 0
+    limit = min(len(src) - i, len(dst) - j)
+
+    while k < limit:
+        score += 1 if src[i + k] == dst[j + k] else -1
+        k += 1
+        if score > best:
+            best = score
+            length = k
+        elif k - length > GIVE_UP:
+            break
+
+    return length
+
+
+def diff(src, dst):
+    index = build_index(src)
+    ops = bytearray()
+    pending = 0   # start of bytes not yet covered by an op
+    last = None   # displacement of the previous region
+    j = 0
+
+    def insert(a, b):
+        if b > a:
+            ops.extend(struct.pack('<BI', OP_INSERT, b - a))
+            ops.extend(dst[a:b])
+
+    while j <= len(dst) - SEED:
+        i = find_seed(src, dst, index, j, last)
+        if i is None:
+            j += 1
+            continue
+
+        while j > pending and i > 0 and src[i - 1] == dst[j - 1]:
+            i -= 1
+            j -= 1
+
+        n = extend(src, dst, i, j)
+        insert(pending, j)
+
+        delta = bytes((dst[j + k] - src[i + k]) & 0xFF for k in range(n))
+        if delta.count(0) == n:
+            ops.extend(struct.pack('<BII', OP_COPY, i, n))
+        else:
+            ops.extend(struct.pack('<BII', OP_ADD, i, n))
+            ops.extend(delta)
+
+        last = i - j
+        j += n
+        pending = j
+
+    insert(pending, len(dst))
+
+    z = zlib.compressobj(9, zlib.DEFLATED, -15)
+    body = z.compress(bytes(ops)) + z.flush()
+
+    return HDR.pack(MAGIC, len(src), hashlib.sha256(src).digest(),
+                    len(dst), hashlib.sha256(dst).digest()) + body
+
+
+def apply(src, patch):
+    magic, src_size, src_sha, dst_size, dst_sha = HDR.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError('not a delta patch')
+    if src_size != len(src) or hashlib.sha256(src).digest() != src_sha:
+        raise ValueError('patch was made against a different image')
+
+    ops = zlib.decompress(patch[HDR.size:], -15)
+    dst = bytearray()
+    p = 0
+
+    while p < len(ops):
+        op = ops[p]
+        if op == OP_INSERT:
+            n, = struct.unpack_from('<I', ops, p + 1)
+            p += 5
+            dst.extend(ops[p:p + n])
+            p += n
+            continue
+
+        off, n = struct.unpack_from('<II', ops, p + 1)
+        p += 9
+        if off + n > len(src):
+            raise ValueError('copy past the end of the source')
+
+        if op == OP_COPY:
+            dst.extend(src[off:off + n])
+        elif op == OP_ADD:
+            dst.extend((src[off + k] + ops[p + k]) & 0xFF for k in range(n))
+            p += n
+        else:
+            raise ValueError('bad op %d' % op)
+
+    if len(dst) != dst_size or hashlib.sha256(dst).digest() != dst_sha:
+        raise ValueError('rebuilt image does not match')
+
+    return bytes(dst)
+
+
+def check(src, dst, name='image', host=None):
+    patch = diff(src, dst)
+    out = apply(src, patch)
+    ok = out == dst
+    print('%s: %d -> %d bytes, patch %d bytes (%.1f%%), %s' % (
+        name, len(src), len(dst), len(patch),
+        100.0 * len(patch) / max(len(dst), 1), 'identical' if ok else 'MISMATCH'))
+    if host:
+        dev = all(host_apply(host, src, patch, seed) == dst for seed in range(1, 4))
+        print('%s: delta.c %s' % (name, 'identical' if dev else 'MISMATCH'))
+        ok = ok and dev
+    return ok
+
+
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'delta_host')
+
+
+def host_build(tmp):
+    exe = os.path.join(tmp, 'delta_host')
+    main_dir = os.path.join(HOST_DIR, '..', '..', 'main')
+    cmd = [os.environ.get('CC', 'cc'), '-std=gnu17', '-O2', '-I' + HOST_DIR, '-I' + main_dir,
+           os.path.join(HOST_DIR, 'delta_host.c'), os.path.join(main_dir, 'delta.c'),
+           '-lz', '-o', exe]
+    try:
+        subprocess.run(cmd, check=True)
+    except (OSError, subprocess.CalledProcessError) as e:
+        print('delta_ota: host build of delta.c failed: %s' % e)
+        return None
+    return exe
+
+
+def host_apply(exe, src, patch, seed=1):
+    """Rebuild with main/delta.c; None if it refused the patch."""
+    d = os.path.dirname(exe)
+    paths = [os.path.join(d, n) for n in ('src.bin', 'patch.bin', 'out.bin')]
+    for path, data in zip(paths, (src, patch)):
+        with open(path, 'wb') as f:
+            f.write(data)
+    r = subprocess.run([exe] + paths + [str(seed)], stderr=subprocess.DEVNULL)
+    return read(paths[2]) if r.returncode == 0 else None
+
+
+def selftest():
+    rnd = random.Random(1)
+    base = bytearray()
+    while len(base) < 256 * 1024:
+        # code-like: repeated instruction patterns and 32-bit literals
+        base.extend(rnd.choice([b'\x36\x41\x00', b'\x1d\xf0', b'\x0c\x02', b'\x91\x00\x00\x40']))
+        if rnd.random() < 0.05:
+            base.extend(struct.pack('<I', 0x400d0000 + rnd.randrange(0x10000)))
+    base = bytes(base)
+
+    cases = [('identical', base)]
+
+    edit = bytearray(base)
+    edit[1000:1000] = bytes(rnd.randrange(256) for _ in range(300))
+    cases.append(('insert 300 B', bytes(edit)))
+
+    edit = bytearray(base)
+    for _ in range(200):
+        k = rnd.randrange(0, len(edit) - 4)
+        v, = struct.unpack_from('<I', edit, k)
+        struct.pack_into('<I', edit, k, (v + 0x40) & 0xFFFFFFFF)
+    cases.append(('200 shifted words', bytes(edit)))
+
+    edit = bytearray(base)
+    del edit[5000:9000]
+    edit.extend(bytes(rnd.randrange(256) for _ in range(2000)))
+    cases.append(('cut + append', bytes(edit)))
+
+    cases.append(('unrelated', bytes(rnd.randrange(256) for _ in range(4096))))
+
+    # enough new code that the inflated ops wrap the 32K dictionary a few times
+    edit = bytearray(base)
+    edit[50000:50000] = bytes(rnd.randrange(256) for _ in range(100 * 1024))
+    cases.append(('insert 100 KB', bytes(edit)))
+
+    with tempfile.TemporaryDirectory() as tmp:
+        host = host_build(tmp)
+        if not host:
+            return False
+
+        ok = all([check(base, dst, name, host) for name, dst in cases])
+
+        # a patch for some other build must be refused before anything is written
+        other = bytearray(base)
+        other[0] ^= 1
+        refused = host_apply(host, bytes(other), diff(base, cases[1][1])) is None
+        print('wrong source: delta.c %s' % ('refused' if refused else 'ACCEPTED'))
+
+        return ok and refused
+
+
+def read(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def main():
+    args = sys.argv[1:]
+
+    if args[:1] == ['diff'] and len(args) == 4:
+        patch = diff(read(args[1]), read(args[2]))
+        with open(args[3], 'wb') as f:
+            f.write(patch)
+        print('delta_ota: %s -> %s, %d bytes' % (args[1], args[3], len(patch)))
+    elif args[:1] == ['apply'] and len(args) == 4:
+        with open(args[3], 'wb') as f:
+            f.write(apply(read(args[1]), read(args[2])))
+    elif args[:1] == ['check'] and len(args) == 3:
+        sys.exit(0 if check(read(args[1]), read(args[2]), args[2]) else 1)
+    elif args[:1] == ['selftest']:
+        sys.exit(0 if selftest() else 1)
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Local endpoint for the bridge's API Post uploader.
+
+usage: http_sink.py [--port N] [--fail-every N] [--down-s N] [--delay-ms N] [--close]
+
+Accepts POSTs on any path, keeps connections alive (HTTP/1.1) and prints,
+every 10 s, the requests/s, records and bytes per record it received, and
+how many TCP connections they came over. Point api_url at
+http://<this host>:<port>/ and enable API Post on the config page.
+
+--fail-every N answers every Nth request with 503, --down-s N answers
+everything with 503 for the first N seconds (a backend outage: the bridge
+should queue, back off and then catch up), --delay-ms slows each answer,
+and --close drops the connection after every response, to compare with
+keep-alive.
+"""
+
+import argparse
+import http.server
+import json
+import threading
+import time
+
+lock = threading.Lock()
+totals = {'conns': 0, 'requests': 0, 'failed': 0, 'records': 0, 'bytes': 0}
+window = dict(totals)
+started = time.time()
+
+
+def count_records(ctype, body):
+    if ctype.startswith('application/json'):
+        try:
+            doc = json.loads(body)
+            return len(doc) if isinstance(doc, list) else 1
+        except ValueError:
+            return 0
+    return body.count(b'\n')
+
+
+def make_handler(args):
+    class Sink(http.server.BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def setup(self):
+            super().setup()
+            with lock:
+                totals['conns'] += 1
+
+        def do_POST(self):
+            body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+
+            with lock:
+                totals['requests'] += 1
+                n = totals['requests']
+
+            if args.delay_ms:
+                time.sleep(args.delay_ms / 1000)
+
+            down = time.time() - started < args.down_s
+            if down or (args.fail_every and n % args.fail_every == 0):
+                with lock:
+                    totals['failed'] += 1
+                self.reply(503)
+                return
+
+            with lock:
+                totals['records'] += count_records(self.headers.get('Content-Type', ''), body)
+                totals['bytes'] += len(body)
+            self.reply(200)
+
+        def reply(self, status):
+            self.send_response(status)
+            self.send_header('Content-Length', '0')
+            if args.close:
+                self.send_header('Connection', 'close')
+                self.close_connection = True
+            self.end_headers()
+
+        def log_message(self, *a):
+            pass
+
+    return Sink
+
+
+def report(interval):
+    global window
+    while True:
+        time.sleep(interval)
+        with lock:
+            now = dict(totals)
+        d = {k: now[k] - window[k] for k in now}
+        window = now
+        print('%6.1f req/s  %4d records  %6.1f B/record  %3d failed  %3d new conns  (total %d req over %d conns)' % (
+            d['requests'] / interval, d['records'],
+            d['bytes'] / d['records'] if d['records'] else 0,
+            d['failed'], d['conns'], now['requests'], now['conns']), flush=True)
+
+
+def main():
+    ap = argparse.ArgumentParser(usage=__doc__.strip().splitlines()[2][7:])
+    ap.add_argument('--port', type=int, default=8001)
+    ap.add_argument('--fail-every', type=int, default=0)
+    ap.add_argument('--down-s', type=float, default=0)
+    ap.add_argument('--delay-ms', type=float, default=0)
+    ap.add_argument('--close', action='store_true')
+    args = ap.parse_args()
+
+    threading.Thread(target=report, args=(10,), daemon=True).start()
+    srv = http.server.ThreadingHTTPServer(('', args.port), make_handler(args))
+    print('listening on :%d' % args.port, flush=True)
+    srv.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
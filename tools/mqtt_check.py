@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Check the bridge's MQTT fix stream against a broker.
+
+usage: mqtt_check.py <broker> [--port N] [--topic gps/bridge]
+
+Subscribes to <topic>/# (QoS 1) with a minimal MQTT 3.1.1 client, no
+libraries needed, and every 10 s prints fixes/s, the oldest fix's age in
+the period (backlog shows up as age), repeats, positions missing from
+the outbox sequence, and the latest <topic>/stats. A backlog drain is reported when
+fixes come back to live after being older than 30 s.
+
+Against a local mosquitto (`mosquitto -v`), with mqtt_uri pointed at it:
+cut the device's uplink or stop the broker for a while, restore it, and
+watch the backlog come through with no gaps; the device's /system MQTT
+line gives the drain time and rate from its side.
+"""
+
+import argparse
+import json
+import socket
+import struct
+import time
+
+LIVE_S = 30
+
+
+def encode_len(n):
+    out = bytearray()
+    while True:
+        b, n = n % 128, n // 128
+        out.append(b | (0x80 if n else 0))
+        if not n:
+            return bytes(out)
+
+
+def utf8(s):
+    b = s.encode()
+    return struct.pack('>H', len(b)) + b
+
+
+def packet(kind, body):
+    return bytes([kind]) + encode_len(len(body)) + body
+
+
+def read_packet(sock):
+    head = sock.recv(1)
+    if not head:
+        raise ConnectionError('broker closed the connection')
+    n, mult = 0, 1
+    while True:
+        b = sock.recv(1)[0]
+        n += (b & 0x7F) * mult
+        mult *= 128
+        if not b & 0x80:
+            break
+    body = b''
+    while len(body) < n:
+        chunk = sock.recv(n - len(body))
+        if not chunk:
+            raise ConnectionError('short packet')
+        body += chunk
+    return head[0], body
+
+
+def main():
+    ap = argparse.ArgumentParser(usage=__doc__.strip().splitlines()[2][7:])
+    ap.add_argument('broker')
+    ap.add_argument('--port', type=int, default=1883)
+    ap.add_argument('--topic', default='gps/bridge')
+    args = ap.parse_args()
+
+    sock = socket.create_connection((args.broker, args.port))
+    sock.settimeout(1)
+    sock.sendall(packet(0x10, utf8('MQTT') + bytes([4, 0x02]) + struct.pack('>H', 60) +
+                        utf8('mqtt-check-%d' % (time.time() % 10000))))
+    sock.sendall(packet(0x82, struct.pack('>H', 1) + utf8(args.topic + '/#') + b'\x01'))
+
+    seen = set()
+    top = -1
+    period = {'fixes': 0, 'dups': 0, 'oldest': 0}
+    stats = None
+    behind_since = None
+    t_report = t_ping = time.time()
+
+    while True:
+        try:
+            kind, body = read_packet(sock)
+        except socket.timeout:
+            kind = None
+
+        if kind is not None and kind & 0xF0 == 0x30:
+            qos = (kind >> 1) & 3
+            tlen = struct.unpack('>H', body[:2])[0]
+            topic = body[2:2 + tlen].decode()
+            off = 2 + tlen
+            if qos:
+                sock.sendall(packet(0x40, body[off:off + 2]))
+                off += 2
+            payload = json.loads(body[off:])
+
+            if topic.endswith('/stats'):
+                stats = payload
+            elif topic.endswith('/fix'):
+                now = time.time()
+                for fix in payload:
+                    seq = fix['seq']
+                    if seq in seen:
+                        period['dups'] += 1
+                        continue
+                    seen.add(seq)
+                    top = max(top, seq)
+                    period['fixes'] += 1
+                    age = now - fix['ts']
+                    period['oldest'] = max(period['oldest'], age)
+
+                    if age > LIVE_S and behind_since is None:
+                        behind_since = now
+                    elif age <= LIVE_S and behind_since is not None:
+                        print('backlog drained in %.1f s' % (now - behind_since), flush=True)
+                        behind_since = None
+
+        now = time.time()
+        if now - t_ping > 30:
+            sock.sendall(b'\xc0\x00')
+            t_ping = now
+        if now - t_report >= 10:
+            missing = top - min(seen) + 1 - len(seen) if seen else 0
+            print('%5.1f fixes/s  oldest %6.0f s  %3d repeats  %d missing  last seq %d  %s' % (
+                period['fixes'] / (now - t_report), period['oldest'], period['dups'],
+                missing, top, json.dumps(stats) if stats else ''), flush=True)
+            period = {'fixes': 0, 'dups': 0, 'oldest': 0}
+            t_report = now
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Feed NMEA into the bridge's UART2 RX, timed to this host's clock.
+
+usage: nmea_replay.py <tty|-> [--baud N] [--delay-ms N] [--file log.nmea] [--no-fix]
+
+Each second, --delay-ms after the host's second boundary (default 80, a
+typical receiver's output latency), one epoch of sentences is written:
+synthesised RMC and GGA at a fixed position, or the epochs of a recorded
+log with time, date and checksums rewritten to now. --no-fix sends void
+fixes, to watch the NTP server go to holdover and then unsynchronised.
+
+Testing the NTP server with a USB serial adapter wired to GPIO16:
+
+  nmea_replay.py /dev/ttyUSB0 --delay-ms 80
+  ntpdate -q <device>                  # offset about -80 ms, no fudge
+  chronyd -Q 'server <device> iburst maxsamples 8'
+
+With the host on good time, the offset reported is the receiver latency
+the device can't see; NTP_NMEA_FUDGE_MS is set to it. '-' writes to
+stdout instead (e.g. through socat to a pty).
+"""
+
+import argparse
+import os
+import sys
+import termios
+import time
+
+LAT, LON, ALT = '1435.1234', '12059.5678', '15.0'
+
+
+def sentence(body):
+    c = 0
+    for ch in body.encode():
+        c ^= ch
+    return '$%s*%02X\r\n' % (body, c)
+
+
+def stamps(t):
+    return time.strftime('%H%M%S.00', time.gmtime(t)), time.strftime('%d%m%y', time.gmtime(t))
+
+
+def synth(t, fix):
+    hms, dmy = stamps(t)
+    if not fix:
+        return [sentence('GPRMC,%s,V,,,,,,,%s,,,N' % (hms, dmy)),
+                sentence('GPGGA,%s,,,,,0,00,99.9,,M,,M,,' % hms)]
+    return [sentence('GPRMC,%s,A,%s,N,%s,E,0.02,0.0,%s,,,A' % (hms, LAT, LON, dmy)),
+            sentence('GPGGA,%s,%s,N,%s,E,1,09,0.9,%s,M,46.9,M,,' % (hms, LAT, LON, ALT))]
+
+
+def load_epochs(path):
+    """Sentence bodies grouped into epochs, split at each RMC."""
+    epochs, cur = [], []
+    with open(path, errors='replace') as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('$'):
+                continue
+            if line[3:6] == 'RMC' and cur:
+                epochs.append(cur)
+                cur = []
+            cur.append(line.split('*')[0][1:])
+    if cur:
+        epochs.append(cur)
+    return epochs
+
+
+def restamp(epoch, t):
+    hms, dmy = stamps(t)
+    out = []
+    for body in epoch:
+        f = body.split(',')
+        kind = f[0][2:]
+        if kind in ('RMC', 'GGA', 'ZDA') and len(f) > 1:
+            f[1] = hms
+        if kind == 'RMC' and len(f) > 9:
+            f[9] = dmy
+        out.append(sentence(','.join(f)))
+    return out
+
+
+def open_out(path, baud):
+    if path == '-':
+        return sys.stdout.buffer.fileno()
+
+    fd = os.open(path, os.O_WRONLY | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    speed = getattr(termios, 'B%d' % baud)
+    attr[0] = 0  # iflag
+    attr[1] = 0  # oflag: no CR/LF translation
+    attr[2] = termios.CS8 | termios.CLOCAL | termios.CREAD
+    attr[3] = 0  # lflag
+    attr[4] = attr[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    return fd
+
+
+def main():
+    ap = argparse.ArgumentParser(usage=__doc__.strip().splitlines()[2][7:])
+    ap.add_argument('out')
+    ap.add_argument('--baud', type=int, default=9600)
+    ap.add_argument('--delay-ms', type=float, default=80)
+    ap.add_argument('--file')
+    ap.add_argument('--no-fix', action='store_true')
+    args = ap.parse_args()
+
+    fd = open_out(args.out, args.baud)
+    epochs = load_epochs(args.file) if args.file else None
+    n = 0
+
+    while True:
+        now = time.time()
+        second = int(now) + 1
+        time.sleep(second + args.delay_ms / 1000 - now)
+
+        if epochs:
+            lines = restamp(epochs[n % len(epochs)], second)
+        else:
+            lines = synth(second, not args.no_fix)
+        os.write(fd, ''.join(lines).encode())
+        n += 1
+
+
+if __name__ == '__main__':
+    main()
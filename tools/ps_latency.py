@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""Compare inbound latency under each Wi-Fi power-save mode.
+
+usage: ps_latency.py <device> [samples]
+
+Pins the device's wifi_ps setting to each mode in turn (off, min modem,
+max modem, then auto), lets it settle, and times TCP connects to port 80
+from here: the SYN/SYN-ACK round trip is exactly what modem sleep delays.
+Connects alone don't count as requests, so in auto mode the governor is
+measured in the state it drops to when idle. The setting is put back
+afterwards.
+
+The driver ignores the power-save setting while the soft-AP is up. The
+firmware drops it NETWORK_AP_OFF_MS after the STA is online with nobody
+on the AP (the "Off while Sta online" setting), so run this from the
+STA's network; it waits for /system to report the AP down first.
+"""
+
+import json
+import socket
+import statistics
+import sys
+import time
+import urllib.request
+
+MODES = [(1, 'none'), (2, 'min modem'), (3, 'max modem'), (0, 'auto, idle')]
+SETTLE_S = 15  # longer than the governor's linger after our own request
+AP_WAIT_S = 90
+
+
+def post(base, page, body):
+    req = urllib.request.Request('http://%s/%s' % (base, page), data=body.encode())
+    with urllib.request.urlopen(req, timeout=10) as r:
+        return r.read()
+
+
+def values(base, page):
+    groups = json.loads(post(base, page, '{}'))
+    return {e.get('name'): e.get('value') for g in groups for e in g['elements']}
+
+
+def connect_ms(host):
+    t0 = time.time()
+    with socket.create_connection((host, 80), timeout=5):
+        pass
+    return (time.time() - t0) * 1000
+
+
+def measure(host, samples):
+    out = []
+    for _ in range(samples):
+        out.append(connect_ms(host))
+        time.sleep(0.5)  # spread over beacon intervals
+    return out
+
+
+def wait_ap_off(base):
+    deadline = time.time() + AP_WAIT_S
+    while 'soft-AP is up' in values(base, 'system').get('powersave', ''):
+        if time.time() > deadline:
+            return False
+        time.sleep(5)
+    return True
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    base = sys.argv[1]
+    samples = int(sys.argv[2]) if len(sys.argv) > 2 else 40
+    host = base.split(':')[0]
+
+    original = values(base, 'config').get('wifi_ps', '0')
+
+    if not wait_ap_off(base):
+        print('soft-AP still up after %d s (a client on it, or "Off while Sta online" unset):\n'
+              'every mode will measure the same' % AP_WAIT_S)
+
+    print('%-12s %8s %8s %8s %8s' % ('mode', 'min', 'median', 'p90', 'max'))
+    try:
+        for value, label in MODES:
+            post(base, 'config', json.dumps({'wifi_ps': str(value)}))
+            time.sleep(SETTLE_S)
+            ms = sorted(measure(host, samples))
+            print('%-12s %8.1f %8.1f %8.1f %8.1f' % (
+                label, ms[0], statistics.median(ms), ms[int(len(ms) * 0.9)], ms[-1]))
+    finally:
+        post(base, 'config', json.dumps({'wifi_ps': original}))
+
+    print('\ndevice: %s' % values(base, 'system').get('powersave', '?'))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Soak the web server and check that request handling does not allocate.
+
+usage: soak.py <device> [seconds]
+
+Polls the UI endpoints the way open browser tabs do for the given time
+(default 600 s), then compares the device's own counters from /system
+before and after: malloc fallbacks out of the request arenas must not
+grow, and the number of allocated heap blocks must come back to where it
+started.
+"""
+
+import json
+import re
+import sys
+import time
+import urllib.request
+
+PAGES = [('system', '{}'), ('app', '{}'), ('config', '{}'), ('firmware', '{}')]
+
+
+def post(base, page, body):
+    req = urllib.request.Request('http://%s/%s' % (base, page), data=body.encode())
+    with urllib.request.urlopen(req, timeout=10) as r:
+        return r.read()
+
+
+def counters(base):
+    groups = json.loads(post(base, 'system', '{}'))
+    values = {e.get('name'): e.get('value') for g in groups for e in g['elements']}
+
+    blocks = int(values['heap_blocks'].split()[0])
+    fallback = int(re.search(r'(\d+) malloc', values['arena']).group(1))
+    return blocks, fallback, values['arena']
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    base = sys.argv[1]
+    seconds = int(sys.argv[2]) if len(sys.argv) > 2 else 600
+
+    # one round first so lazily created state (sockets, scan cache) exists
+    for page, body in PAGES:
+        post(base, page, body)
+    blocks0, fallback0, _ = counters(base)
+
+    requests = errors = 0
+    end = time.time() + seconds
+    while time.time() < end:
+        for page, body in PAGES:
+            try:
+                post(base, page, body)
+            except OSError:
+                errors += 1
+            requests += 1
+        urllib.request.urlopen('http://%s/scan' % base, timeout=10).read()
+        requests += 1
+
+    time.sleep(2)
+    blocks1, fallback1, arena = counters(base)
+
+    print('%d requests, %d errors' % (requests, errors))
+    print('heap blocks %d -> %d' % (blocks0, blocks1))
+    print('arena fallback mallocs %d -> %d (%s)' % (fallback0, fallback1, arena))
+
+    ok = fallback1 == fallback0 and blocks1 <= blocks0
+    print('PASS' if ok else 'FAIL')
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
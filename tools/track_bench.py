@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Measure /track query latency against the amount of track stored.
+
+usage: track_bench.py <device> [format]
+
+Two sweeps over the log the device holds now:
+
+  seek   a 60 s window placed ever further back in the log; with the
+         sector time index the time to the first record should stay flat
+         however much log lies after (or before) the window
+  span   windows ending now and growing to the whole log; total time
+         should grow with the points returned, not with the log size
+
+For each query the time to the first body byte and to the end are
+measured here, and the device's own count of flash pages read is taken
+from /system. Run it again as the log grows to get latency against log
+size.
+"""
+
+import json
+import sys
+import time
+import urllib.request
+
+
+def post(base, page, body):
+    req = urllib.request.Request('http://%s/%s' % (base, page), data=body.encode())
+    with urllib.request.urlopen(req, timeout=10) as r:
+        return r.read()
+
+
+def device_query_stats(base):
+    groups = json.loads(post(base, 'system', '{}'))
+    values = {e.get('name'): e.get('value') for g in groups for e in g['elements']}
+    return values.get('track_query', '?'), values.get('track', '?')
+
+
+def query(base, frm, to, fmt):
+    url = 'http://%s/track?from=%s&to=%s&format=%s' % (base, frm, to, fmt)
+    t0 = time.time()
+    with urllib.request.urlopen(url, timeout=60) as r:
+        first = r.read(1)
+        ttfb = time.time() - t0
+        body = first + r.read()
+    total = time.time() - t0
+    return ttfb, total, body
+
+
+def points(body, fmt):
+    if fmt == 'csv':
+        return max(body.count(b'\n') - 1, 0)
+    if fmt == 'geojson':
+        return json.loads(body).get('properties', {}).get('points', 0)
+    return body.count(b'<trkpt')
+
+
+def row(label, base, frm, to, fmt):
+    ttfb, total, body = query(base, frm, to, fmt)
+    dev, _ = device_query_stats(base)
+    print('%-14s %6d pts %8d B  first %6.0f ms  total %7.0f ms  | %s'
+          % (label, points(body, fmt), len(body), ttfb * 1000, total * 1000, dev))
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    base = sys.argv[1]
+    fmt = sys.argv[2] if len(sys.argv) > 2 else 'csv'
+
+    _, log = device_query_stats(base)
+    print('log: %s' % log)
+
+    print('\nseek: 60 s window, N seconds back')
+    for age in (60, 600, 3600, 6 * 3600, 24 * 3600, 72 * 3600):
+        row('-%ds' % age, base, -age, -(age - 60) if age > 60 else '', fmt)
+
+    print('\nspan: from N seconds back to now')
+    for age in (60, 600, 3600, 6 * 3600, 24 * 3600):
+        row('-%ds' % age, base, -age, '', fmt)
+    row('all', base, 0, '', fmt)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Build the web UI asset bundle for the "www" data partition.
+
+usage: www_bundle.py <www dir> <output.www> [max bytes]
+
+Every file under the directory is stored under its relative path. HTML,
+JS and CSS go through the same conservative minifier as www_gzip.py and
+everything that isn't already compressed is gzipped. Layout (little
+endian), as read by main/assets.c:
+
+  header  "WWW1", u32 count, u32 total size, u32 CRC-32 of the rest
+  index   count x (char path[32], u32 offset, u32 size, u32 crc, u32 flags)
+  data    the files, 4-byte aligned
+
+An api_ca.pem in the directory is the CA the API poster verifies
+api_url against (stored as is, not gzipped).
+
+Flash it with `idf.py flash` (the build does it) or upload it from the
+firmware page; the device picks the upload route by the .www extension.
+"""
+
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+from www_gzip import minify
+
+MAGIC = b'WWW1'
+HEADER = struct.Struct('<4sIII')
+ENTRY = struct.Struct('<32sIIII')
+PATH_MAX = 32
+GZIP = 0x01
+
+MINIFY = ('.html', '.js', '.css')
+STORED = ('.png', '.jpg', '.jpeg', '.gif', '.woff', '.woff2', '.gz', '.pem')
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if path.endswith(MINIFY):
+        data = minify(data.decode('utf-8')).encode('utf-8')
+    if path.endswith(STORED):
+        return data, 0
+    return gzip.compress(data, compresslevel=9, mtime=0), GZIP
+
+
+def build(root):
+    files = []
+    for dirpath, _, names in os.walk(root):
+        for name in sorted(names):
+            full = os.path.join(dirpath, name)
+            rel = os.path.relpath(full, root).replace(os.sep, '/')
+            if len(rel.encode()) >= PATH_MAX:
+                sys.exit('www_bundle: path too long: %s' % rel)
+            files.append((rel, full))
+    files.sort()
+
+    offset = HEADER.size + ENTRY.size * len(files)
+    index, blobs = b'', b''
+    for rel, full in files:
+        data, flags = load(full)
+        pad = (-offset) % 4
+        blobs += b'\0' * pad
+        offset += pad
+        index += ENTRY.pack(rel.encode(), offset, len(data), zlib.crc32(data), flags)
+        blobs += data
+        offset += len(data)
+        print('  %-24s %6d B%s' % (rel, len(data), ' (gz)' if flags & GZIP else ''))
+
+    body = index + blobs
+    return HEADER.pack(MAGIC, len(files), HEADER.size + len(body), zlib.crc32(body)) + body
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        sys.exit(__doc__.strip().splitlines()[2])
+
+    bundle = build(sys.argv[1])
+
+    if len(sys.argv) == 4 and len(bundle) > int(sys.argv[3], 0):
+        sys.exit('www_bundle: %d bytes does not fit in %s' % (len(bundle), sys.argv[3]))
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(bundle)
+
+    print('www_bundle: %s -> %s, %d bytes' % (sys.argv[1], sys.argv[2], len(bundle)))
+
+
+if __name__ == '__main__':
+    main()
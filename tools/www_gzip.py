@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""Minify and gzip a web UI file for embedding into the firmware.
+
+usage: www_gzip.py <input.html> <output.gz>
+
+Minification is deliberately conservative: HTML and block comments are
+removed, every line is stripped and empty lines are dropped. Line breaks
+are kept so JavaScript automatic semicolon insertion is unaffected.
+The gzip header carries no timestamp, so identical input always yields
+an identical blob (and therefore an identical ETag on the device).
+"""
+
+import gzip
+import re
+import sys
+
+
+def minify(text):
+    text = re.sub(r'<!--.*?-->', '', text, flags=re.S)
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if not line or line.startswith('//'):
+            continue
+        lines.append(line)
+    return '\n'.join(lines) + '\n'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip().splitlines()[2])
+
+    with open(sys.argv[1], encoding='utf-8') as f:
+        raw = f.read()
+
+    mini = minify(raw).encode('utf-8')
+    blob = gzip.compress(mini, compresslevel=9, mtime=0)
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(blob)
+
+    print('www_gzip: %s %d -> %d (min) -> %d (gz) bytes' %
+          (sys.argv[1], len(raw.encode('utf-8')), len(mini), len(blob)))
+
+
+if __name__ == '__main__':
+    main()